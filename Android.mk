@@ -12,7 +12,7 @@ LOCAL_C_INCLUDES  := \
 	${MEMMGR_SRC_PATH}/include \
 
 LOCAL_SRC_FILES := \
-	$(subst $(LOCAL_PATH)/,,$(shell find $(LOCAL_PATH) -name "*.cpp" -print)) \
+	$(subst $(LOCAL_PATH)/,,$(shell find $(LOCAL_PATH)/source -name "*.cpp" -print)) \
 	
 include $(BUILD_STATIC_LIBRARY)	
 
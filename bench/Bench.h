@@ -0,0 +1,66 @@
+#ifndef _MEMMGR_BENCH_H_
+#define _MEMMGR_BENCH_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <chrono>
+
+namespace bench
+{
+
+// milliseconds of the fastest of 'runs' calls to f()
+template <typename F>
+double Measure(F f, int runs = 5)
+{
+	double best = 0;
+	for (int i = 0; i < runs; ++i)
+	{
+		auto start = std::chrono::steady_clock::now();
+		f();
+		std::chrono::duration<double, std::milli> ms = std::chrono::steady_clock::now() - start;
+		if (i == 0 || ms.count() < best) {
+			best = ms.count();
+		}
+	}
+	return best;
+}
+
+// one line per case, relative to the reference case of its group
+inline void Report(const char* name, double ms, double ref_ms)
+{
+	printf("  %-36s %9.2f ms  %5.2fx\n", name, ms, ref_ms / ms);
+}
+
+// xorshift64, the same sequence on every platform
+class Random
+{
+public:
+	explicit Random(uint64_t seed = 0x9E3779B97F4A7C15ull) : m_state(seed) {}
+
+	uint64_t Next()
+	{
+		m_state ^= m_state << 13;
+		m_state ^= m_state >> 7;
+		m_state ^= m_state << 17;
+		return m_state;
+	}
+
+	// in [0, n)
+	size_t Below(size_t n) { return static_cast<size_t>(Next() % n); }
+
+private:
+	uint64_t m_state;
+
+}; // Random
+
+// keeps the compiler from dropping a computed value
+template <typename T>
+inline void DoNotOptimize(const T& value)
+{
+	asm volatile("" : : "r,m"(value) : "memory");
+}
+
+}
+
+#endif // _MEMMGR_BENCH_H_
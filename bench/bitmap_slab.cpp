@@ -0,0 +1,121 @@
+// BlockAllocator's two ways of tracking free blocks, MODE_FREELIST and
+// MODE_BITMAP, on the same workloads for a few block sizes.
+
+#include "Bench.h"
+
+#include "memmgr/BlockAllocator.h"
+
+#include <algorithm>
+#include <vector>
+
+namespace
+{
+
+const size_t kPageSize = 16384;
+const size_t kBlocks   = 400000;
+const size_t kChurn    = 2000000;
+const size_t kMaxBatch = 256;
+
+// allocates every block, then frees them in allocation order
+double BenchFillDrain(mm::BlockAllocator& alloc)
+{
+	std::vector<void*> blocks(kBlocks);
+	return bench::Measure([&]() {
+		for (size_t i = 0; i < kBlocks; ++i) {
+			blocks[i] = alloc.Allocate();
+		}
+		for (size_t i = 0; i < kBlocks; ++i) {
+			alloc.Free(blocks[i]);
+		}
+	});
+}
+
+// frees a large live set in random order, so most blocks are cold; the
+// free list writes into each of them, the bitmap only into page headers
+double BenchColdFree(mm::BlockAllocator& alloc)
+{
+	bench::Random rnd;
+	std::vector<void*> blocks(kBlocks);
+	double best = 0;
+	for (int run = 0; run < 5; ++run)
+	{
+		for (size_t i = 0; i < kBlocks; ++i) {
+			blocks[i] = alloc.Allocate();
+		}
+		for (size_t i = kBlocks; i > 1; --i) {
+			std::swap(blocks[i - 1], blocks[rnd.Below(i)]);
+		}
+		double ms = bench::Measure([&]() {
+			for (size_t i = 0; i < kBlocks; ++i) {
+				alloc.Free(blocks[i]);
+			}
+		}, 1);
+		if (run == 0 || ms < best) {
+			best = ms;
+		}
+	}
+	return best;
+}
+
+// random batches freed and allocated again over a live set
+double BenchChurn(mm::BlockAllocator& alloc)
+{
+	bench::Random rnd;
+	std::vector<void*> live(kBlocks / 4);
+	for (void*& p : live) {
+		p = alloc.Allocate();
+	}
+	std::vector<size_t> batch;
+	double ms = bench::Measure([&]() {
+		for (size_t done = 0; done < kChurn; done += batch.size())
+		{
+			batch.clear();
+			for (size_t n = 1 + rnd.Below(kMaxBatch); n > 0; --n)
+			{
+				size_t slot = rnd.Below(live.size());
+				if (live[slot]) {
+					alloc.Free(live[slot]);
+					live[slot] = nullptr;
+					batch.push_back(slot);
+				}
+			}
+			for (size_t slot : batch) {
+				live[slot] = alloc.Allocate();
+			}
+		}
+	});
+	for (void* p : live) {
+		alloc.Free(p);
+	}
+	return ms;
+}
+
+void Run(size_t data_size)
+{
+	mm::BlockAllocator freelist(data_size, kPageSize, 4, mm::BlockAllocator::MODE_FREELIST);
+	mm::BlockAllocator bitmap(data_size, kPageSize, 4, mm::BlockAllocator::MODE_BITMAP);
+
+	printf("%zu byte blocks\n", data_size);
+
+	double ref = BenchFillDrain(freelist);
+	bench::Report("fill and drain, free list", ref, ref);
+	bench::Report("fill and drain, bitmap", BenchFillDrain(bitmap), ref);
+
+	ref = BenchColdFree(freelist);
+	bench::Report("free in random order, free list", ref, ref);
+	bench::Report("free in random order, bitmap", BenchColdFree(bitmap), ref);
+
+	ref = BenchChurn(freelist);
+	bench::Report("random churn, free list", ref, ref);
+	bench::Report("random churn, bitmap", BenchChurn(bitmap), ref);
+}
+
+}
+
+int main()
+{
+	Run(16);
+	Run(64);
+	Run(256);
+	return 0;
+}
@@ -0,0 +1,124 @@
+// The buddy tier against glibc malloc on medium sizes: random frees and
+// allocations over a live set, through BuddyAllocator itself and through
+// BlockAllocatorPool, which sends these sizes to its buddy tier.
+
+#include "Bench.h"
+
+#include "memmgr/BlockAllocatorPool.h"
+#include "memmgr/BuddyAllocator.h"
+
+#include <stdlib.h>
+
+#include <vector>
+
+namespace
+{
+
+const size_t kOps = 1000000;
+
+struct Workload
+{
+	const char* name;
+	size_t live;
+	size_t min_size;
+	// sizes are spread evenly over the octaves up to max_size, and more
+	// often small when 'skewed'
+	size_t max_size;
+	bool   skewed;
+};
+
+const Workload kWorkloads[] = {
+	{ "1KB-1MB, mostly small, 256 live", 256, 1024, 1024 * 1024, true },
+	{ "1KB-16KB, 4096 live", 4096, 1024, 16 * 1024, false },
+	{ "4KB-256KB, 512 live", 512, 4096, 256 * 1024, false },
+};
+
+size_t NextSize(const Workload& w, bench::Random& rnd)
+{
+	size_t octaves = 0;
+	while ((w.min_size << (octaves + 1)) <= w.max_size) {
+		++octaves;
+	}
+	size_t octave = rnd.Below(octaves + 1);
+	if (w.skewed) {
+		size_t other = rnd.Below(octaves + 1);
+		octave = other < octave ? other : octave;
+	}
+	size_t base = w.min_size << octave;
+	size_t size = base + rnd.Below(base);
+	return size > w.max_size ? w.max_size : size;
+}
+
+// replaces a random live block kOps times; the first byte of every block
+// is written, as a caller would. inspect() sees the bytes requested by the
+// last live set, before it is freed.
+template <typename Alloc, typename Free, typename Inspect>
+double Run(const Workload& w, Alloc alloc, Free release, Inspect inspect)
+{
+	std::vector<void*>  blocks(w.live, nullptr);
+	std::vector<size_t> sizes(w.live, 0);
+	double ms = bench::Measure([&]() {
+		bench::Random rnd;
+		for (size_t i = 0; i < kOps; ++i)
+		{
+			size_t slot = rnd.Below(w.live);
+			if (blocks[slot]) {
+				release(blocks[slot], sizes[slot]);
+			}
+			sizes[slot] = NextSize(w, rnd);
+			blocks[slot] = alloc(sizes[slot]);
+			*static_cast<volatile char*>(blocks[slot]) = 1;
+		}
+	}, 3);
+
+	size_t requested = 0;
+	for (size_t s : sizes) {
+		requested += s;
+	}
+	inspect(requested);
+	for (size_t i = 0; i < w.live; ++i) {
+		if (blocks[i]) {
+			release(blocks[i], sizes[i]);
+		}
+	}
+	return ms;
+}
+
+}
+
+int main()
+{
+	for (const Workload& w : kWorkloads)
+	{
+		printf("%s, %zu random frees and allocations\n", w.name, kOps);
+
+		double ref = Run(w, [](size_t size) { return malloc(size); },
+			[](void* p, size_t) { free(p); }, [](size_t) {});
+		bench::Report("glibc malloc", ref, ref);
+
+		mm::BuddyAllocator buddy;
+		size_t requested = 0;
+		mm::BuddyAllocator::Stats stats = {};
+		double ms = Run(w, [&](size_t size) {
+				return buddy.Allocate(size);
+			}, [&](void* p, size_t size) {
+				buddy.Free(p, size);
+			}, [&](size_t bytes) {
+				requested = bytes;
+				stats = buddy.GetStats();
+			});
+		bench::Report("mm::BuddyAllocator", ms, ref);
+
+		// the default config sends sizes up to 1MB to the buddy tier
+		mm::BlockAllocatorPool pool;
+		bench::Report("mm::BlockAllocatorPool", Run(w, [&](size_t size) {
+				return pool.Allocate(size);
+			}, [&](void* p, size_t size) {
+				pool.Free(p, size);
+			}, [](size_t) {}), ref);
+
+		printf("  %-36s %6.1f MB requested, %6.1f MB in blocks, %6.1f MB of regions\n", "buddy footprint",
+			requested / 1048576.0, stats.live_bytes / 1048576.0, stats.region_bytes / 1048576.0);
+	}
+	return 0;
+}
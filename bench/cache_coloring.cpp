@@ -0,0 +1,109 @@
+// Cache-line coloring of BlockAllocator pages, and cache-line aligned
+// blocks for data written by different threads.
+
+#include "Bench.h"
+
+#include "memmgr/BlockAllocator.h"
+#include "memmgr/BlockAllocatorPool.h"
+
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+const size_t kPageSize  = 8192;
+const size_t kDataSize  = 3000;
+const size_t kPages     = 512;
+const int    kPasses    = 2000;
+
+const size_t   kThreads    = 4;
+const uint64_t kIncrements = 20000000;
+
+// Reads the first line of every block, as a pass over object headers.
+// Without coloring the blocks sit at the same few offsets of every page,
+// so the lines compete for a handful of cache sets.
+double BenchHeaders(bool coloring)
+{
+	mm::BlockAllocator alloc(kDataSize, kPageSize, 4);
+	alloc.SetColoring(coloring);
+
+	std::vector<uint64_t*> blocks(kPages * alloc.GetBlocksPerPage());
+	for (uint64_t*& p : blocks) {
+		p = static_cast<uint64_t*>(alloc.Allocate());
+		*p = 1;
+	}
+
+	printf("  %-36s %9zu\n", coloring ? "colors, colored" : "colors, uncolored", alloc.GetColorCount());
+	double ms = bench::Measure([&]() {
+		uint64_t sum = 0;
+		for (int pass = 0; pass < kPasses; ++pass) {
+			for (uint64_t* p : blocks) {
+				sum += *p;
+			}
+		}
+		bench::DoNotOptimize(sum);
+	});
+
+	for (uint64_t* p : blocks) {
+		alloc.Free(p);
+	}
+	return ms;
+}
+
+// each thread bumps its own counter, allocated next to the others
+double BenchCounters(bool cache_aligned)
+{
+	mm::BlockAllocatorPool* pool = mm::BlockAllocatorPool::Instance();
+
+	volatile uint64_t* counters[kThreads];
+	for (size_t i = 0; i < kThreads; ++i)
+	{
+		void* p = cache_aligned ? pool->AllocateCacheAligned(sizeof(uint64_t)) : pool->Allocate(sizeof(uint64_t));
+		counters[i] = static_cast<volatile uint64_t*>(p);
+		*counters[i] = 0;
+	}
+
+	double ms = bench::Measure([&]() {
+		std::vector<std::thread> threads;
+		for (size_t i = 0; i < kThreads; ++i)
+		{
+			volatile uint64_t* counter = counters[i];
+			threads.emplace_back([counter]() {
+				for (uint64_t n = 0; n < kIncrements; ++n) {
+					*counter = *counter + 1;
+				}
+			});
+		}
+		for (std::thread& t : threads) {
+			t.join();
+		}
+	}, 3);
+
+	for (size_t i = 0; i < kThreads; ++i)
+	{
+		void* p = const_cast<uint64_t*>(counters[i]);
+		if (cache_aligned) {
+			pool->FreeCacheAligned(p, sizeof(uint64_t));
+		} else {
+			pool->Free(p, sizeof(uint64_t));
+		}
+	}
+	return ms;
+}
+
+}
+
+int main()
+{
+	printf("first line of %zu byte blocks over %zu pages of %zu, x %d\n", kDataSize, kPages, kPageSize, kPasses);
+	double ref = BenchHeaders(false);
+	bench::Report("uncolored pages", ref, ref);
+	bench::Report("colored pages", BenchHeaders(true), ref);
+
+	printf("%zu threads, %llu increments each of adjacent counters\n", kThreads, (unsigned long long)kIncrements);
+	ref = BenchCounters(false);
+	bench::Report("Allocate(8)", ref, ref);
+	bench::Report("AllocateCacheAligned(8)", BenchCounters(true), ref);
+	return 0;
+}
@@ -0,0 +1,94 @@
+// local_shared_ptr and intrusive_ptr against std::shared_ptr: creation,
+// and a copy-heavy pass that copies a set of pointers and drops the copies.
+
+#include "Bench.h"
+
+#include "memmgr/Allocator.h"
+#include "memmgr/IntrusivePtr.h"
+#include "memmgr/LocalSharedPtr.h"
+
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+const size_t kObjects = 1024;
+const int    kRounds  = 2000;
+
+struct Payload
+{
+	int values[6];
+	Payload() : values() {}
+};
+
+struct IntrusivePayload : public mm::LocalRefCounted<IntrusivePayload>
+{
+	int values[6];
+	IntrusivePayload() : values() {}
+};
+
+template <typename Ptr, typename Make>
+double BenchCreate(Make make)
+{
+	return bench::Measure([&]() {
+		std::vector<Ptr> ptrs;
+		ptrs.reserve(kObjects);
+		for (int r = 0; r < kRounds / 10; ++r) {
+			for (size_t i = 0; i < kObjects; ++i) {
+				ptrs.push_back(make());
+			}
+			ptrs.clear();
+		}
+	});
+}
+
+template <typename Ptr, typename Make>
+double BenchCopy(Make make)
+{
+	std::vector<Ptr> src;
+	for (size_t i = 0; i < kObjects; ++i) {
+		src.push_back(make());
+	}
+	return bench::Measure([&]() {
+		std::vector<Ptr> copies;
+		copies.reserve(kObjects * 4);
+		for (int r = 0; r < kRounds; ++r) {
+			// a few owners per object, as when handing jobs their data
+			for (int k = 0; k < 4; ++k) {
+				copies.insert(copies.end(), src.begin(), src.end());
+			}
+			bench::DoNotOptimize(copies.back().get());
+			copies.clear();
+		}
+	});
+}
+
+}
+
+int main()
+{
+	// std::shared_ptr counts atomically once the process has a thread
+	std::thread([]() {}).join();
+
+	printf("create and drop %zu objects x %d\n", kObjects, kRounds / 10);
+	double ref = BenchCreate<std::shared_ptr<Payload>>([]() { return std::make_shared<Payload>(); });
+	bench::Report("std::make_shared", ref, ref);
+	bench::Report("mm::allocate_shared", BenchCreate<std::shared_ptr<Payload>>(
+		[]() { return mm::allocate_shared<Payload>(); }), ref);
+	bench::Report("mm::make_local_shared", BenchCreate<mm::local_shared_ptr<Payload>>(
+		[]() { return mm::make_local_shared<Payload>(); }), ref);
+	bench::Report("mm::make_intrusive", BenchCreate<mm::intrusive_ptr<IntrusivePayload>>(
+		[]() { return mm::make_intrusive<IntrusivePayload>(); }), ref);
+
+	printf("copy %zu pointers 4 times and drop the copies x %d\n", kObjects, kRounds);
+	ref = BenchCopy<std::shared_ptr<Payload>>([]() { return std::make_shared<Payload>(); });
+	bench::Report("std::shared_ptr", ref, ref);
+	bench::Report("mm::local_shared_ptr", BenchCopy<mm::local_shared_ptr<Payload>>(
+		[]() { return mm::make_local_shared<Payload>(); }), ref);
+	bench::Report("mm::intrusive_ptr", BenchCopy<mm::intrusive_ptr<IntrusivePayload>>(
+		[]() { return mm::make_intrusive<IntrusivePayload>(); }), ref);
+
+	return 0;
+}
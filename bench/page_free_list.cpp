@@ -0,0 +1,185 @@
+// Locality of BlockAllocator's free list per page against the single free
+// list threaded through every page that it replaced, after random churn:
+// how many 4KB pages a run of consecutive allocations is spread over, and
+// the cost of walking those blocks in allocation order.
+
+#include "Bench.h"
+
+#include "memmgr/BlockAllocator.h"
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <set>
+#include <vector>
+
+namespace
+{
+
+const size_t kDataSize  = 64;
+const size_t kPageSize  = 8192;
+const size_t kLive      = 200000;
+const size_t kChurn     = 2000000;
+const size_t kMaxBatch  = 256;
+const size_t kRun       = 50000;
+const size_t kWindow    = 64;
+const int    kWalks     = 20;
+
+// The layout BlockAllocator had before the page-local lists: one LIFO
+// list through the free blocks of all pages, new pages from the heap.
+class GlobalFreeListAllocator
+{
+public:
+	GlobalFreeListAllocator(size_t data_size, size_t page_size)
+		: m_block_size(data_size), m_blocks_per_page(page_size / data_size), m_page_size(page_size), m_free(nullptr) {}
+	~GlobalFreeListAllocator()
+	{
+		for (uint8_t* page : m_pages) {
+			delete[] page;
+		}
+	}
+
+	void* Allocate()
+	{
+		if (!m_free)
+		{
+			uint8_t* page = new uint8_t[m_page_size];
+			m_pages.push_back(page);
+			for (size_t i = m_blocks_per_page; i-- > 0; ) {
+				Free(page + i * m_block_size);
+			}
+		}
+		Block* block = m_free;
+		m_free = block->next;
+		return block;
+	}
+
+	void Free(void* p)
+	{
+		Block* block = static_cast<Block*>(p);
+		block->next = m_free;
+		m_free = block;
+	}
+
+private:
+	struct Block
+	{
+		Block* next;
+	};
+
+	size_t m_block_size;
+	size_t m_blocks_per_page;
+	size_t m_page_size;
+	Block* m_free;
+	std::vector<uint8_t*> m_pages;
+
+}; // GlobalFreeListAllocator
+
+struct Node
+{
+	Node*    next;
+	uint64_t value;
+};
+
+template <typename Alloc>
+void Run(const char* name, Alloc& alloc, double* ref_ms)
+{
+	bench::Random rnd;
+
+	// live set with holes in random places
+	std::vector<void*> live(kLive);
+	for (size_t i = 0; i < kLive; ++i) {
+		live[i] = alloc.Allocate();
+	}
+	// frees a batch and refills it in another order, since a LIFO list
+	// would hand the block just freed straight back
+	std::vector<size_t> batch;
+	double churn_ms = bench::Measure([&]() {
+		for (size_t done = 0; done < kChurn; done += batch.size())
+		{
+			batch.clear();
+			for (size_t n = 1 + rnd.Below(kMaxBatch); n > 0; --n)
+			{
+				size_t slot = rnd.Below(kLive);
+				if (live[slot]) {
+					alloc.Free(live[slot]);
+					live[slot] = nullptr;
+					batch.push_back(slot);
+				}
+			}
+			for (size_t i = batch.size(); i > 1; --i) {
+				std::swap(batch[i - 1], batch[rnd.Below(i)]);
+			}
+			for (size_t slot : batch) {
+				live[slot] = alloc.Allocate();
+			}
+		}
+	}, 1);
+	for (size_t i = 0; i < kLive; i += 2) {
+		alloc.Free(live[i]);
+	}
+
+	// a list built in allocation order, as a container filled at once
+	std::vector<Node*> run(kRun);
+	for (size_t i = 0; i < kRun; ++i) {
+		run[i] = static_cast<Node*>(alloc.Allocate());
+		run[i]->value = i;
+	}
+	for (size_t i = 0; i + 1 < kRun; ++i) {
+		run[i]->next = run[i + 1];
+	}
+	run[kRun - 1]->next = nullptr;
+
+	size_t spread = 0;
+	for (size_t i = 0; i + kWindow <= kRun; i += kWindow)
+	{
+		std::set<uintptr_t> pages;
+		for (size_t j = i; j < i + kWindow; ++j) {
+			pages.insert(reinterpret_cast<uintptr_t>(run[j]) >> 12);
+		}
+		spread += pages.size();
+	}
+
+	double walk_ms = bench::Measure([&]() {
+		uint64_t sum = 0;
+		for (int w = 0; w < kWalks; ++w) {
+			for (Node* n = run[0]; n; n = n->next) {
+				sum += n->value;
+			}
+		}
+		bench::DoNotOptimize(sum);
+	});
+
+	if (*ref_ms == 0) {
+		*ref_ms = walk_ms;
+	}
+	printf("%s\n", name);
+	printf("  %-36s %9.2f ms\n", "churn", churn_ms);
+	printf("  %-36s %9.2f\n", "4KB pages per 64 allocations", (double)spread / (kRun / kWindow));
+	bench::Report("walk in allocation order", walk_ms, *ref_ms);
+
+	for (Node* n : run) {
+		alloc.Free(n);
+	}
+	for (size_t i = 1; i < kLive; i += 2) {
+		alloc.Free(live[i]);
+	}
+}
+
+}
+
+int main()
+{
+	printf("%zu byte blocks, %zu live, %zu random frees and allocations\n", kDataSize, kLive, kChurn);
+
+	double ref = 0;
+	{
+		GlobalFreeListAllocator alloc(kDataSize, kPageSize);
+		Run("global free list", alloc, &ref);
+	}
+	{
+		mm::BlockAllocator alloc(kDataSize, kPageSize, 4);
+		Run("free list per page", alloc, &ref);
+	}
+	return 0;
+}
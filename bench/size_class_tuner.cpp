@@ -0,0 +1,96 @@
+// Picks pool size classes for a request histogram written by
+// BlockAllocatorPool::DumpHistogram(), prints them with their expected
+// waste next to the built-in table's, and optionally saves them for
+// Config::block_sizes or as source for -DMEMMGR_BLOCK_SIZES.
+
+#include "memmgr/BlockAllocatorPool.h"
+#include "memmgr/SizeClassTuner.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+namespace
+{
+
+void Usage()
+{
+	printf("usage: size_class_tuner <histogram> <max classes> [options]\n"
+	       "  --align <bytes>   class alignment, 4 by default\n"
+	       "  --table <file>    saves the classes one per line, for Config::block_sizes\n"
+	       "  --source <file>   saves the classes as a kBlockSizes definition\n");
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc < 3) {
+		Usage();
+		return 1;
+	}
+
+	const char* histogram = argv[1];
+	size_t max_classes = strtoul(argv[2], nullptr, 0);
+	size_t alignment = 4;
+	const char* table = nullptr;
+	const char* source = nullptr;
+
+	for (int i = 3; i < argc; ++i)
+	{
+		const char* arg = argv[i];
+		const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+		if (strcmp(arg, "--align") == 0 && value) {
+			alignment = strtoul(value, nullptr, 0);
+		} else if (strcmp(arg, "--table") == 0 && value) {
+			table = value;
+		} else if (strcmp(arg, "--source") == 0 && value) {
+			source = value;
+		} else {
+			Usage();
+			return 1;
+		}
+		++i;
+	}
+	if (max_classes == 0 || alignment == 0 || (alignment & (alignment - 1)) != 0) {
+		Usage();
+		return 1;
+	}
+
+	mm::SizeClassTuner tuner;
+	if (!tuner.LoadHistogram(histogram)) {
+		printf("can't read %s\n", histogram);
+		return 1;
+	}
+
+	std::vector<uint32_t> sizes(max_classes);
+	size_t n = tuner.Optimize(max_classes, alignment, sizes.data());
+	if (n == 0) {
+		printf("no requests in %s\n", histogram);
+		return 1;
+	}
+
+	printf("%zu classes:", n);
+	for (size_t i = 0; i < n; ++i) {
+		printf(" %u", sizes[i]);
+	}
+	printf("\n");
+
+	size_t default_count;
+	const uint32_t* default_sizes = mm::BlockAllocatorPool::GetDefaultBlockSizes(default_count);
+	printf("expected waste per request: %.2f bytes, built-in table of %zu classes %.2f bytes\n",
+		tuner.CalcExpectedWaste(sizes.data(), n), default_count,
+		tuner.CalcExpectedWaste(default_sizes, default_count));
+
+	if (table && !mm::SizeClassTuner::DumpClassTable(table, sizes.data(), n)) {
+		printf("can't write %s\n", table);
+		return 1;
+	}
+	if (source && !mm::SizeClassTuner::DumpClassTableSource(source, sizes.data(), n)) {
+		printf("can't write %s\n", source);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,109 @@
+// Replays a trace recorded with AllocTrace against malloc or against a
+// BlockAllocatorPool built from the options, and reports time, peak live
+// bytes, peak RSS growth and fragmentation. Run each target in its own
+// process, so one replay's freed memory doesn't hide the next one's growth.
+
+#include "memmgr/AllocTrace.h"
+#include "memmgr/BlockAllocatorPool.h"
+#include "memmgr/SizeClassTuner.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+namespace
+{
+
+void Usage()
+{
+	printf("usage: trace_replay <trace> [pool|malloc] [options]\n"
+	       "  --classes <file>    size classes, one per line, as SizeClassTuner writes them\n"
+	       "  --min-page <bytes>  smallest page of a size class\n"
+	       "  --max-page <bytes>  largest page of a size class\n"
+	       "  --buddy-max <bytes> largest size of the buddy tier, 0 turns it off\n"
+	       "  --sources <pfl>     recorded sources to replay: pool, freelist, linear\n");
+}
+
+bool ParseSources(const char* arg, uint32_t& mask)
+{
+	mask = 0;
+	for (const char* c = arg; *c; ++c)
+	{
+		switch (*c)
+		{
+		case 'p':
+			mask |= 1u << mm::AllocTrace::SOURCE_POOL;
+			break;
+		case 'f':
+			mask |= 1u << mm::AllocTrace::SOURCE_FREELIST;
+			break;
+		case 'l':
+			mask |= 1u << mm::AllocTrace::SOURCE_LINEAR;
+			break;
+		default:
+			return false;
+		}
+	}
+	return mask != 0;
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc < 2) {
+		Usage();
+		return 1;
+	}
+
+	const char* trace = argv[1];
+	mm::AllocTrace::ReplayTarget target = mm::AllocTrace::REPLAY_POOL;
+	mm::BlockAllocatorPool::Config cfg = mm::BlockAllocatorPool::GetDefaultConfig();
+	uint32_t source_mask = ~0u;
+	std::vector<uint32_t> classes;
+
+	for (int i = 2; i < argc; ++i)
+	{
+		const char* arg = argv[i];
+		const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+		if (strcmp(arg, "pool") == 0) {
+			target = mm::AllocTrace::REPLAY_POOL;
+		} else if (strcmp(arg, "malloc") == 0) {
+			target = mm::AllocTrace::REPLAY_MALLOC;
+		} else if (strcmp(arg, "--classes") == 0 && value) {
+			classes.resize(4096);
+			classes.resize(mm::SizeClassTuner::LoadClassTable(value, classes.data(), classes.size()));
+			if (classes.empty()) {
+				printf("can't read size classes from %s\n", value);
+				return 1;
+			}
+			cfg.block_sizes     = classes.data();
+			cfg.num_block_sizes = classes.size();
+			++i;
+		} else if (strcmp(arg, "--min-page") == 0 && value) {
+			cfg.min_page_size = strtoul(value, nullptr, 0);
+			++i;
+		} else if (strcmp(arg, "--max-page") == 0 && value) {
+			cfg.max_page_size = strtoul(value, nullptr, 0);
+			++i;
+		} else if (strcmp(arg, "--buddy-max") == 0 && value) {
+			cfg.buddy_max_size = strtoul(value, nullptr, 0);
+			++i;
+		} else if (strcmp(arg, "--sources") == 0 && value && ParseSources(value, source_mask)) {
+			++i;
+		} else {
+			Usage();
+			return 1;
+		}
+	}
+
+	mm::AllocTrace::ReplayResult result;
+	if (!mm::AllocTrace::Replay(trace, target, &cfg, source_mask, result)) {
+		printf("can't replay %s\n", trace);
+		return 1;
+	}
+	mm::AllocTrace::DumpReplayResult(result, target == mm::AllocTrace::REPLAY_POOL ? "pool: " : "malloc: ");
+	return 0;
+}
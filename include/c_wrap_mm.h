@@ -11,6 +11,29 @@ extern "C"
 void* mm_alloc(size_t size);
 void  mm_free(void* p, size_t size);
 
+// zeroed, free it with mm_free(p, count * size); NULL on overflow
+void* mm_calloc(size_t count, size_t size);
+// stays in place while both sizes fall in the same size class; p may be
+// NULL, and new_size 0 frees p and returns NULL
+void* mm_realloc(void* p, size_t old_size, size_t new_size);
+// bytes usable in a block allocated with 'size'
+size_t mm_usable_size(void* p, size_t size);
+
+typedef struct mm_pool_stats
+{
+	// memory held in pool pages
+	size_t page_bytes;
+	// pool blocks in use, and free in the pages
+	size_t used_bytes;
+	size_t free_bytes;
+	// blocks above the largest size class
+	size_t large_bytes;
+} mm_pool_stats;
+
+// the calling thread's pool
+void mm_stats(mm_pool_stats* stats);
+void mm_trim(void);
+
 #endif // _memmgr_wrap_c_h_
 
 #ifdef __cplusplus
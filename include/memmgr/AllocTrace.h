@@ -0,0 +1,136 @@
+#ifndef _MEMMGR_ALLOC_TRACE_H_
+#define _MEMMGR_ALLOC_TRACE_H_
+
+#include "memmgr/BlockAllocatorPool.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+
+namespace mm
+{
+
+// Records the allocations and frees of BlockAllocatorPool,
+// FreelistAllocator and LinearAllocator to a file, to replay them later
+// against another configuration. The hooks are only compiled in when the
+// library is built with MEMMGR_TRACE defined.
+//
+// Each thread appends to its own buffer without locking. A full buffer is
+// copied as one chunk into the memory-mapped trace file, at an offset
+// claimed with an atomic add. Buffers are also flushed on thread exit,
+// by Flush(), and by Stop() for the calling thread.
+class AllocTrace
+{
+public:
+	enum Op
+	{
+		OP_ALLOC,
+		OP_FREE,
+	};
+
+	enum Source
+	{
+		SOURCE_POOL,
+		SOURCE_FREELIST,
+		SOURCE_LINEAR,
+	};
+
+	// 16 bytes per operation
+	struct Record
+	{
+		// block address, turned back into an identity on replay
+		uint64_t ptr;
+		uint32_t size;
+		// op in bits 30-31, source in bits 28-29, and the nanoseconds since
+		// the thread's previous record in bits 0-27; a longer gap starts a
+		// new chunk
+		uint32_t info;
+
+		Op       GetOp() const     { return static_cast<Op>(info >> 30); }
+		Source   GetSource() const { return static_cast<Source>((info >> 28) & 3); }
+		uint32_t GetDelta() const  { return info & DELTA_MASK; }
+	};
+
+	// every chunk starts with this, followed by 'count' records
+	struct ChunkHeader
+	{
+		uint32_t thread;
+		uint32_t count;
+		// steady clock time the first record's delta counts from
+		uint64_t base_ns;
+	};
+
+	static const uint32_t DELTA_MASK = (1u << 28) - 1;
+
+	// starts a trace into a file of at most 'max_bytes'; chunks that don't
+	// fit are dropped and counted
+	static bool Start(const char* filepath, size_t max_bytes);
+	// stops recording and trims the file; threads still recording must not
+	// be inside an allocator call
+	static void Stop();
+	// writes the calling thread's buffer
+	static void Flush();
+
+	static bool IsActive() { return m_active.load(std::memory_order_relaxed); }
+
+	static void Append(Op op, Source source, const void* p, size_t size);
+
+	// records lost because the file was full
+	static uint64_t GetDroppedCount();
+
+public:
+	enum ReplayTarget
+	{
+		// a BlockAllocatorPool built from the given config
+		REPLAY_POOL,
+		// malloc() and free()
+		REPLAY_MALLOC,
+	};
+
+	struct ReplayResult
+	{
+		uint64_t ops;
+		uint64_t elapsed_ns;
+		// peak of the requested bytes that were live at once
+		size_t   peak_live;
+		// peak resident set growth over the start of the replay, sampled;
+		// 0 where the platform can't report it. Memory the process already
+		// freed is reused without growing it, so compare replays run in
+		// fresh processes.
+		size_t   peak_rss;
+		// share of peak_rss not used by live blocks
+		float    fragmentation;
+	};
+
+	// Re-executes the operations from the sources in 'source_mask' (bits
+	// of 1 << Source) on the calling thread, in the recorded order across
+	// threads. Frees of blocks allocated before the trace started are
+	// skipped. 'cfg' is only used by REPLAY_POOL, nullptr means default.
+	static bool Replay(const char* filepath, ReplayTarget target, const BlockAllocatorPool::Config* cfg,
+		uint32_t source_mask, ReplayResult& result);
+
+	static void DumpReplayResult(const ReplayResult& result, const char* prefix = "");
+
+private:
+	static std::atomic<bool> m_active;
+
+}; // AllocTrace
+
+}
+
+#ifdef MEMMGR_TRACE
+#define MEMMGR_TRACE_OP(op, source, p, size)                                         \
+	do {                                                                             \
+		if (mm::AllocTrace::IsActive()) {                                            \
+			mm::AllocTrace::Append(mm::AllocTrace::op, mm::AllocTrace::source, p, size); \
+		}                                                                            \
+	} while (0)
+#else
+#define MEMMGR_TRACE_OP(op, source, p, size) ((void)0)
+#endif // MEMMGR_TRACE
+
+#define MEMMGR_TRACE_ALLOC(source, p, size) MEMMGR_TRACE_OP(OP_ALLOC, source, p, size)
+#define MEMMGR_TRACE_FREE(source, p, size)  MEMMGR_TRACE_OP(OP_FREE, source, p, size)
+
+#endif // _MEMMGR_ALLOC_TRACE_H_
@@ -2,9 +2,12 @@
 #define _MEMMGR_ALLOCATOR_H_
 
 #include "memmgr/BlockAllocatorPool.h"
+#include "memmgr/Arena.h"
 
 #include <memory>
 #include <limits>
+#include <new>
+#include <type_traits>
 
 #include <vector>
 #include <deque>
@@ -42,6 +45,17 @@ public:
 		BlockAllocatorPool::Instance()->Free(p, size);
 	}
 
+	// charged to 'tag' rather than the current one, see MemoryTags
+	static void* Allocate(size_t size, MemoryTag tag)
+	{
+		return BlockAllocatorPool::Instance()->Allocate(size, tag);
+	}
+
+	static void Free(void* p, size_t size, MemoryTag tag)
+	{
+		BlockAllocatorPool::Instance()->Free(p, size, tag);
+	}
+
 }; // AllocHelper
 
 template<typename T>
@@ -55,30 +69,43 @@ struct Allocator
     typedef const T& const_reference;
     typedef T value_type;
 
+    // a container keeps the arena it was created with on copy assignment,
+    // and takes the source's on move assignment and swap, so both stay O(1)
+    typedef std::false_type propagate_on_container_copy_assignment;
+    typedef std::true_type  propagate_on_container_move_assignment;
+    typedef std::true_type  propagate_on_container_swap;
+    typedef std::false_type is_always_equal;
+
     template<typename U>
     struct rebind {typedef Allocator<U> other;};
 
     Allocator() throw() {};
-    Allocator(const Allocator& other) throw() {};
+    explicit Allocator(const Arena& arena) throw() : arena(arena) {};
+    Allocator(const Allocator& other) throw() : arena(other.arena) {};
 
     template<typename U>
-    Allocator(const Allocator<U>& other) throw() {};
+    Allocator(const Allocator<U>& other) throw() : arena(other.arena) {};
 
     template<typename U>
-    Allocator& operator = (const Allocator<U>& other) { return *this; }
-    Allocator<T>& operator = (const Allocator& other) { return *this; }
+    Allocator& operator = (const Allocator<U>& other) { arena = other.arena; return *this; }
+    Allocator<T>& operator = (const Allocator& other) { arena = other.arena; return *this; }
     ~Allocator() {}
 
+    // throws std::bad_alloc when the arena is out of memory or over budget
     pointer allocate(size_type n, const void* hint = 0)
     {
         //return static_cast<T*>(::operator new(n * sizeof(T)));
-		return static_cast<T*>(BlockAllocatorPool::Instance()->Allocate(n * sizeof(T)));
+		void* p = arena.Allocate(n * sizeof(T));
+		if (!p) {
+			throw std::bad_alloc();
+		}
+		return static_cast<T*>(p);
     }
 
     void deallocate(T* ptr, size_type n)
     {
 		//::operator delete(ptr);
-		BlockAllocatorPool::Instance()->Free(ptr, n * sizeof(T));
+		arena.Free(ptr, n * sizeof(T));
     }
 
 	// void construct(pointer p, const T& val)    { new (p) T(val); }
@@ -89,12 +116,21 @@ struct Allocator
 		return std::numeric_limits<size_type>::max() / sizeof(T);
 	}
 
+	// copies of a container don't inherit a short-lived arena
+	Allocator select_on_container_copy_construction() const
+	{
+		return Allocator();
+	}
+
+	// public so the converting constructor can access
+	Arena arena;
+
 }; // Allocator
 
 template <typename T, typename U>
-inline bool operator == (const Allocator<T>&, const Allocator<U>&)
+inline bool operator == (const Allocator<T>& a, const Allocator<U>& b)
 {
-    return true;
+    return a.arena == b.arena;
 }
 
 template <typename T, typename U>
@@ -155,35 +191,70 @@ auto allocate_unique(Args&&... args) {
 template <typename T>
 class AllocVector : public std::vector<T, Allocator<T>>
 {
+public:
+	using std::vector<T, Allocator<T>>::vector;
+	AllocVector() {}
+	explicit AllocVector(const Arena& arena)
+		: std::vector<T, Allocator<T>>(Allocator<T>(arena)) {}
 }; // AllocVector
 
 template <typename T>
 class AllocDeque : public std::deque<T, Allocator<T>>
 {
+public:
+	using std::deque<T, Allocator<T>>::deque;
+	AllocDeque() {}
+	explicit AllocDeque(const Arena& arena)
+		: std::deque<T, Allocator<T>>(Allocator<T>(arena)) {}
 }; // AllocDeque
 
 template <typename T>
 class AllocList : public std::list<T, Allocator<T>>
 {
+public:
+	using std::list<T, Allocator<T>>::list;
+	AllocList() {}
+	explicit AllocList(const Arena& arena)
+		: std::list<T, Allocator<T>>(Allocator<T>(arena)) {}
 }; // AllocList
 
 template <typename T>
 class AllocSet : public std::set<T, std::less<T>, Allocator<T>>
 {
+public:
+	using std::set<T, std::less<T>, Allocator<T>>::set;
+	AllocSet() {}
+	explicit AllocSet(const Arena& arena)
+		: std::set<T, std::less<T>, Allocator<T>>(Allocator<T>(arena)) {}
 }; // AllocSet
 
 template <typename K, typename V>
 class AllocMap : public std::map<K, V, std::less<K>, Allocator<std::pair<const K, V>>>
 {
+public:
+	using std::map<K, V, std::less<K>, Allocator<std::pair<const K, V>>>::map;
+	AllocMap() {}
+	explicit AllocMap(const Arena& arena)
+		: std::map<K, V, std::less<K>, Allocator<std::pair<const K, V>>>(Allocator<std::pair<const K, V>>(arena)) {}
 }; // AllocMap
 
 template <typename K, typename V>
 class AllocUnorderedMap : public std::unordered_map<K, V, std::hash<K>, std::equal_to<K>, Allocator<std::pair<const K, V>>>
 {
+public:
+	using std::unordered_map<K, V, std::hash<K>, std::equal_to<K>, Allocator<std::pair<const K, V>>>::unordered_map;
+	AllocUnorderedMap() {}
+	explicit AllocUnorderedMap(const Arena& arena)
+		: std::unordered_map<K, V, std::hash<K>, std::equal_to<K>, Allocator<std::pair<const K, V>>>(Allocator<std::pair<const K, V>>(arena)) {}
 }; // AllocUnorderedMap
 
 using AllocString = std::basic_string<char, std::char_traits<char>, Allocator<char>>;
 
+inline AllocString MakeAllocString(const Arena& arena, const char* str = "")
+{
+	return AllocString(str, Allocator<char>(arena));
+}
+
 }
 
 #endif // _MEMMGR_ALLOCATOR_H_
\ No newline at end of file
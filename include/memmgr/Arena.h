@@ -0,0 +1,76 @@
+#ifndef _MEMMGR_ARENA_H_
+#define _MEMMGR_ARENA_H_
+
+#include "memmgr/BlockAllocatorPool.h"
+#include "memmgr/LinearAllocator.h"
+
+#include <stddef.h>
+
+namespace mm
+{
+
+// Non-owning handle naming where a container's memory comes from.
+// A default constructed arena routes to the calling thread's
+// BlockAllocatorPool::Instance(), which is the old stateless behaviour.
+// The referenced pool or LinearAllocator must outlive every container
+// bound to it; destroying it then drops all of their memory at once.
+class Arena
+{
+public:
+	Arena() : m_type(TYPE_DEFAULT), m_impl(nullptr) {}
+	explicit Arena(BlockAllocatorPool* pool)
+		: m_type(pool ? TYPE_POOL : TYPE_DEFAULT), m_impl(pool) {}
+	explicit Arena(LinearAllocator* linear)
+		: m_type(linear ? TYPE_LINEAR : TYPE_DEFAULT), m_impl(linear) {}
+
+	void* Allocate(size_t size) const
+	{
+		switch (m_type)
+		{
+		case TYPE_POOL:
+			return static_cast<BlockAllocatorPool*>(m_impl)->Allocate(size);
+		case TYPE_LINEAR:
+			return static_cast<LinearAllocator*>(m_impl)->alloc<void*>(size);
+		default:
+			return BlockAllocatorPool::Instance()->Allocate(size);
+		}
+	}
+
+	void Free(void* p, size_t size) const
+	{
+		switch (m_type)
+		{
+		case TYPE_POOL:
+			static_cast<BlockAllocatorPool*>(m_impl)->Free(p, size);
+			break;
+		case TYPE_LINEAR:
+			// attempt to rewind, the rest is dropped with the arena
+			static_cast<LinearAllocator*>(m_impl)->rewindIfLastAlloc(p, size);
+			break;
+		default:
+			BlockAllocatorPool::Instance()->Free(p, size);
+			break;
+		}
+	}
+
+	bool IsDefault() const { return m_type == TYPE_DEFAULT; }
+
+	bool operator == (const Arena& other) const { return m_impl == other.m_impl; }
+	bool operator != (const Arena& other) const { return m_impl != other.m_impl; }
+
+private:
+	enum Type
+	{
+		TYPE_DEFAULT,
+		TYPE_POOL,
+		TYPE_LINEAR,
+	};
+
+	Type  m_type;
+	void* m_impl;
+
+}; // Arena
+
+}
+
+#endif // _MEMMGR_ARENA_H_
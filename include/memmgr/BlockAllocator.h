@@ -9,40 +9,159 @@
 namespace mm
 {
 
+class MemoryBudget;
+class PageRegion;
+
 struct BlockHeader
 {
     // union-ed with data
     BlockHeader* pNext;
 };
 
+// Pages are aligned to their size, so the page of a block is found by
+// masking its address. Each page keeps its own free list; a page is on
+// exactly one of the allocator's lists (see BlockAllocator::PageList).
 struct PageHeader
 {
-    PageHeader* pNext;
-    BlockHeader* Blocks() {
-		return reinterpret_cast<BlockHeader*>(this + 1);
+    PageHeader*  pNext;
+    PageHeader*  pPrev;
+
+    union
+    {
+        // MODE_FREELIST: free blocks of this page only
+        BlockHeader* pFreeList;
+        // MODE_BITMAP: every bitmap word below this one is fully used
+        size_t       nHint;
+    };
+
+    // blocks handed out from this page
+    uint32_t     nUsed;
+    uint32_t     nList;
+
+    // page offset past the last block ever handed out, when the page came
+    // zeroed from the system; blocks beyond it only hold the free list
+    // link. The page size when the contents are unknown.
+    uint32_t     nFresh;
+
+    // extra offset of the first block, a multiple of the cache line size
+    // that differs between consecutive pages (cache coloring)
+    uint32_t     nColor;
+
+    // MODE_BITMAP: one bit per block, set while the block is free
+    static const size_t BITMAP_OFFSET = (sizeof(PageHeader*) * 3 + sizeof(uint32_t) * 4 + 7) & ~size_t(7);
+
+    uint64_t* Bitmap() {
+		return reinterpret_cast<uint64_t*>(reinterpret_cast<uint8_t*>(this) + BITMAP_OFFSET);
     }
 };
+static_assert(PageHeader::BITMAP_OFFSET >= sizeof(PageHeader), "bitmap overlaps the page header");
 
 class BlockAllocator
 {
 public:
+    // how free blocks are tracked within a page
+    enum Mode
+    {
+        // intrusive list threaded through the free blocks
+        MODE_FREELIST,
+        // occupancy bitmap in the page header; frees don't touch the
+        // block, and live blocks can be enumerated
+        MODE_BITMAP,
+    };
+
+    typedef void (*WalkCallback)(void* block, size_t size, void* ud);
+
+    static const size_t CACHE_LINE_SIZE = 64;
+
     // debug patterns
     static const uint8_t PATTERN_ALIGN = 0xFC;
     static const uint8_t PATTERN_ALLOC = 0xFD;
     static const uint8_t PATTERN_FREE  = 0xFE;
 
     BlockAllocator();
-    BlockAllocator(size_t data_size, size_t page_size, size_t alignment);
+    BlockAllocator(size_t data_size, size_t page_size, size_t alignment,
+                   Mode mode = MODE_FREELIST);
     ~BlockAllocator();
 
     // resets the allocator to a new configuration
-    void Reset(size_t data_size, size_t page_size, size_t alignment);
+    void Reset(size_t data_size, size_t page_size, size_t alignment,
+               Mode mode = MODE_FREELIST);
 
     // alloc and free blocks
     void* Allocate();
+    // a block with its data cleared; blocks never handed out from a page
+    // that came zeroed from a PageRegion aren't cleared again
+    void* AllocateZeroed();
     void  Free(void* p);
     void  FreeAll();
+
+    // releases the cached empty pages, and the current page if it is empty
+    void  Trim();
+
+    // MODE_BITMAP only: whether 'p' is currently handed out, and a visit
+    // of every live block; Walk() returns false in MODE_FREELIST
+    bool  IsLive(const void* p) const;
+    bool  Walk(WalkCallback cb, void* ud) const;
+
+    // how many empty pages are kept for reuse before they are released
+    void  SetMaxEmptyPages(uint32_t count) { m_nMaxEmptyPages = count; }
+
+    // makes sure at least 'count' blocks are free without further page
+    // allocation; new pages are touched while threading their free list,
+    // so they are resident when this returns. Reserved pages stay cached
+    // as empty pages until used or Trim()med.
+    void  Reserve(size_t count);
+
+    // charges every page to 'budget', set it before the first allocation;
+    // Allocate() returns nullptr when the budget refuses a new page
+    void  SetBudget(MemoryBudget* budget);
+
+    // takes pages from 'region' instead of the heap, set it before the
+    // first allocation; its page size must match this allocator's
+    void  SetPageRegion(PageRegion* region);
+
+    // Starts the blocks of each new page one cache line further in, as far
+    // as the unused tail of the page allows, so the same block of every
+    // page doesn't land in the same cache set. Set it before the first
+    // allocation.
+    void  SetColoring(bool enable);
+
+    // layout
+    Mode   GetMode() const          { return m_eMode; }
+    size_t GetDataSize() const      { return m_szDataSize; }
+    size_t GetBlockSize() const     { return m_szBlockSize; }
+    size_t GetPageSize() const      { return m_szPageSize; }
+    size_t GetBlocksPerPage() const { return m_nBlocksPerPage; }
+    // distinct block offsets the pages cycle through, 1 without coloring
+    size_t GetColorCount() const     { return m_nColors; }
+
+    // statistics
+    uint32_t GetPageCount() const      { return m_nPages; }
+    uint32_t GetBlockCount() const     { return m_nBlocks; }
+    uint32_t GetFreeBlockCount() const { return m_nFreeBlocks; }
+    uint32_t GetPeakUsedCount() const  { return m_nPeakUsed; }
+    uint32_t GetEmptyPageCount() const { return m_nEmptyPages; }
+
+    // block size after alignment, and how many of them fit in a page; the
+    // first block starts at a multiple of 'alignment' into the page
+    static size_t CalcBlockSize(size_t data_size, size_t alignment);
+    static size_t CalcBlocksPerPage(size_t block_size, size_t page_size,
+                                    Mode mode = MODE_FREELIST, size_t alignment = 1);
+
 private:
+    // Partial pages are binned by how full they are, and the next current
+    // page is taken from the fullest bin, so allocations concentrate on
+    // few pages and the others get a chance to drain and be released.
+    enum PageList
+    {
+        LIST_PARTIAL    = 0,
+        NUM_PARTIAL_BINS = 4,
+        LIST_FULL       = NUM_PARTIAL_BINS,
+        LIST_EMPTY,
+        LIST_CURRENT,
+        NUM_LISTS       = LIST_CURRENT,
+    };
+
 #if defined(_DEBUG)
     // fill a free page with debug patterns
     void FillFreePage(PageHeader* pPage);
@@ -54,14 +173,48 @@ private:
     void FillAllocatedBlock(BlockHeader* pBlock);
 #endif
 
+    // allocates a page and threads its blocks onto the page's free list
+    PageHeader* AllocatePage();
+    void        ReleasePage(PageHeader* pPage);
+
+    // picks the page to allocate from once the current one is exhausted
+    PageHeader* NextPage();
+
+    // 'fresh' tells whether the block was zero apart from its list link
+    BlockHeader* AllocateBlock(bool& fresh);
+
+    PageHeader* PageOf(void* p) const {
+        return reinterpret_cast<PageHeader*>(reinterpret_cast<size_t>(p) & ~(m_szPageSize - 1));
+    }
+    uint32_t PartialBin(uint32_t nUsed) const {
+        return static_cast<uint32_t>(nUsed * NUM_PARTIAL_BINS / m_nBlocksPerPage);
+    }
+
+    void PushPage(PageHeader* pPage, uint32_t list);
+    void UnlinkPage(PageHeader* pPage);
+
+    // MODE_BITMAP block lookup
+    BlockHeader* TakeBitmapBlock(PageHeader* pPage);
+    void         PutBitmapBlock(PageHeader* pPage, BlockHeader* pBlock);
+    size_t       BlockIndex(const PageHeader* pPage, const void* p) const {
+        size_t offset = reinterpret_cast<size_t>(p) - reinterpret_cast<size_t>(pPage) - m_szBlocksOffset - pPage->nColor;
+        return static_cast<size_t>((static_cast<uint64_t>(offset) * m_nBlockRecip) >> 32);
+    }
+
+    void WalkPage(PageHeader* pPage, WalkCallback cb, void* ud) const;
+
+    BlockHeader* FirstBlock(PageHeader* pPage) const {
+        return reinterpret_cast<BlockHeader*>(reinterpret_cast<uint8_t*>(pPage) + m_szBlocksOffset + pPage->nColor);
+    }
+
     // gets the next block
-    BlockHeader* NextBlock(BlockHeader* pBlock);
+    BlockHeader* NextBlock(BlockHeader* pBlock) const;
 
-    // the page list
-    PageHeader* m_pPageList;
+    // the page blocks are allocated from
+    PageHeader* m_pCurrent;
 
-    // the free block list
-    BlockHeader* m_pFreeList;
+    // the page lists, indexed by PageList
+    PageHeader* m_pLists[NUM_LISTS];
 
     size_t      m_szDataSize;
     size_t      m_szPageSize;
@@ -69,10 +222,28 @@ private:
     size_t      m_szBlockSize;
     size_t      m_nBlocksPerPage;
 
+    Mode        m_eMode;
+    // offset of the first block from the page start
+    size_t      m_szBlocksOffset;
+    size_t      m_nBitmapWords;
+    // ceil(2^32 / block size), divides page offsets by the block size
+    uint64_t    m_nBlockRecip;
+
+    bool        m_bColoring;
+    uint32_t    m_nColors;
+    // color of the next new page
+    uint32_t    m_nNextColor;
+
+    MemoryBudget* m_pBudget;
+    PageRegion*   m_pRegion;
+
     // statistics
     uint32_t    m_nPages;
     uint32_t    m_nBlocks;
     uint32_t    m_nFreeBlocks;
+    uint32_t    m_nPeakUsed;
+    uint32_t    m_nEmptyPages;
+    uint32_t    m_nMaxEmptyPages;
 
     // disable copy & assignment
     BlockAllocator(const BlockAllocator& clone);
@@ -4,12 +4,19 @@
 #define _MEMMGR_BLOCK_ALLOCATOR_POOL_H_
 
 #include "memmgr/BlockAllocator.h"
+#include "memmgr/MemoryTags.h"
 
+#include <atomic>
 #include <new>
+#include <thread>
 
 namespace mm
 {
 
+class BuddyAllocator;
+class ClassRegions;
+class MemoryBudget;
+
 class BlockAllocatorPool
 {
 public:
@@ -27,30 +34,285 @@ public:
     }
 
 public:
+    struct Config
+    {
+        // Page (slab) sizing. Each size class gets the smallest power of two
+        // page in [min_page_size, max_page_size] that holds at least
+        // min_blocks_per_page blocks and loses at most max_waste_ratio of the
+        // page to the header and the unusable tail. When no page in range
+        // qualifies the one with the lowest waste ratio is used. Both bounds
+        // must be non-zero powers of two, min <= max.
+        size_t min_page_size;
+        size_t max_page_size;
+        size_t min_blocks_per_page;
+        float  max_waste_ratio;
+
+        // free block tracking per size class, by data size; null keeps
+        // every class on MODE_FREELIST
+        BlockAllocator::Mode (*select_mode)(size_t data_size);
+
+        // Address space reserved per size class in the process wide
+        // ClassRegions, a power of two; 0 takes pages from the heap. Pools
+        // with a region can classify pointers and free them without a size.
+        // The region is a hard cap per class shared by every pool of the
+        // process: once a class's region is full, Allocate() of that class
+        // returns nullptr, there is no fallback to the heap.
+        size_t region_size;
+
+        // Ascending data sizes of the size classes, copied at Initialize();
+        // null uses the built-in table. SizeClassTuner builds one from a
+        // request histogram.
+        const uint32_t* block_sizes;
+        size_t          num_block_sizes;
+
+        // counts the requests per size, see GetHistogram()
+        bool collect_histogram;
+
+        // staggers the first block of consecutive pages by a cache line,
+        // see BlockAllocator::SetColoring()
+        bool cache_coloring;
+
+        // Sizes above the largest class up to buddy_max_size come from a
+        // BuddyAllocator on regions of buddy_region_size, both powers of
+        // two; 0 sends them to the system allocator like the larger ones.
+        size_t buddy_max_size;
+        size_t buddy_region_size;
+
+        Config();
+    };
+
+    struct ClassInfo
+    {
+        size_t data_size;
+        size_t block_size;
+        size_t page_size;
+        size_t blocks_per_page;
+        // bytes per page not handed out as blocks
+        size_t page_waste;
+
+        BlockAllocator::Mode mode;
+
+        uint32_t pages;
+        uint32_t blocks;
+        uint32_t free_blocks;
+        uint32_t peak_used;
+    };
+
+    // One line of a prewarm profile: keep 'count' blocks of 'size' ready.
+    // The text form is one "size count" pair per line, '#' starts a comment,
+    // which is what DumpProfile() writes from the peak usage of a run.
+    struct ProfileEntry
+    {
+        uint32_t size;
+        uint32_t count;
+    };
+
+public:
+    // dedicated pools are owned by the caller and must be used from the
+    // thread that created them; deleting one releases all of its pages
+    BlockAllocatorPool();
+    explicit BlockAllocatorPool(const Config& cfg);
+    virtual ~BlockAllocatorPool();
+
     virtual int Initialize();
     virtual void Finalize();
+    // takes in the blocks freed on other threads, and collects the
+    // calling thread's blocks retired to the EpochReclaimer
     virtual void Tick();
 
+    // drops every page and rebuilds the size classes with a new config
+    int Initialize(const Config& cfg);
+
+    // Blocks are charged to the calling thread's current MemoryTag, or to
+    // 'tag'; free a block under the tag it was allocated with.
     void* Allocate(size_t size);
+    void* Allocate(size_t size, MemoryTag tag);
     void* Allocate(size_t size, size_t alignment);
     void  Free(void* p, size_t size);
+    void  Free(void* p, size_t size, MemoryTag tag);
+
+    // a cleared block, see BlockAllocator::AllocateZeroed()
+    void* AllocateZeroed(size_t size);
+    // keeps the block when both sizes map to the same class, and
+    // reallocs in place when both are large; otherwise moves the data
+    void* Reallocate(void* p, size_t old_size, size_t new_size);
+
+    // A block that starts on a cache line and has its lines to itself,
+    // for data written by different threads, such as per thread counters.
+    // Blocks up to CACHE_ALIGNED_MAX_SIZE come from classes of whole cache
+    // lines, larger ones from the system.
+    void* AllocateCacheAligned(size_t size);
+    void  FreeCacheAligned(void* p, size_t size);
+
+    static const size_t CACHE_ALIGNED_MAX_SIZE = BlockAllocator::CACHE_LINE_SIZE * 4;
+
+    // bytes a block requested with 'size' can hold
+    size_t GetUsableSize(size_t size) const;
+    // bytes held in blocks above the largest class, buddy blocks counted
+    // whole
+    size_t GetLargeBytes() const { return m_szLargeBytes; }
+
+    // Free() from any thread: blocks freed on other threads than the
+    // owner's are queued without locking, until its next Tick()
+    void  FreeRemote(void* p, size_t size);
+    // returns the queued blocks to their size classes, owner thread only
+    void  DrainRemoteFrees();
+
+    // region pools only: frees a block of any class, asserts when 'p' is
+    // not a pooled block
+    void  Free(void* p);
+
+    // region pools only: the size class index of 'p', -1 when 'p' isn't
+    // from a pool; Owns() is false for large blocks
+    int   ClassOf(const void* p) const;
+    bool  Owns(const void* p) const { return ClassOf(p) >= 0; }
+
+    // the size class index serving 'size', -1 above the largest class
+    int   GetClassIndex(size_t size) const;
+
+    // hands the pool to the calling thread, for pools shared under a
+    // lock; the previous owner must be done with it
+    void  SetOwnerThread();
+
+    // returns the cached empty pages of every size class, and the kept
+    // buddy region, to the system
+    void  Trim();
 
+    // blocks of the size classes handed out and not freed
+    size_t GetLiveBlockCount() const;
+
+    // visits every live block of the MODE_BITMAP classes; blocks of
+    // MODE_FREELIST classes and large blocks are not tracked
+    void  WalkHeap(BlockAllocator::WalkCallback cb, void* ud) const;
+    bool  IsLive(const void* p, size_t size) const;
+
+    // charges the pages of every size class and the large blocks to
+    // 'budget'; Allocate() returns nullptr when the budget refuses
+    void  SetBudget(MemoryBudget* budget);
+    MemoryBudget* GetBudget() const { return m_pBudget; }
+
+    // pre-allocates and faults in pages so that 'count' blocks of 'size'
+    // can be handed out without touching the system allocator
+    void  Reserve(size_t size, size_t count);
+
+    void  Prewarm(const ProfileEntry* profile, size_t count);
+    bool  Prewarm(const char* filepath);
+
+    // peak blocks in use per size class, in profile form
+    size_t GetProfile(ProfileEntry* profile, size_t max_count) const;
+    bool   DumpProfile(const char* filepath) const;
+
+	// requests per size: entries 0 to GetMaxBlockSize() count that size,
+	// the last one every larger request; null unless the config set
+	// collect_histogram
+	const uint64_t* GetHistogram() const { return m_pHistogram; }
+	size_t GetHistogramSize() const { return m_pHistogram ? m_szMaxBlockSize + 2 : 0; }
+	void   ResetHistogram();
+	// one "size count" line per requested size, as SizeClassTuner reads it
+	bool   DumpHistogram(const char* filepath) const;
+
+	size_t GetMaxBlockSize() const { return m_szMaxBlockSize; }
+
+	size_t GetClassCount() const;
+	bool   GetClassInfo(size_t idx, ClassInfo& info) const;
+
+	// logs the per class page table with its waste and usage
+	void DumpMemoryStats(const char* prefix = "") const;
+
+	// The calling thread's default pool. When the thread exits its empty
+	// pages go back to the system, and so does the pool once nothing is
+	// left in it. A pool with blocks still live elsewhere, which can only
+	// come back through FreeRemote(), is orphaned instead: the next thread
+	// to need a default pool adopts it, or ReclaimOrphans() frees it once
+	// it has drained.
 	static BlockAllocatorPool* Instance();
 
+	// drains every orphaned pool and deletes the ones left empty; returns
+	// how many are still waiting for blocks
+	static size_t ReclaimOrphans();
+	static size_t GetOrphanCount();
+
+	// config for pools created by Instance(), set it before the first use
+	static void SetDefaultConfig(const Config& cfg);
+	static const Config& GetDefaultConfig();
+
+	// the page size chosen for a block size under a config
+	static size_t CalcPageSize(const Config& cfg, size_t block_size,
+		BlockAllocator::Mode mode = BlockAllocator::MODE_FREELIST);
+
+	// the built-in class table
+	static const uint32_t* GetDefaultBlockSizes(size_t& count);
+
 private:
-	BlockAllocatorPool();
-	~BlockAllocatorPool();
+	BlockAllocator* LookUpAllocator(size_t size);
+
+	// runs on thread exit for the default pool
+	static void ReleaseInstance(BlockAllocatorPool* pool);
 
-	static BlockAllocator* LookUpAllocator(size_t size);
+	void CountRequest(size_t size) {
+		++m_pHistogram[size <= m_szMaxBlockSize ? size : m_szMaxBlockSize + 1];
+	}
+
+	// sizes above the largest class go to the buddy tier, then to the
+	// system allocator
+	void* AllocateLarge(size_t size, bool zeroed = false);
+	void  FreeLarge(void* p, size_t size);
+	void* ReallocateLarge(void* p, size_t old_size, size_t new_size);
+	// what a large block is charged to the budget, the tags and the large
+	// bytes: its whole block for sizes of the buddy tier, even when the
+	// system served it, so the free releases what the allocation took
+	size_t GetLargeCharge(size_t size) const;
+
+	// how a block waits in a remote free queue, the size only for large
+	// blocks
+	struct RemoteBlock
+	{
+		RemoteBlock* next;
+		size_t       size;
+	};
+
+	// disable copy & assignment
+	BlockAllocatorPool(const BlockAllocatorPool&) = delete;
+	BlockAllocatorPool& operator = (const BlockAllocatorPool&) = delete;
 
 private:
-	thread_local static size_t*         m_pBlockSizeLookup;
-	thread_local static BlockAllocator* m_pAllocators;
+	size_t*         m_pBlockSizeLookup;
+	BlockAllocator* m_pAllocators;
+
+	// one class per cache line count up to CACHE_ALIGNED_MAX_SIZE
+	BlockAllocator* m_pCacheAllocators;
+
+	uint32_t*       m_pBlockSizes;
+	size_t          m_nNumBlockSizes;
+	size_t          m_szMaxBlockSize;
+
+	uint64_t*       m_pHistogram;
+
+	BuddyAllocator* m_pBuddy;
+
+	size_t          m_szLargeBytes;
+
+	// per size class, then one for large blocks
+	std::atomic<RemoteBlock*>* m_pRemoteFrees;
+
+	Config m_config;
+
+	MemoryBudget* m_pBudget;
+
+	ClassRegions* m_pRegions;
+
+	bool m_bInitialized;
+
+	// no owner while orphaned
+	std::atomic<std::thread::id> m_owner;
+	// default config generation the pool was built with, see Instance()
+	uint32_t m_nConfigGeneration;
 
-	thread_local static BlockAllocatorPool* m_instance;
+	struct ThreadInstance;
+	thread_local static ThreadInstance m_instance;
 
 }; // BlockAllocatorPool
 
 }
 
-#endif // _MEMMGR_BLOCK_ALLOCATOR_POOL_H_
\ No newline at end of file
+#endif // _MEMMGR_BLOCK_ALLOCATOR_POOL_H_
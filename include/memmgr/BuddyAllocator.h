@@ -0,0 +1,116 @@
+#ifndef _MEMMGR_BUDDY_ALLOCATOR_H_
+#define _MEMMGR_BUDDY_ALLOCATOR_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+namespace mm
+{
+
+// Power of two blocks split from large regions of reserved memory, for the
+// sizes between the pool classes and the system allocator. A block's offset
+// in its region is a multiple of its size, so its buddy is one xor of the
+// offset away; regions are only page aligned, so the address itself is not
+// aligned to the block size, and over-aligned requests can't rely on it.
+// Every region keeps a bitmap per order telling which blocks sit on a free
+// list; the free lists are doubly linked through the free blocks. Splitting
+// and merging are then constant time per order, and the first non-empty
+// order is a bit scan. Freed buddies merge back up, and a region that is
+// whole again goes back to the system, apart from one kept for the next
+// allocation. Not thread-safe.
+class BuddyAllocator
+{
+public:
+	struct Config
+	{
+		// powers of two, min_block_size <= max_block_size <= region_size
+		size_t min_block_size;
+		size_t max_block_size;
+		size_t region_size;
+
+		Config();
+	};
+
+	struct Stats
+	{
+		size_t regions;
+		size_t region_bytes;
+		// in whole blocks
+		size_t live_bytes;
+		size_t live_blocks;
+		size_t free_bytes;
+		// the largest block Allocate() can serve without a new region
+		size_t largest_free;
+	};
+
+public:
+	BuddyAllocator();
+	explicit BuddyAllocator(const Config& cfg);
+	BuddyAllocator(const BuddyAllocator&) = delete;
+	BuddyAllocator& operator = (const BuddyAllocator&) = delete;
+	~BuddyAllocator();
+
+	// nullptr above max_block_size, or when no region can be reserved
+	void* Allocate(size_t size);
+	// 'size' as allocated; 'p' may point anywhere inside the block
+	void  Free(void* p, size_t size);
+
+	bool   Owns(const void* p) const { return FindRegion(p) != nullptr; }
+	// the block a request of 'size' gets
+	size_t GetBlockSize(size_t size) const;
+	size_t GetMaxBlockSize() const { return m_config.max_block_size; }
+
+	// returns the kept empty region
+	void  Trim();
+
+	Stats GetStats() const;
+	void  DumpMemoryStats(const char* prefix = "") const;
+
+private:
+	struct Region;
+	struct FreeBlock;
+
+	uint32_t OrderOf(size_t size) const;
+
+	Region* NewRegion();
+	void    ReleaseRegion(Region* region);
+	Region* FindRegion(const void* p) const;
+
+	void  Push(Region* region, uint8_t* block, uint32_t order);
+	void  Remove(FreeBlock* block, uint32_t order);
+	FreeBlock* Pop(uint32_t order);
+
+	bool  TestBit(const Region* region, uint32_t order, size_t offset) const;
+	void  SetBit(Region* region, uint32_t order, size_t offset, bool free);
+
+private:
+	Config m_config;
+
+	uint32_t m_min_order;
+	uint32_t m_max_order;
+	uint32_t m_region_order;
+
+	// per order from m_min_order to m_region_order, and a bit per order
+	// with a block on it
+	FreeBlock* m_free[32];
+	uint32_t   m_nonempty;
+
+	// where each order's bits start in a region's bitmap, in words
+	size_t   m_bitmap_offsets[32];
+	size_t   m_bitmap_words;
+
+	// sorted by address
+	std::vector<Region*> m_regions;
+	size_t   m_empty_regions;
+
+	// Memory usage tracking
+	size_t   m_live_bytes;
+	size_t   m_live_blocks;
+
+}; // BuddyAllocator
+
+}
+
+#endif // _MEMMGR_BUDDY_ALLOCATOR_H_
@@ -0,0 +1,104 @@
+#ifndef _MEMMGR_CACHE_LINE_ALLOCATOR_H_
+#define _MEMMGR_CACHE_LINE_ALLOCATOR_H_
+
+#include "memmgr/BlockAllocatorPool.h"
+
+#include <limits>
+#include <new>
+#include <utility>
+
+namespace mm
+{
+
+// Objects written by different threads must not share a cache line, or
+// every write invalidates the line in the other cores' caches (false
+// sharing). Blocks from these allocators start on a cache line and own
+// every line they touch.
+
+template<typename T>
+struct CacheLineAllocator
+{
+	typedef std::size_t size_type;
+	typedef std::ptrdiff_t difference_type;
+	typedef T* pointer;
+	typedef const T* const_pointer;
+	typedef T& reference;
+	typedef const T& const_reference;
+	typedef T value_type;
+
+	template<typename U>
+	struct rebind {typedef CacheLineAllocator<U> other;};
+
+	CacheLineAllocator() throw() {}
+	CacheLineAllocator(const CacheLineAllocator&) throw() {}
+	template<typename U>
+	CacheLineAllocator(const CacheLineAllocator<U>&) throw() {}
+
+	pointer allocate(size_type n, const void* hint = 0)
+	{
+		void* p = BlockAllocatorPool::Instance()->AllocateCacheAligned(n * sizeof(T));
+		if (!p) {
+			throw std::bad_alloc();
+		}
+		return static_cast<T*>(p);
+	}
+
+	void deallocate(T* ptr, size_type n)
+	{
+		BlockAllocatorPool::Instance()->FreeCacheAligned(ptr, n * sizeof(T));
+	}
+
+	size_type max_size() const
+	{
+		return std::numeric_limits<size_type>::max() / sizeof(T);
+	}
+
+}; // CacheLineAllocator
+
+template <typename T, typename U>
+inline bool operator == (const CacheLineAllocator<T>&, const CacheLineAllocator<U>&) { return true; }
+template <typename T, typename U>
+inline bool operator != (const CacheLineAllocator<T>&, const CacheLineAllocator<U>&) { return false; }
+
+// Pads T to whole cache lines, so that in an array of them from
+// CacheLineAllocator, such as one counter per thread, each element has its
+// lines to itself.
+template<typename T>
+struct alignas(BlockAllocator::CACHE_LINE_SIZE) CacheLinePadded
+{
+	T value;
+
+	template<typename... Args>
+	explicit CacheLinePadded(Args&&... args) : value(std::forward<Args>(args)...) {}
+
+	T& operator * () { return value; }
+	const T& operator * () const { return value; }
+	T* operator -> () { return &value; }
+	const T* operator -> () const { return &value; }
+
+}; // CacheLinePadded
+
+class CacheLineHelper
+{
+public:
+	template<class T, typename... Arguments>
+	static T* New(Arguments&&... parameters)
+	{
+		void* p = BlockAllocatorPool::Instance()->AllocateCacheAligned(sizeof(T));
+		return p ? new (p) T(std::forward<Arguments>(parameters)...) : nullptr;
+	}
+
+	template<class T>
+	static void Delete(T* p)
+	{
+		if (p) {
+			p->~T();
+			BlockAllocatorPool::Instance()->FreeCacheAligned(p, sizeof(T));
+		}
+	}
+
+}; // CacheLineHelper
+
+}
+
+#endif // _MEMMGR_CACHE_LINE_ALLOCATOR_H_
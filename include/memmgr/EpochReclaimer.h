@@ -0,0 +1,73 @@
+#ifndef _MEMMGR_EPOCH_RECLAIMER_H_
+#define _MEMMGR_EPOCH_RECLAIMER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace mm
+{
+
+class BlockAllocatorPool;
+
+// Epoch-based reclamation for lock-free structures built on the pools.
+// Readers wrap every access in a Guard, which costs a store and a fence
+// on entry, nothing per read. A writer retires the blocks it unlinked; a
+// retired block goes back to the pool it came from once the global epoch
+// has moved on twice, when no reader can still hold it.
+//
+// The epoch moves on when every thread inside a Guard has seen the current
+// one. Threads try to advance it every RETIRE_BATCH retires and on Collect(),
+// which BlockAllocatorPool::Tick() calls; a background thread can drive it
+// too. A pool must outlive the blocks retired into it.
+class EpochReclaimer
+{
+public:
+	typedef void (*Destructor)(void* p);
+
+	// a reader critical section, may nest
+	class Guard
+	{
+	public:
+		Guard() { Enter(); }
+		~Guard() { Leave(); }
+
+	private:
+		Guard(const Guard&) = delete;
+		Guard& operator = (const Guard&) = delete;
+	};
+
+	static void Enter();
+	static void Leave();
+
+	// Frees 'p', a block of 'size' bytes from 'pool', after every current
+	// reader has left; 'dtor' runs on it first when given. Blocks of pools
+	// owned by other threads are handed back with FreeRemote().
+	static void Retire(BlockAllocatorPool* pool, void* p, size_t size, Destructor dtor = nullptr);
+
+	template<class T>
+	static void Retire(BlockAllocatorPool* pool, T* p)
+	{
+		Retire(pool, p, sizeof(T), [](void* p) { static_cast<T*>(p)->~T(); });
+	}
+
+	// advances the epoch when every reader has seen it
+	static bool TryAdvance();
+	// advances the epoch and frees the calling thread's blocks that no
+	// reader can reach, and those left by threads that exited
+	static void Collect();
+
+	// advances the epoch every 'interval_ms' on a thread of its own
+	static bool StartBackground(uint32_t interval_ms);
+	static void StopBackground();
+
+	static uint64_t GetEpoch();
+	// blocks retired on the calling thread and not freed yet
+	static size_t   GetPendingCount();
+
+	static const size_t RETIRE_BATCH = 64;
+
+}; // EpochReclaimer
+
+}
+
+#endif // _MEMMGR_EPOCH_RECLAIMER_H_
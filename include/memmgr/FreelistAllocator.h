@@ -1,11 +1,20 @@
 #ifndef _MEMMGR_FREELIST_ALLOCATOR_H_
 #define _MEMMGR_FREELIST_ALLOCATOR_H_
 
+#include "memmgr/MemoryTags.h"
+
 #include <stddef.h>
 
+#include <thread>
+
 namespace mm
 {
 
+class MemoryBudget;
+
+// Not thread-safe, apart from Free(): blocks freed on other threads than
+// the owner are queued without locking and reused by the owner's next
+// Allocate() of that size.
 class FreelistAllocator
 {
 public:
@@ -14,8 +23,21 @@ public:
 	FreelistAllocator& operator = (const FreelistAllocator&) = delete;
 	~FreelistAllocator();
 
+	// charged to the current MemoryTag, or to 'tag'
 	void* Allocate(size_t size);
+	void* Allocate(size_t size, MemoryTag tag);
 	void  Free(void* p, size_t size);
+	void  Free(void* p, size_t size, MemoryTag tag);
+
+	// makes sure 'n' blocks for 'size' are on the free list
+	void  Reserve(size_t size, size_t n);
+
+	// the owner is the constructing thread until another one calls this
+	void  SetOwnerThread() { m_owner = std::this_thread::get_id(); }
+
+	// charges every block taken from the system to 'budget', set it before
+	// the first allocation; Allocate() returns nullptr when refused
+	void  SetBudget(MemoryBudget* budget);
 
 	void DumpMemoryStats(const char* prefix = "") const;
 
@@ -30,6 +52,10 @@ private:
 
 	size_t m_min_page_sz, m_max_page_sz;
 
+	MemoryBudget* m_budget;
+
+	std::thread::id m_owner;
+
 	// Memory usage tracking
 	size_t m_tot_allocated;
 	size_t m_wasted_space;
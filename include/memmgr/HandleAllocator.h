@@ -0,0 +1,160 @@
+#ifndef _MEMMGR_HANDLE_ALLOCATOR_H_
+#define _MEMMGR_HANDLE_ALLOCATOR_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+namespace mm
+{
+
+class MemoryBudget;
+
+// Blocks reached through handles instead of pointers, so that the
+// allocator can move them. Blocks are bumped into aligned pages; a freed
+// block leaves a hole until its page empties. Tick() evacuates the
+// sparsest pages a block at a time into the current page, within a time
+// budget, and gives the emptied pages back, so the heap stays close to the
+// live data however long the process runs.
+//
+// A handle carries a generation, a stale one resolves to nullptr. Get()
+// pointers are good until the next Tick(); Pin() keeps a block in place
+// until Unpin(). Blocks above max_block_size get memory of their own and
+// never move. Not thread-safe.
+class HandleAllocator
+{
+public:
+	struct Handle
+	{
+		uint32_t index;
+		// 0 for the null handle
+		uint32_t generation;
+
+		Handle() : index(0), generation(0) {}
+		bool IsNull() const { return generation == 0; }
+
+		bool operator == (const Handle& h) const { return index == h.index && generation == h.generation; }
+		bool operator != (const Handle& h) const { return !(*this == h); }
+	};
+
+	struct Config
+	{
+		// a power of two, pages are aligned to it
+		size_t page_size;
+		size_t max_block_size;
+		// pages with less of their used part live are evacuated
+		float  compact_threshold;
+
+		Config();
+	};
+
+	struct Stats
+	{
+		// bytes of live blocks in pages, headers included
+		size_t   live_bytes;
+		size_t   page_bytes;
+		size_t   large_bytes;
+		uint32_t pages;
+		uint32_t handles;
+		// share of page_bytes not live
+		float    fragmentation;
+
+		// since construction
+		uint64_t moved_bytes;
+		uint64_t moved_blocks;
+		uint64_t freed_pages;
+	};
+
+public:
+	HandleAllocator();
+	explicit HandleAllocator(const Config& cfg);
+	HandleAllocator(const HandleAllocator&) = delete;
+	HandleAllocator& operator = (const HandleAllocator&) = delete;
+	~HandleAllocator();
+
+	// a null handle when out of memory
+	Handle Allocate(size_t size);
+	void   Free(Handle h);
+
+	bool   IsValid(Handle h) const { return Lookup(h) != nullptr; }
+	void*  Get(Handle h) const;
+	template<typename T>
+	T*     Get(Handle h) const { return static_cast<T*>(Get(h)); }
+	size_t GetSize(Handle h) const;
+
+	// pins nest
+	void*  Pin(Handle h);
+	void   Unpin(Handle h);
+
+	// Moves blocks for at most 'budget_us' microseconds, 0 for no limit,
+	// and returns the bytes moved. A page being evacuated carries over to
+	// the next call.
+	size_t Tick(uint32_t budget_us);
+
+	// charges every page and large block to 'budget', set it before the
+	// first allocation; Allocate() fails when refused
+	void   SetBudget(MemoryBudget* budget);
+
+	Stats  GetStats() const;
+	void   DumpMemoryStats(const char* prefix = "") const;
+
+private:
+	struct Entry
+	{
+		void*    ptr;
+		uint32_t size;
+		uint32_t generation;
+		uint32_t pins;
+		// next free entry while unused
+		uint32_t next_free;
+		bool     large;
+	};
+
+	struct Page;
+	struct BlockHeader;
+
+	// nullptr for a stale or null handle
+	Entry* Lookup(Handle h);
+	const Entry* Lookup(Handle h) const;
+	Page*  PageOf(const void* p) const;
+
+	// room for 'size' bytes in the current page, opening a new one when
+	// it's full
+	BlockHeader* Bump(size_t size);
+	Page* NewPage();
+	void  FreePage(Page* page);
+	// an empty page that isn't the current one goes back
+	void  ReleaseIfEmpty(Page* page);
+
+	Page* PickVictim() const;
+	// moves the next live block of the victim, releasing the page once it's
+	// through; false when there's no memory to move to
+	bool  EvacuateNext();
+
+private:
+	Config m_config;
+
+	std::vector<Entry> m_entries;
+	uint32_t m_free_entry;
+
+	std::vector<Page*> m_pages;
+	Page* m_current;
+
+	// the page Tick() is emptying, and how far it got
+	Page*  m_victim;
+	size_t m_victim_offset;
+
+	MemoryBudget* m_budget;
+
+	// Memory usage tracking
+	size_t   m_large_bytes;
+	uint64_t m_moved_bytes;
+	uint64_t m_moved_blocks;
+	uint64_t m_freed_pages;
+
+}; // HandleAllocator
+
+}
+
+#endif // _MEMMGR_HANDLE_ALLOCATOR_H_
@@ -0,0 +1,164 @@
+#ifndef _MEMMGR_INTRUSIVE_PTR_H_
+#define _MEMMGR_INTRUSIVE_PTR_H_
+
+#include "memmgr/BlockAllocatorPool.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <utility>
+
+namespace mm
+{
+
+// Smart pointer for objects that carry their own reference count. The count
+// is adjusted through intrusive_ptr_add_ref(T*) / intrusive_ptr_release(T*)
+// found by argument dependent lookup, as with boost::intrusive_ptr.
+template <typename T>
+class intrusive_ptr
+{
+public:
+	typedef T element_type;
+
+	intrusive_ptr() : m_ptr(nullptr) {}
+	intrusive_ptr(std::nullptr_t) : m_ptr(nullptr) {}
+	intrusive_ptr(T* p, bool add_ref = true)
+		: m_ptr(p)
+	{
+		if (m_ptr && add_ref) {
+			intrusive_ptr_add_ref(m_ptr);
+		}
+	}
+
+	intrusive_ptr(const intrusive_ptr& other)
+		: m_ptr(other.m_ptr)
+	{
+		if (m_ptr) {
+			intrusive_ptr_add_ref(m_ptr);
+		}
+	}
+	intrusive_ptr(intrusive_ptr&& other)
+		: m_ptr(other.m_ptr)
+	{
+		other.m_ptr = nullptr;
+	}
+
+	template <typename U>
+	intrusive_ptr(const intrusive_ptr<U>& other)
+		: m_ptr(other.get())
+	{
+		if (m_ptr) {
+			intrusive_ptr_add_ref(m_ptr);
+		}
+	}
+
+	~intrusive_ptr()
+	{
+		if (m_ptr) {
+			intrusive_ptr_release(m_ptr);
+		}
+	}
+
+	intrusive_ptr& operator = (intrusive_ptr other)
+	{
+		swap(other);
+		return *this;
+	}
+
+	void swap(intrusive_ptr& other) { std::swap(m_ptr, other.m_ptr); }
+
+	void reset() { intrusive_ptr().swap(*this); }
+	void reset(T* p) { intrusive_ptr(p).swap(*this); }
+
+	// gives up ownership without touching the count
+	T* detach()
+	{
+		T* p = m_ptr;
+		m_ptr = nullptr;
+		return p;
+	}
+
+	T* get() const { return m_ptr; }
+	T& operator * () const { return *m_ptr; }
+	T* operator -> () const { return m_ptr; }
+	explicit operator bool () const { return m_ptr != nullptr; }
+
+private:
+	T* m_ptr;
+
+}; // intrusive_ptr
+
+template <typename T, typename U>
+inline bool operator == (const intrusive_ptr<T>& a, const intrusive_ptr<U>& b) { return a.get() == b.get(); }
+template <typename T, typename U>
+inline bool operator != (const intrusive_ptr<T>& a, const intrusive_ptr<U>& b) { return a.get() != b.get(); }
+
+// Non-atomic reference count base for objects allocated with
+// make_intrusive<T>(). T must be the most derived type, since the block
+// is returned to the pool with sizeof(T).
+template <typename T>
+class LocalRefCounted
+{
+public:
+	uint32_t RefCount() const { return m_refs; }
+
+protected:
+	LocalRefCounted() : m_refs(0), m_pool(nullptr) {}
+	LocalRefCounted(const LocalRefCounted&) : m_refs(0), m_pool(nullptr) {}
+	LocalRefCounted& operator = (const LocalRefCounted&) { return *this; }
+	~LocalRefCounted() {}
+
+private:
+	friend void intrusive_ptr_add_ref(const LocalRefCounted* p)
+	{
+		++p->m_refs;
+	}
+
+	friend void intrusive_ptr_release(const LocalRefCounted* p)
+	{
+		if (--p->m_refs == 0)
+		{
+			T* obj = static_cast<T*>(const_cast<LocalRefCounted*>(p));
+			BlockAllocatorPool* pool = p->m_pool;
+			obj->~T();
+			pool->Free(obj, sizeof(T));
+		}
+	}
+
+	template <typename U, typename... Args>
+	friend intrusive_ptr<U> make_intrusive(BlockAllocatorPool* pool, Args&&... args);
+
+private:
+	mutable uint32_t m_refs;
+
+	BlockAllocatorPool* m_pool;
+
+}; // LocalRefCounted
+
+template <typename T, typename... Args>
+intrusive_ptr<T> make_intrusive(BlockAllocatorPool* pool, Args&&... args)
+{
+	void* buf = pool->Allocate(sizeof(T));
+	if (!buf) {
+		return intrusive_ptr<T>();
+	}
+	T* obj;
+	try {
+		obj = new (buf) T(std::forward<Args>(args)...);
+	} catch (...) {
+		pool->Free(buf, sizeof(T));
+		throw;
+	}
+	obj->m_pool = pool;
+	return intrusive_ptr<T>(obj);
+}
+
+template <typename T, typename... Args>
+intrusive_ptr<T> make_intrusive(Args&&... args)
+{
+	return make_intrusive<T>(BlockAllocatorPool::Instance(), std::forward<Args>(args)...);
+}
+
+}
+
+#endif // _MEMMGR_INTRUSIVE_PTR_H_
@@ -27,14 +27,25 @@
 #define ANDROID_LINEARALLOCATOR_H
 
 #include "memmgr/FreelistAllocator.h"
+#include "memmgr/MemoryTags.h"
+#include "memmgr/OffsetPtr.h"
 
 #include <stddef.h>
 #include <type_traits>
 
-#include <vector>
+#include <algorithm>
+#include <initializer_list>
+#include <iterator>
+#include <new>
+#include <stdexcept>
+#include <utility>
 
 namespace mm {
 
+class LinearPageRecycler;
+class MappedArena;
+class MemoryBudget;
+
 /**
  * A memory manager that internally allocates multi-kbyte buffers for placing objects in. It avoids
  * the overhead of malloc when many objects are allocated. It is most useful when creating many
@@ -43,11 +54,79 @@ namespace mm {
  */
 class LinearAllocator {
 public:
+    /**
+     * How an allocator sizes its pages and where it gets them from.
+     */
+    struct Policy {
+        // The ideal size of the first page, a multiple of 8. Later pages double in size until
+        // they reach maxPageSize.
+        size_t initialPageSize;
+        size_t maxPageSize;
+        // The maximum amount of wasted space we can have per page, as a fraction of its size.
+        // Allocations exceeding this will have their own dedicated page.
+        float maxWasteRatio;
+        // Pages come from and go back to this recycler instead of malloc, nullptr for none.
+        // A FreelistAllocator passed to the constructor still takes precedence.
+        LinearPageRecycler* recycler;
+        // Starts at the size the recycler learned from recent arenas, on the ladder from
+        // initialPageSize, rather than at initialPageSize.
+        bool adaptiveInitialSize;
+        // Pages are carved from this memory-mapped file and stay there, so that what is built
+        // can be persisted and mapped back later; nullptr for none. It takes precedence over
+        // the FreelistAllocator and the recycler, and must outlive the allocator. Link the
+        // objects with offset_ptr and OffsetVector to map them back at any address.
+        MappedArena* arena;
+    };
+
+    /**
+     * The policy of allocators constructed without one: 512 byte to 128kb pages, malloc'd.
+     * Changing it only affects allocators constructed afterwards, and must not race with them.
+     */
+    static const Policy& defaultPolicy();
+    static void setDefaultPolicy(const Policy& policy);
+
     LinearAllocator();
 	LinearAllocator(FreelistAllocator* alloc);
+    /**
+     * Starts with a single page that holds at least 'initialCapacity' bytes of
+     * allocations, each rounded up to the alignment, on top of the page header,
+     * instead of growing from the default initial page size.
+     */
+    explicit LinearAllocator(size_t initialCapacity, FreelistAllocator* alloc = nullptr);
+    explicit LinearAllocator(const Policy& policy, FreelistAllocator* alloc = nullptr);
+    /**
+     * Moving takes over the pages and destructors without copying; pointers into the arena stay
+     * valid, and the source is left empty. LinearStdAllocators and LsaVectors still refer to
+     * the source.
+     */
+    LinearAllocator(LinearAllocator&& other);
+    LinearAllocator& operator = (LinearAllocator&& other);
+    /**
+     * Same as the move assignment, kept for existing callers.
+     */
 	LinearAllocator& operator = (const LinearAllocator&);
     ~LinearAllocator();
 
+    /**
+     * The pages and destructors of a detached arena, until an allocator adopts them.
+     */
+    struct Detached;
+
+    /**
+     * Hands the arena's contents off and leaves the allocator empty, to be adopted by another
+     * allocator, on any thread. Returns nullptr when there is nothing to hand off.
+     */
+    Detached* detach();
+
+    /**
+     * Takes over a detached arena next to the allocator's own contents; they are freed
+     * together. Each page goes back to where it came from, on whichever thread this allocator
+     * is destroyed. Pages are charged to this allocator's budget, the transfer fails and
+     * leaves 'detached' as is when the budget refuses them. Adopting into an empty allocator
+     * without a budget keeps the detached arena's.
+     */
+    bool adopt(Detached* detached);
+
     /**
      * Reserves and returns a region of memory of at least size 'size', aligning as needed.
      * Typically this is used in an object's overridden new() method or as a replacement for malloc.
@@ -72,10 +151,16 @@ public:
      */
     template<class T, typename... Params>
     T* create(Params&&... params) {
-        T* ret = new (allocImpl(sizeof(T))) T(std::forward<Params>(params)...);
+        void* buf = allocImpl(sizeof(T));
+        if (!buf) {
+            return nullptr;
+        }
+        T* ret = new (buf) T(std::forward<Params>(params)...);
         if (!std::is_trivially_destructible<T>::value) {
-            auto dtor = [](void* ret) { ((T*)ret)->~T(); };
-            addToDestructionList(dtor, ret);
+            if (!addToDestructionList(&destroy<T>, ret)) {
+                ret->~T();
+                return nullptr;
+            }
         }
         return ret;
     }
@@ -84,7 +169,8 @@ public:
     T* create_trivial(Params&&... params) {
         static_assert(std::is_trivially_destructible<T>::value,
                 "Error, called create_trivial on a non-trivial type");
-        return new (allocImpl(sizeof(T))) T(std::forward<Params>(params)...);
+        void* buf = allocImpl(sizeof(T));
+        return buf ? new (buf) T(std::forward<Params>(params)...) : nullptr;
     }
 
     template<class T>
@@ -96,18 +182,30 @@ public:
 
     /**
      * Attempt to deallocate the given buffer, with the LinearAllocator attempting to rewind its
-     * state if possible.
+     * state if possible. Runs the destructor early only when 'ptr' is the newest object of its
+     * type; any other object is destroyed with the allocator.
      */
     void rewindIfLastAlloc(void* ptr, size_t allocSize);
 
     /**
-     * Same as rewindIfLastAlloc(void*, size_t)
+     * Same as rewindIfLastAlloc(void*, size_t), but only looks among the destructors of T, and
+     * searches all of them, so an older T is destroyed right away too
      */
     template<class T>
     void rewindIfLastAlloc(T* ptr) {
-        rewindIfLastAlloc((void*)ptr, sizeof(T));
+        if (!std::is_trivially_destructible<T>::value) {
+            runDestructorFor(&destroy<T>, ptr);
+        }
+        rewindBuffer(ptr, sizeof(T));
     }
 
+    /**
+     * Resizes the buffer at 'ptr' from 'oldSize' to 'newSize' bytes without moving it. This only
+     * works for the most recent allocation, while the current page has room for 'newSize'.
+     * Returns false and leaves the buffer untouched otherwise.
+     */
+    bool tryExtend(void* ptr, size_t oldSize, size_t newSize);
+
     /**
      * Dump memory usage statistics to the log (allocated and wasted space)
      */
@@ -119,35 +217,69 @@ public:
      */
     size_t usedSize() const { return mTotalAllocated - mWastedSpace; }
 
+    /**
+     * Charges every page to 'budget'. Must be set before the first allocation; once the
+     * budget refuses a page, alloc() and create() return nullptr.
+     */
+    void setBudget(MemoryBudget* budget);
+
+    /**
+     * Charges the pages allocated from now on to 'tag' rather than to the MemoryTag that was
+     * current when the allocator was constructed. Each page is released under the tag it was
+     * charged to, also after a move or adopt().
+     */
+    void setTag(MemoryTag tag) { mTag = tag; }
+    MemoryTag tag() const { return mTag; }
+
 private:
     LinearAllocator(const LinearAllocator& other);
 
     class Page;
     typedef void (*Destructor)(void* addr);
-    struct DestructorNode {
-        Destructor dtor;
-        void* addr;
-        DestructorNode* next = nullptr;
-    };
+    /**
+     * The objects that need a destructor are kept out of the pages, in arrays of addresses
+     * grouped by destructor, so teardown runs each type's destructor in a tight loop. Types
+     * are destroyed one after another; within a type, in reverse order of construction.
+     */
+    struct DestructorChunk;
+    struct DestructorGroup;
+
+    template<class T>
+    static void destroy(void* addr) { ((T*)addr)->~T(); }
 
     void* allocImpl(size_t size);
+    void rewindBuffer(void* ptr, size_t allocSize);
 
-    void addToDestructionList(Destructor, void* addr);
+    bool addToDestructionList(Destructor, void* addr);
     void runDestructorFor(void* addr);
-    Page* newPage(size_t pageSize);
+    void runDestructorFor(Destructor dtor, void* addr);
+    bool removeDestructor(DestructorGroup* group, void* addr);
+    void runDestructors();
+    Page* newPage(size_t pageSize, bool dedicated = false);
+    void freePage(Page* p);
+    void release();
+    void takeFrom(LinearAllocator& other);
+    void resetContents();
     bool fitsInCurrentPage(size_t size);
-    void ensureNext(size_t size);
+    bool ensureNext(size_t size);
     void* start(Page *p);
     void* end(Page* p);
 
+    Policy mPolicy;
     size_t mPageSize;
     size_t mMaxAllocSize;
     void* mNext;
     Page* mCurrentPage;
     Page* mPages;
-    DestructorNode* mDtorList = nullptr;
+    DestructorGroup* mDtorGroups = nullptr;
+    // the group the last object was added to
+    DestructorGroup* mLastDtorGroup = nullptr;
+    // an emptied chunk kept to avoid churn at chunk boundaries
+    DestructorChunk* mSpareDtorChunk = nullptr;
 
 	FreelistAllocator* m_alloc = nullptr;
+    MemoryBudget* mBudget = nullptr;
+    MemoryTag mTag = MEMORY_TAG_NONE;
 
     // Memory usage tracking
     size_t mTotalAllocated;
@@ -178,13 +310,27 @@ public:
     LinearStdAllocator(const LinearStdAllocator<U>& other)  // NOLINT(implicit)
             : linearAllocator(other.linearAllocator) {}
 
+    // throws std::bad_alloc when the budget refuses a page
     T* allocate(size_t num, const void* = 0) {
-        return (T*)(linearAllocator.alloc<void*>(num * sizeof(T)));
+        void* p = linearAllocator.alloc<void*>(num * sizeof(T));
+        if (!p) {
+            throw std::bad_alloc();
+        }
+        return (T*)p;
     }
 
     void deallocate(pointer p, size_t num) {
-        // attempt to rewind, but no guarantees
-        linearAllocator.rewindIfLastAlloc(p, num * sizeof(T));
+        // attempt to rewind, but no guarantees; allocate() never registers destructors, so
+        // shrinking to nothing rewinds without looking through them
+        linearAllocator.tryExtend(p, num * sizeof(T), 0);
+    }
+
+    /**
+     * Growth hook: grows the buffer at 'p' from 'oldNum' to 'newNum' elements in place when it
+     * is the allocator's most recent allocation.
+     */
+    bool tryExtend(pointer p, size_t oldNum, size_t newNum) {
+        return linearAllocator.tryExtend(p, oldNum * sizeof(T), newNum * sizeof(T));
     }
 
     // public so template copy constructor can access
@@ -197,11 +343,383 @@ bool operator== (const LinearStdAllocator<T1>&, const LinearStdAllocator<T2>&) {
 template <class T1, class T2>
 bool operator!= (const LinearStdAllocator<T1>&, const LinearStdAllocator<T2>&) { return false; }
 
+/**
+ * A vector in a LinearAllocator. std::vector always moves to a new buffer when it grows, which
+ * leaves the old one behind as dead space in the arena; LsaVector first tries to extend its
+ * buffer in place, which succeeds for as long as it is the arena's most recent allocation, so
+ * filling it with push_back() neither copies nor wastes space. Otherwise it moves to a buffer
+ * of twice the size like std::vector.
+ *
+ * It has the interface of std::vector, but is no longer derived from it: it can't be passed
+ * where a std::vector<T, LinearStdAllocator<T>>& is expected, and its iterators are pointers.
+ */
 template <class T>
-class LsaVector : public std::vector<T, LinearStdAllocator<T>> {
+class LsaVector {
 public:
+    typedef T value_type;
+    typedef size_t size_type;
+    typedef ptrdiff_t difference_type;
+    typedef T& reference;
+    typedef const T& const_reference;
+    typedef T* pointer;
+    typedef const T* const_pointer;
+    typedef T* iterator;
+    typedef const T* const_iterator;
+    typedef std::reverse_iterator<iterator> reverse_iterator;
+    typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+    typedef LinearStdAllocator<T> allocator_type;
+
     explicit LsaVector(const LinearStdAllocator<T>& allocator)
-            : std::vector<T, LinearStdAllocator<T>>(allocator) {}
+            : mAllocator(allocator), mData(nullptr), mSize(0), mCapacity(0) {}
+    LsaVector(const LsaVector& other)
+            : mAllocator(other.mAllocator), mData(nullptr), mSize(0), mCapacity(0) {
+        assign(other.begin(), other.end());
+    }
+    LsaVector(LsaVector&& other)
+            : mAllocator(other.mAllocator), mData(other.mData), mSize(other.mSize)
+            , mCapacity(other.mCapacity) {
+        other.mData = nullptr;
+        other.mSize = other.mCapacity = 0;
+    }
+    ~LsaVector() {
+        clear();
+        if (mData) {
+            mAllocator.deallocate(mData, mCapacity);
+        }
+    }
+
+    LsaVector& operator=(const LsaVector& other) {
+        if (this != &other) {
+            assign(other.begin(), other.end());
+        }
+        return *this;
+    }
+    LsaVector& operator=(LsaVector&& other) {
+        // the buffers stay where they are, so only swap within one arena
+        if (&mAllocator.linearAllocator == &other.mAllocator.linearAllocator) {
+            swap(other);
+        } else {
+            assign(std::make_move_iterator(other.begin()), std::make_move_iterator(other.end()));
+        }
+        return *this;
+    }
+    LsaVector& operator=(std::initializer_list<T> list) {
+        assign(list.begin(), list.end());
+        return *this;
+    }
+
+    void assign(size_t n, const T& v) {
+        T tmp(v);
+        clear();
+        resize(n, tmp);
+    }
+    template<class InputIt, typename = typename std::enable_if<!std::is_integral<InputIt>::value>::type>
+    void assign(InputIt first, InputIt last) {
+        clear();
+        insert(end(), first, last);
+    }
+    void assign(std::initializer_list<T> list) { assign(list.begin(), list.end()); }
+
+    allocator_type get_allocator() const { return mAllocator; }
+
+    iterator begin() { return mData; }
+    iterator end() { return mData + mSize; }
+    const_iterator begin() const { return mData; }
+    const_iterator end() const { return mData + mSize; }
+    const_iterator cbegin() const { return mData; }
+    const_iterator cend() const { return mData + mSize; }
+    reverse_iterator rbegin() { return reverse_iterator(end()); }
+    reverse_iterator rend() { return reverse_iterator(begin()); }
+    const_reverse_iterator rbegin() const { return const_reverse_iterator(end()); }
+    const_reverse_iterator rend() const { return const_reverse_iterator(begin()); }
+    const_reverse_iterator crbegin() const { return rbegin(); }
+    const_reverse_iterator crend() const { return rend(); }
+
+    T* data() { return mData; }
+    const T* data() const { return mData; }
+
+    size_t size() const { return mSize; }
+    size_t max_size() const { return size_t(-1) / sizeof(T); }
+    size_t capacity() const { return mCapacity; }
+    bool empty() const { return mSize == 0; }
+
+    T& operator[](size_t i) { return mData[i]; }
+    const T& operator[](size_t i) const { return mData[i]; }
+    T& at(size_t i) {
+        if (i >= mSize) {
+            throw std::out_of_range("LsaVector::at");
+        }
+        return mData[i];
+    }
+    const T& at(size_t i) const {
+        if (i >= mSize) {
+            throw std::out_of_range("LsaVector::at");
+        }
+        return mData[i];
+    }
+    T& front() { return mData[0]; }
+    const T& front() const { return mData[0]; }
+    T& back() { return mData[mSize - 1]; }
+    const T& back() const { return mData[mSize - 1]; }
+
+    void push_back(const T& v) { emplace_back(v); }
+    void push_back(T&& v) { emplace_back(std::move(v)); }
+
+    template<typename... Args>
+    T& emplace_back(Args&&... args) {
+        if (mSize == mCapacity && !extend(mSize + 1)) {
+            // 'args' may refer to an element, which relocating would move away
+            T tmp(std::forward<Args>(args)...);
+            relocate(mCapacity * 2 > mSize + 1 ? mCapacity * 2 : mSize + 1);
+            T* ret = new (mData + mSize) T(std::move(tmp));
+            ++mSize;
+            return *ret;
+        }
+        T* ret = new (mData + mSize) T(std::forward<Args>(args)...);
+        ++mSize;
+        return *ret;
+    }
+
+    void pop_back() {
+        mData[--mSize].~T();
+    }
+
+    template<typename... Args>
+    iterator emplace(const_iterator pos, Args&&... args) {
+        size_t index = pos - mData;
+        emplace_back(std::forward<Args>(args)...);
+        std::rotate(mData + index, mData + mSize - 1, mData + mSize);
+        return mData + index;
+    }
+    iterator insert(const_iterator pos, const T& v) { return emplace(pos, v); }
+    iterator insert(const_iterator pos, T&& v) { return emplace(pos, std::move(v)); }
+    iterator insert(const_iterator pos, size_t n, const T& v) {
+        size_t index = pos - mData;
+        T tmp(v);
+        reserve(mSize + n);
+        for (size_t i = 0; i < n; ++i) {
+            emplace_back(tmp);
+        }
+        std::rotate(mData + index, mData + mSize - n, mData + mSize);
+        return mData + index;
+    }
+    template<class InputIt, typename = typename std::enable_if<!std::is_integral<InputIt>::value>::type>
+    iterator insert(const_iterator pos, InputIt first, InputIt last) {
+        size_t index = pos - mData;
+        size_t oldSize = mSize;
+        for (; first != last; ++first) {
+            emplace_back(*first);
+        }
+        std::rotate(mData + index, mData + oldSize, mData + mSize);
+        return mData + index;
+    }
+    iterator insert(const_iterator pos, std::initializer_list<T> list) {
+        return insert(pos, list.begin(), list.end());
+    }
+
+    iterator erase(const_iterator pos) { return erase(pos, pos + 1); }
+    iterator erase(const_iterator first, const_iterator last) {
+        iterator dst = mData + (first - mData);
+        if (first != last) {
+            iterator newEnd = std::move(mData + (last - mData), end(), dst);
+            while (end() != newEnd) {
+                pop_back();
+            }
+        }
+        return dst;
+    }
+
+    void clear() {
+        while (mSize > 0) {
+            pop_back();
+        }
+    }
+
+    void reserve(size_t n) {
+        if (n > mCapacity && !extend(n)) {
+            relocate(n);
+        }
+    }
+
+    // the arena can't take memory back, so there is nothing to release
+    void shrink_to_fit() {}
+
+    void resize(size_t n) {
+        reserve(n);
+        while (mSize < n) {
+            new (mData + mSize) T();
+            ++mSize;
+        }
+        while (mSize > n) {
+            pop_back();
+        }
+    }
+
+    void resize(size_t n, const T& v) {
+        if (n > mCapacity) {
+            T tmp(v);
+            reserve(n);
+            resize(n, tmp);
+            return;
+        }
+        while (mSize < n) {
+            new (mData + mSize) T(v);
+            ++mSize;
+        }
+        while (mSize > n) {
+            pop_back();
+        }
+    }
+
+    void swap(LsaVector& other) {
+        std::swap(mData, other.mData);
+        std::swap(mSize, other.mSize);
+        std::swap(mCapacity, other.mCapacity);
+    }
+
+private:
+    bool extend(size_t n) {
+        if (!mAllocator.tryExtend(mData, mCapacity, n)) {
+            return false;
+        }
+        mCapacity = n;
+        return true;
+    }
+
+    void relocate(size_t n) {
+        T* data = mAllocator.allocate(n);
+        for (size_t i = 0; i < mSize; ++i) {
+            new (data + i) T(std::move(mData[i]));
+            mData[i].~T();
+        }
+        if (mData) {
+            mAllocator.deallocate(mData, mCapacity);
+        }
+        mData = data;
+        mCapacity = n;
+    }
+
+    LinearStdAllocator<T> mAllocator;
+    T* mData;
+    size_t mSize;
+    size_t mCapacity;
+};
+
+template <class T>
+bool operator==(const LsaVector<T>& a, const LsaVector<T>& b) {
+    return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin());
+}
+template <class T>
+bool operator!=(const LsaVector<T>& a, const LsaVector<T>& b) { return !(a == b); }
+template <class T>
+bool operator<(const LsaVector<T>& a, const LsaVector<T>& b) {
+    return std::lexicographical_compare(a.begin(), a.end(), b.begin(), b.end());
+}
+template <class T>
+bool operator>(const LsaVector<T>& a, const LsaVector<T>& b) { return b < a; }
+template <class T>
+bool operator<=(const LsaVector<T>& a, const LsaVector<T>& b) { return !(b < a); }
+template <class T>
+bool operator>=(const LsaVector<T>& a, const LsaVector<T>& b) { return !(a < b); }
+
+/**
+ * A vector that can live in the arena it stores its elements in, including a MappedArena mapped
+ * at another address by a later run: it refers to its buffer with an offset_ptr and is passed
+ * the allocator on every call that may grow it, instead of holding on to it. Growing works as
+ * for LsaVector. Elements are never destroyed, so they must be trivially destructible.
+ */
+template <class T>
+class OffsetVector {
+public:
+    static_assert(std::is_trivially_destructible<T>::value,
+            "Error, OffsetVector elements are never destroyed");
+
+    typedef T value_type;
+    typedef size_t size_type;
+    typedef T* iterator;
+    typedef const T* const_iterator;
+
+    OffsetVector() : mSize(0), mCapacity(0) {}
+
+    iterator begin() { return mData.get(); }
+    iterator end() { return mData.get() + mSize; }
+    const_iterator begin() const { return mData.get(); }
+    const_iterator end() const { return mData.get() + mSize; }
+
+    T* data() { return mData.get(); }
+    const T* data() const { return mData.get(); }
+
+    size_t size() const { return mSize; }
+    size_t capacity() const { return mCapacity; }
+    bool empty() const { return mSize == 0; }
+
+    T& operator[](size_t i) { return mData[i]; }
+    const T& operator[](size_t i) const { return mData[i]; }
+    T& back() { return mData[mSize - 1]; }
+    const T& back() const { return mData[mSize - 1]; }
+
+    void push_back(LinearAllocator& allocator, const T& v) { emplace_back(allocator, v); }
+
+    template<typename... Args>
+    T& emplace_back(LinearAllocator& allocator, Args&&... args) {
+        if (mSize == mCapacity) {
+            grow(allocator, mSize + 1);
+        }
+        T* ret = new (mData.get() + mSize) T(std::forward<Args>(args)...);
+        ++mSize;
+        return *ret;
+    }
+
+    void pop_back() { --mSize; }
+    void clear() { mSize = 0; }
+
+    void reserve(LinearAllocator& allocator, size_t n) {
+        if (n > mCapacity && !allocator.tryExtend(mData.get(), mCapacity * sizeof(T), n * sizeof(T))) {
+            relocate(allocator, n);
+        }
+        if (n > mCapacity) {
+            mCapacity = n;
+        }
+    }
+
+    /**
+     * Copies 'count' elements into the vector, in a buffer of exactly that size when it doesn't
+     * have the room yet.
+     */
+    void assign(LinearAllocator& allocator, const T* first, size_t count) {
+        mSize = 0;
+        reserve(allocator, count);
+        for (size_t i = 0; i < count; ++i) {
+            new (mData.get() + i) T(first[i]);
+        }
+        mSize = count;
+    }
+
+private:
+    void grow(LinearAllocator& allocator, size_t n) {
+        if (allocator.tryExtend(mData.get(), mCapacity * sizeof(T), n * sizeof(T))) {
+            mCapacity = n;
+            return;
+        }
+        n = n > mCapacity * 2 ? n : mCapacity * 2;
+        relocate(allocator, n);
+        mCapacity = n;
+    }
+
+    void relocate(LinearAllocator& allocator, size_t n) {
+        T* data = static_cast<T*>(allocator.alloc<T>(n * sizeof(T)));
+        if (!data) {
+            throw std::bad_alloc();
+        }
+        for (size_t i = 0; i < mSize; ++i) {
+            new (data + i) T(std::move(mData[i]));
+        }
+        mData = data;
+    }
+
+    offset_ptr<T> mData;
+    size_t mSize;
+    size_t mCapacity;
 };
 
 }; // namespace mm
@@ -0,0 +1,80 @@
+#ifndef _MEMMGR_LINEAR_PAGE_RECYCLER_H_
+#define _MEMMGR_LINEAR_PAGE_RECYCLER_H_
+
+#include <stddef.h>
+
+#include <mutex>
+
+namespace mm
+{
+
+// Keeps the pages of destroyed LinearAllocators for the next ones, so that
+// short-lived arenas don't go to malloc for every page. Pages are cached by
+// their exact size, which the page-size ladder keeps to a few values. It
+// also remembers how much recent arenas used, for new ones to start with
+// a page that large. It may be shared by allocators on any thread.
+class LinearPageRecycler
+{
+public:
+	// caches at most 'max_cached_bytes' of pages
+	explicit LinearPageRecycler(size_t max_cached_bytes);
+	LinearPageRecycler(const LinearPageRecycler&) = delete;
+	LinearPageRecycler& operator = (const LinearPageRecycler&) = delete;
+	~LinearPageRecycler();
+
+	// a cached page of 'size' bytes, or a new one from malloc()
+	void* Allocate(size_t size);
+	// caches the page, or frees it when the cache is full
+	void  Free(void* p, size_t size);
+
+	// frees every cached page
+	void  Trim();
+
+	// the bytes an arena used before it was destroyed
+	void   RecordHighWater(size_t bytes);
+	// the largest of the recent high-water marks, 0 before any
+	size_t GetSuggestedSize() const;
+
+	size_t GetCachedBytes() const;
+
+	void DumpMemoryStats(const char* prefix = "") const;
+
+	// shared by the arenas that don't bring their own
+	static LinearPageRecycler& Instance();
+
+private:
+	struct FreePage
+	{
+		FreePage* next;
+	};
+
+	struct Slot
+	{
+		size_t    size;
+		FreePage* pages;
+		size_t    count;
+	};
+
+	static const int MAX_SLOTS = 16;
+	static const int HIGH_WATER_COUNT = 16;
+
+private:
+	mutable std::mutex m_mutex;
+
+	size_t m_max_cached_bytes;
+	size_t m_cached_bytes;
+
+	Slot m_slots[MAX_SLOTS];
+
+	size_t m_high_water[HIGH_WATER_COUNT];
+	int    m_high_water_pos;
+
+	// Memory usage tracking
+	size_t m_reused;
+	size_t m_allocated;
+
+}; // LinearPageRecycler
+
+}
+
+#endif // _MEMMGR_LINEAR_PAGE_RECYCLER_H_
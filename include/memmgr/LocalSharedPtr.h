@@ -0,0 +1,304 @@
+#ifndef _MEMMGR_LOCAL_SHARED_PTR_H_
+#define _MEMMGR_LOCAL_SHARED_PTR_H_
+
+#include "memmgr/BlockAllocatorPool.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <type_traits>
+#include <utility>
+
+namespace mm
+{
+
+// Shared ownership for objects that never leave one thread: the reference
+// counts are plain integers and the control block and the object live in
+// a single BlockAllocatorPool block. Copying a local_shared_ptr to another
+// thread is undefined behaviour; use std::shared_ptr for that.
+class LocalControlBlock
+{
+public:
+	void AddRef() { ++m_uses; }
+	void Release()
+	{
+		if (--m_uses == 0)
+		{
+			m_dispose(this);
+			ReleaseWeak();
+		}
+	}
+
+	void AddWeak() { ++m_weaks; }
+	void ReleaseWeak()
+	{
+		if (--m_weaks == 0) {
+			m_destroy(this);
+		}
+	}
+
+	bool Lock()
+	{
+		if (m_uses == 0) {
+			return false;
+		}
+		++m_uses;
+		return true;
+	}
+
+	uint32_t UseCount() const { return m_uses; }
+
+protected:
+	typedef void (*Callback)(LocalControlBlock* cb);
+
+	LocalControlBlock(Callback dispose, Callback destroy)
+		: m_uses(1), m_weaks(1), m_dispose(dispose), m_destroy(destroy) {}
+
+private:
+	uint32_t m_uses;
+	// all strong owners together hold one weak reference
+	uint32_t m_weaks;
+
+	Callback m_dispose;
+	Callback m_destroy;
+
+}; // LocalControlBlock
+
+template <typename T>
+class LocalInplaceBlock : public LocalControlBlock
+{
+public:
+	template <typename... Args>
+	static LocalInplaceBlock* Create(BlockAllocatorPool* pool, Args&&... args)
+	{
+		static_assert(alignof(T) <= sizeof(void*),
+			"over-aligned types are not supported by the pool");
+
+		void* buf = pool->Allocate(sizeof(LocalInplaceBlock));
+		if (!buf) {
+			return nullptr;
+		}
+		LocalInplaceBlock* cb = new (buf) LocalInplaceBlock(pool);
+		try {
+			new (cb->Get()) T(std::forward<Args>(args)...);
+		} catch (...) {
+			pool->Free(buf, sizeof(LocalInplaceBlock));
+			throw;
+		}
+		return cb;
+	}
+
+	T* Get() { return reinterpret_cast<T*>(&m_storage); }
+
+private:
+	explicit LocalInplaceBlock(BlockAllocatorPool* pool)
+		: LocalControlBlock(&Dispose, &Destroy), m_pool(pool) {}
+
+	static void Dispose(LocalControlBlock* cb)
+	{
+		static_cast<LocalInplaceBlock*>(cb)->Get()->~T();
+	}
+
+	static void Destroy(LocalControlBlock* cb)
+	{
+		LocalInplaceBlock* self = static_cast<LocalInplaceBlock*>(cb);
+		self->m_pool->Free(self, sizeof(LocalInplaceBlock));
+	}
+
+private:
+	BlockAllocatorPool* m_pool;
+
+	typename std::aligned_storage<sizeof(T), alignof(T)>::type m_storage;
+
+}; // LocalInplaceBlock
+
+template <typename T>
+class local_weak_ptr;
+
+template <typename T>
+class local_shared_ptr
+{
+public:
+	typedef T element_type;
+
+	local_shared_ptr() : m_ptr(nullptr), m_cb(nullptr) {}
+	local_shared_ptr(std::nullptr_t) : m_ptr(nullptr), m_cb(nullptr) {}
+
+	local_shared_ptr(const local_shared_ptr& other)
+		: m_ptr(other.m_ptr), m_cb(other.m_cb)
+	{
+		if (m_cb) {
+			m_cb->AddRef();
+		}
+	}
+	local_shared_ptr(local_shared_ptr&& other)
+		: m_ptr(other.m_ptr), m_cb(other.m_cb)
+	{
+		other.m_ptr = nullptr;
+		other.m_cb = nullptr;
+	}
+
+	template <typename U, typename = typename std::enable_if<std::is_convertible<U*, T*>::value>::type>
+	local_shared_ptr(const local_shared_ptr<U>& other)
+		: m_ptr(other.m_ptr), m_cb(other.m_cb)
+	{
+		if (m_cb) {
+			m_cb->AddRef();
+		}
+	}
+	template <typename U, typename = typename std::enable_if<std::is_convertible<U*, T*>::value>::type>
+	local_shared_ptr(local_shared_ptr<U>&& other)
+		: m_ptr(other.m_ptr), m_cb(other.m_cb)
+	{
+		other.m_ptr = nullptr;
+		other.m_cb = nullptr;
+	}
+
+	// aliasing constructor: shares ownership with 'owner' but points at 'p'
+	template <typename U>
+	local_shared_ptr(const local_shared_ptr<U>& owner, T* p)
+		: m_ptr(p), m_cb(owner.m_cb)
+	{
+		if (m_cb) {
+			m_cb->AddRef();
+		}
+	}
+
+	~local_shared_ptr()
+	{
+		if (m_cb) {
+			m_cb->Release();
+		}
+	}
+
+	local_shared_ptr& operator = (local_shared_ptr other)
+	{
+		swap(other);
+		return *this;
+	}
+
+	void swap(local_shared_ptr& other)
+	{
+		std::swap(m_ptr, other.m_ptr);
+		std::swap(m_cb, other.m_cb);
+	}
+
+	void reset() { local_shared_ptr().swap(*this); }
+
+	T* get() const { return m_ptr; }
+	T& operator * () const { return *m_ptr; }
+	T* operator -> () const { return m_ptr; }
+	explicit operator bool () const { return m_ptr != nullptr; }
+
+	long use_count() const { return m_cb ? m_cb->UseCount() : 0; }
+	bool unique() const { return use_count() == 1; }
+
+private:
+	local_shared_ptr(T* p, LocalControlBlock* cb) : m_ptr(p), m_cb(cb) {}
+
+	template <typename U> friend class local_shared_ptr;
+	template <typename U> friend class local_weak_ptr;
+	template <typename U, typename... Args>
+	friend local_shared_ptr<U> make_local_shared(BlockAllocatorPool* pool, Args&&... args);
+
+private:
+	T* m_ptr;
+	LocalControlBlock* m_cb;
+
+}; // local_shared_ptr
+
+template <typename T>
+class local_weak_ptr
+{
+public:
+	local_weak_ptr() : m_ptr(nullptr), m_cb(nullptr) {}
+
+	template <typename U, typename = typename std::enable_if<std::is_convertible<U*, T*>::value>::type>
+	local_weak_ptr(const local_shared_ptr<U>& sp)
+		: m_ptr(sp.m_ptr), m_cb(sp.m_cb)
+	{
+		if (m_cb) {
+			m_cb->AddWeak();
+		}
+	}
+
+	local_weak_ptr(const local_weak_ptr& other)
+		: m_ptr(other.m_ptr), m_cb(other.m_cb)
+	{
+		if (m_cb) {
+			m_cb->AddWeak();
+		}
+	}
+	local_weak_ptr(local_weak_ptr&& other)
+		: m_ptr(other.m_ptr), m_cb(other.m_cb)
+	{
+		other.m_ptr = nullptr;
+		other.m_cb = nullptr;
+	}
+
+	~local_weak_ptr()
+	{
+		if (m_cb) {
+			m_cb->ReleaseWeak();
+		}
+	}
+
+	local_weak_ptr& operator = (local_weak_ptr other)
+	{
+		swap(other);
+		return *this;
+	}
+
+	void swap(local_weak_ptr& other)
+	{
+		std::swap(m_ptr, other.m_ptr);
+		std::swap(m_cb, other.m_cb);
+	}
+
+	void reset() { local_weak_ptr().swap(*this); }
+
+	long use_count() const { return m_cb ? m_cb->UseCount() : 0; }
+	bool expired() const { return use_count() == 0; }
+
+	local_shared_ptr<T> lock() const
+	{
+		if (m_cb && m_cb->Lock()) {
+			return local_shared_ptr<T>(m_ptr, m_cb);
+		}
+		return local_shared_ptr<T>();
+	}
+
+private:
+	T* m_ptr;
+	LocalControlBlock* m_cb;
+
+}; // local_weak_ptr
+
+template <typename T, typename U>
+inline bool operator == (const local_shared_ptr<T>& a, const local_shared_ptr<U>& b) { return a.get() == b.get(); }
+template <typename T, typename U>
+inline bool operator != (const local_shared_ptr<T>& a, const local_shared_ptr<U>& b) { return a.get() != b.get(); }
+template <typename T>
+inline bool operator == (const local_shared_ptr<T>& a, std::nullptr_t) { return !a; }
+template <typename T>
+inline bool operator != (const local_shared_ptr<T>& a, std::nullptr_t) { return static_cast<bool>(a); }
+
+// allocates the object and its counts in one block of 'pool'; the last
+// reference must be dropped on the thread that owns the pool. Returns an
+// empty pointer when the pool refuses the block, e.g. over its budget
+template <typename T, typename... Args>
+local_shared_ptr<T> make_local_shared(BlockAllocatorPool* pool, Args&&... args)
+{
+	LocalInplaceBlock<T>* cb = LocalInplaceBlock<T>::Create(pool, std::forward<Args>(args)...);
+	return cb ? local_shared_ptr<T>(cb->Get(), cb) : local_shared_ptr<T>();
+}
+
+template <typename T, typename... Args>
+local_shared_ptr<T> make_local_shared(Args&&... args)
+{
+	return make_local_shared<T>(BlockAllocatorPool::Instance(), std::forward<Args>(args)...);
+}
+
+}
+
+#endif // _MEMMGR_LOCAL_SHARED_PTR_H_
@@ -0,0 +1,92 @@
+#ifndef _MEMMGR_MAPPED_ARENA_H_
+#define _MEMMGR_MAPPED_ARENA_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <mutex>
+
+namespace mm
+{
+
+// A file mapped into memory that LinearAllocator pages can be carved from,
+// see LinearAllocator::Policy::arena. Data built into it once is persisted
+// with the file and mapped back by a later run without parsing, paged in
+// as it is touched.
+//
+// An arena opened at the address it was created at keeps raw pointers
+// into itself valid; one that lands elsewhere only keeps offset_ptr, so
+// data meant to move between addresses links itself with those. Only
+// trivially destructible objects are meant to be stored: destructors the
+// allocator registers still run when it is destroyed.
+class MappedArena
+{
+public:
+	// Creates or truncates 'filepath' with room for 'capacity' bytes, which
+	// take no disk space until written. 'base' asks for a fixed address and
+	// fails when it's taken; nullptr lets the system choose.
+	static MappedArena* Create(const char* filepath, size_t capacity, void* base = nullptr);
+	// Maps back an arena written by an earlier run. 'base' is as for
+	// Create(); nullptr tries the address the arena was created at and
+	// takes another when that's taken. Only a writable arena gives out
+	// more pages.
+	static MappedArena* Open(const char* filepath, bool writable = false, void* base = nullptr);
+
+	MappedArena(const MappedArena&) = delete;
+	MappedArena& operator = (const MappedArena&) = delete;
+	// persists a writable arena, and trims its file to the used size
+	~MappedArena();
+
+	// 'size' bytes aligned to 16, nullptr when the arena is full or read
+	// only; pages are never given back
+	void* AllocatePage(size_t size);
+
+	bool Contains(const void* p) const {
+		return static_cast<const uint8_t*>(p) >= m_base && static_cast<const uint8_t*>(p) < m_base + m_capacity;
+	}
+
+	// the object to start from after a restore, stored as an offset
+	void  SetRoot(const void* p);
+	void* GetRoot() const;
+	template<typename T>
+	T* GetRoot() const { return static_cast<T*>(GetRoot()); }
+
+	// writes the header and the dirty pages to the file
+	bool Persist();
+
+	void*  GetBase() const { return m_base; }
+	size_t GetCapacity() const { return m_capacity; }
+	size_t GetUsedSize() const;
+	bool   IsWritable() const { return m_writable; }
+	// true when raw pointers stored by the run that built it still hold
+	bool   IsAtCreationBase() const;
+
+private:
+	struct Header;
+
+	MappedArena();
+
+	static MappedArena* Map(const char* filepath, bool create, bool writable, size_t capacity, void* base);
+	void Unmap();
+
+	Header* GetHeader() const { return reinterpret_cast<Header*>(m_base); }
+
+private:
+	mutable std::mutex m_mutex;
+
+	uint8_t* m_base;
+	size_t   m_capacity;
+	bool     m_writable;
+
+#ifdef _WIN32
+	void*    m_file;
+	void*    m_mapping;
+#else
+	int      m_fd;
+#endif // _WIN32
+
+}; // MappedArena
+
+}
+
+#endif // _MEMMGR_MAPPED_ARENA_H_
@@ -0,0 +1,95 @@
+#ifndef _MEMMGR_MEMORY_BUDGET_H_
+#define _MEMMGR_MEMORY_BUDGET_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+
+namespace mm
+{
+
+// A named cap on the memory a group of allocators may take from the system.
+// Allocators charge it when they acquire a page (or a large block) and
+// credit it when they give one back, so the cost is per page, not per
+// block. A budget can be shared by allocators on any thread.
+class MemoryBudget
+{
+public:
+	enum HardLimitPolicy
+	{
+		// the allocation fails and the allocator returns nullptr
+		HARD_LIMIT_FAIL,
+		// the allocating thread waits until enough memory is released
+		HARD_LIMIT_BLOCK,
+	};
+
+	// called on the allocating thread with no lock held, so it may release
+	// memory charged to this budget
+	typedef void (*PressureCallback)(MemoryBudget& budget, size_t requested, void* ud);
+
+	MemoryBudget(const char* name, size_t soft_limit, size_t hard_limit,
+		HardLimitPolicy policy = HARD_LIMIT_FAIL);
+	MemoryBudget(const MemoryBudget&) = delete;
+	MemoryBudget& operator = (const MemoryBudget&) = delete;
+	~MemoryBudget();
+
+	// called when usage first crosses the soft limit
+	void SetSoftLimitCallback(PressureCallback cb, void* ud);
+	// called when a request would exceed the hard limit, before the policy
+	// is applied; the request is retried once after it returns
+	void SetHardLimitCallback(PressureCallback cb, void* ud);
+	// how long HARD_LIMIT_BLOCK waits before failing, 0 waits forever
+	void SetBlockTimeout(uint32_t ms) { m_block_timeout_ms = ms; }
+
+	bool Acquire(size_t size);
+	void Release(size_t size);
+
+	const char* GetName() const { return m_name; }
+
+	size_t GetCurrent() const { return m_current.load(std::memory_order_relaxed); }
+	size_t GetPeak() const { return m_peak.load(std::memory_order_relaxed); }
+	size_t GetSoftLimit() const { return m_soft_limit; }
+	size_t GetHardLimit() const { return m_hard_limit; }
+
+	void ResetPeak();
+
+	void DumpMemoryStats(const char* prefix = "") const;
+
+	// every live budget, by name
+	static MemoryBudget* Find(const char* name);
+	static void DumpAllMemoryStats(const char* prefix = "");
+
+private:
+	bool TryAcquire(size_t size, bool& crossed_soft);
+	void UpdatePeak(size_t current);
+
+private:
+	const char* m_name;
+
+	size_t m_soft_limit, m_hard_limit;
+	HardLimitPolicy m_policy;
+	uint32_t m_block_timeout_ms;
+
+	std::atomic<size_t> m_current;
+	std::atomic<size_t> m_peak;
+
+	PressureCallback m_soft_cb;
+	void* m_soft_ud;
+	PressureCallback m_hard_cb;
+	void* m_hard_ud;
+
+	// blocked acquirers
+	std::atomic<int> m_waiters;
+	std::mutex m_mutex;
+	std::condition_variable m_cond;
+
+	MemoryBudget* m_next;
+
+}; // MemoryBudget
+
+}
+
+#endif // _MEMMGR_MEMORY_BUDGET_H_
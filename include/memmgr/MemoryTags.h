@@ -0,0 +1,144 @@
+#ifndef _MEMMGR_MEMORY_TAGS_H_
+#define _MEMMGR_MEMORY_TAGS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+
+namespace mm
+{
+
+// a category memory is charged to, from MemoryTags::Register()
+enum MemoryTag : uint8_t
+{
+	MEMORY_TAG_NONE = 0,
+};
+
+// Bytes held per category, such as "render", "net" or "cache", across
+// BlockAllocatorPool, FreelistAllocator and LinearAllocator. Allocations
+// are charged to the tag passed to them, or else to the calling thread's
+// current tag, which MemoryTagScope sets. A block must be freed under the
+// tag it was allocated with: pass it again, or free in the same scope.
+// The pool charges whole class blocks, the linear allocator whole pages,
+// under the tag current when it was constructed unless setTag() says
+// otherwise.
+//
+// The hooks are only compiled in when the library is built with
+// MEMMGR_TAGS defined. Each thread then counts into its own counters, a
+// few adds with no lock nor atomic read-modify-write, and queries add up
+// every thread's. A thread's counts carry on in a shared total once it
+// exits.
+class MemoryTags
+{
+public:
+	static const size_t MAX_TAGS = 64;
+	static const size_t MAX_NAME_LENGTH = 31;
+
+	struct Stats
+	{
+		// negative in a thread's share when it frees what others allocated
+		int64_t  live_bytes;
+		int64_t  peak_bytes;
+		uint64_t alloc_count;
+		uint64_t free_count;
+	};
+
+	// the tag of 'name', registered on the first call; MEMORY_TAG_NONE when
+	// every tag is taken
+	static MemoryTag Register(const char* name);
+	// MEMORY_TAG_NONE when 'name' isn't registered
+	static MemoryTag Find(const char* name);
+	static const char* GetName(MemoryTag tag);
+
+	static MemoryTag GetCurrent() { return m_current; }
+	static void SetCurrent(MemoryTag tag) { m_current = tag; }
+
+	static void OnAlloc(MemoryTag tag, size_t size)
+	{
+		Counters* c = m_counters ? m_counters : AttachThread();
+		int64_t live = Add(c->live_bytes[tag], static_cast<int64_t>(size));
+		Add(c->alloc_count[tag], static_cast<uint64_t>(1));
+		if (live > c->peak_bytes[tag].load(std::memory_order_relaxed)) {
+			c->peak_bytes[tag].store(live, std::memory_order_relaxed);
+		}
+	}
+	static void OnFree(MemoryTag tag, size_t size)
+	{
+		Counters* c = m_counters ? m_counters : AttachThread();
+		Add(c->live_bytes[tag], -static_cast<int64_t>(size));
+		Add(c->free_count[tag], static_cast<uint64_t>(1));
+	}
+
+	// Every thread's counts added up. The peak is exact for a tag used on
+	// one thread; with blocks freed on other threads it is the highest of
+	// the per thread peaks and of the totals earlier queries saw.
+	static Stats GetStats(MemoryTag tag);
+
+	// a line per tag that was ever charged
+	static void DumpMemoryStats(const char* prefix = "");
+	// the same as text, one "tag live peak allocs frees" line per tag
+	static bool DumpStats(const char* filepath);
+
+private:
+	// read by queries on other threads, written by the owner only
+	struct Counters
+	{
+		std::atomic<int64_t>  live_bytes[MAX_TAGS];
+		std::atomic<int64_t>  peak_bytes[MAX_TAGS];
+		std::atomic<uint64_t> alloc_count[MAX_TAGS];
+		std::atomic<uint64_t> free_count[MAX_TAGS];
+	};
+
+	template<typename T>
+	static T Add(std::atomic<T>& counter, T value)
+	{
+		T sum = counter.load(std::memory_order_relaxed) + value;
+		counter.store(sum, std::memory_order_relaxed);
+		return sum;
+	}
+
+	static Counters* AttachThread();
+	// folds an exiting thread's counts into the shared total
+	static void DetachThread(Counters* counters);
+
+	struct ThreadExit;
+
+private:
+	thread_local static MemoryTag m_current;
+	thread_local static Counters* m_counters;
+
+}; // MemoryTags
+
+// charges the allocations without an explicit tag to 'tag' until it goes
+// out of scope
+class MemoryTagScope
+{
+public:
+	explicit MemoryTagScope(MemoryTag tag)
+		: m_prev(MemoryTags::GetCurrent())
+	{
+		MemoryTags::SetCurrent(tag);
+	}
+	MemoryTagScope(const MemoryTagScope&) = delete;
+	MemoryTagScope& operator = (const MemoryTagScope&) = delete;
+	~MemoryTagScope() { MemoryTags::SetCurrent(m_prev); }
+
+private:
+	MemoryTag m_prev;
+
+}; // MemoryTagScope
+
+}
+
+#ifdef MEMMGR_TAGS
+#define MEMMGR_TAG_ALLOC(tag, size) mm::MemoryTags::OnAlloc(tag, size)
+#define MEMMGR_TAG_FREE(tag, size)  mm::MemoryTags::OnFree(tag, size)
+#define MEMMGR_CURRENT_TAG          mm::MemoryTags::GetCurrent()
+#else
+#define MEMMGR_TAG_ALLOC(tag, size) ((void)(tag))
+#define MEMMGR_TAG_FREE(tag, size)  ((void)(tag))
+#define MEMMGR_CURRENT_TAG          mm::MEMORY_TAG_NONE
+#endif // MEMMGR_TAGS
+
+#endif // _MEMMGR_MEMORY_TAGS_H_
@@ -0,0 +1,63 @@
+#ifndef _MEMMGR_OFFSET_PTR_H_
+#define _MEMMGR_OFFSET_PTR_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace mm
+{
+
+// A pointer stored as the distance from itself to its target, so that it
+// stays valid when the memory holding both is mapped at another address,
+// such as a MappedArena reopened by a later run or a region shared between
+// processes. It must live in the same mapping as its target; copying one
+// elsewhere recomputes the distance.
+template<typename T>
+class offset_ptr
+{
+public:
+	typedef T element_type;
+
+	offset_ptr() : m_offset(NULL_OFFSET) {}
+	offset_ptr(T* p) { set(p); }
+	offset_ptr(const offset_ptr& other) { set(other.get()); }
+
+	offset_ptr& operator = (const offset_ptr& other) { set(other.get()); return *this; }
+	offset_ptr& operator = (T* p) { set(p); return *this; }
+
+	T* get() const {
+		return m_offset == NULL_OFFSET ? nullptr
+			: reinterpret_cast<T*>(reinterpret_cast<intptr_t>(this) + m_offset);
+	}
+
+	T& operator * () const { return *get(); }
+	T* operator -> () const { return get(); }
+	T& operator [] (size_t i) const { return get()[i]; }
+
+	operator T* () const { return get(); }
+
+	offset_ptr& operator += (ptrdiff_t n) { set(get() + n); return *this; }
+	offset_ptr& operator -= (ptrdiff_t n) { set(get() - n); return *this; }
+	offset_ptr& operator ++ () { return *this += 1; }
+	offset_ptr& operator -- () { return *this -= 1; }
+
+private:
+	void set(T* p) {
+		m_offset = p ? reinterpret_cast<intptr_t>(p) - reinterpret_cast<intptr_t>(this) : NULL_OFFSET;
+	}
+
+	// points into the pointer itself, where no target can be
+	static const intptr_t NULL_OFFSET = 1;
+
+	intptr_t m_offset;
+
+}; // offset_ptr
+
+template<typename T, typename U>
+inline bool operator == (const offset_ptr<T>& a, const offset_ptr<U>& b) { return a.get() == b.get(); }
+template<typename T, typename U>
+inline bool operator != (const offset_ptr<T>& a, const offset_ptr<U>& b) { return a.get() != b.get(); }
+
+}
+
+#endif // _MEMMGR_OFFSET_PTR_H_
@@ -0,0 +1,106 @@
+#ifndef _MEMMGR_PAGE_REGION_H_
+#define _MEMMGR_PAGE_REGION_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <mutex>
+
+namespace mm
+{
+
+// A slice of reserved address space that hands out pages of one size.
+// Pages are committed when first handed out and decommitted when given
+// back, apart from the first few bytes that link the free pages. The
+// region may be shared by allocators on any thread.
+class PageRegion
+{
+public:
+	PageRegion();
+
+	void Init(uint8_t* base, size_t size, size_t page_size);
+
+	// nullptr when the region is exhausted, logged the first time; 'zeroed'
+	// tells whether the page was never used before
+	void* AllocatePage(bool* zeroed = nullptr);
+	void  FreePage(void* page);
+
+	bool Contains(const void* p) const {
+		return static_cast<size_t>(static_cast<const uint8_t*>(p) - m_base) < m_size;
+	}
+
+	size_t GetPageSize() const { return m_page_size; }
+	// pages handed out and not freed
+	size_t GetPageCount() const { return m_used; }
+
+private:
+	struct FreePageHeader
+	{
+		FreePageHeader* next;
+	};
+
+private:
+	std::mutex m_mutex;
+
+	uint8_t* m_base;
+	size_t   m_size;
+	size_t   m_page_size;
+	size_t   m_sys_page_size;
+
+	// start of the never used tail, and of its uncommitted part
+	uint8_t* m_top;
+	uint8_t* m_committed;
+	FreePageHeader* m_free;
+
+	size_t   m_used;
+
+	bool     m_exhausted_logged;
+
+}; // PageRegion
+
+// One reservation for the whole process, split into a PageRegion per size
+// class, so the class of a pooled pointer is a subtract and a shift and
+// pool pages don't interleave with the heap.
+class ClassRegions
+{
+public:
+	// Reserves 'region_size' bytes of address space per class on the first
+	// call. Later calls return the same reservation when the layout matches,
+	// nullptr otherwise. 'region_size' must be a power of two, and a
+	// multiple of every page size.
+	static ClassRegions* Acquire(size_t num_classes, size_t region_size, const size_t* page_sizes);
+
+	// the class of 'p', or -1 when it is outside the reservation
+	int ClassOf(const void* p) const
+	{
+		size_t offset = static_cast<size_t>(static_cast<const uint8_t*>(p) - m_base);
+		if (offset >= m_total_size) {
+			return -1;
+		}
+		return static_cast<int>(offset >> m_region_shift);
+	}
+
+	PageRegion* GetRegion(size_t cls) { return m_regions + cls; }
+	size_t GetClassCount() const { return m_num_classes; }
+	size_t GetRegionSize() const { return static_cast<size_t>(1) << m_region_shift; }
+
+private:
+	ClassRegions();
+	ClassRegions(const ClassRegions&) = delete;
+	ClassRegions& operator = (const ClassRegions&) = delete;
+
+	bool Init(size_t num_classes, size_t region_size, const size_t* page_sizes);
+
+private:
+	uint8_t* m_base;
+	size_t   m_total_size;
+	uint32_t m_region_shift;
+
+	size_t      m_num_classes;
+	PageRegion* m_regions;
+
+}; // ClassRegions
+
+}
+
+#endif // _MEMMGR_PAGE_REGION_H_
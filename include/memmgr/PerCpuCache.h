@@ -0,0 +1,105 @@
+#ifndef _MEMMGR_PER_CPU_CACHE_H_
+#define _MEMMGR_PER_CPU_CACHE_H_
+
+#include "memmgr/BlockAllocatorPool.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <mutex>
+
+namespace mm
+{
+
+// A BlockAllocatorPool front end that keeps a small cache of free blocks
+// per CPU and size class, in place of one pool per thread, so the memory
+// parked in caches is bounded by the core count and not by the thread
+// count. Any thread may free any block.
+//
+// On Linux x86-64 with glibc 2.35 or later, the caches are pushed and
+// popped inside restartable sequences (rseq): the kernel restarts an
+// operation that was preempted or migrated to another CPU, so the fast
+// path has no atomic instruction and no lock. A miss refills, and an
+// overflow flushes, half a cache at a time from one shared backend pool
+// under a mutex; so do blocks above the largest class.
+//
+// Where rseq isn't registered, on other platforms or when glibc was told
+// not to (glibc.pthread.rseq=0), there are no caches and every call goes
+// to the backend pool under the mutex, so the same rules hold everywhere.
+class PerCpuCache
+{
+public:
+	// 'max_slots' caps the blocks cached per CPU and class;
+	// 'max_class_bytes' lowers the cap for large classes
+	explicit PerCpuCache(const BlockAllocatorPool::Config& cfg = BlockAllocatorPool::GetDefaultConfig(),
+		size_t max_slots = DEFAULT_MAX_SLOTS, size_t max_class_bytes = DEFAULT_MAX_CLASS_BYTES);
+	// returns every cached block; no thread may be using the cache
+	~PerCpuCache();
+
+	void* Allocate(size_t size);
+	void  Free(void* p, size_t size);
+
+	// returns the calling CPU's cached blocks and the backend's empty
+	// pages to the system
+	void  Trim();
+
+	// false when every call goes to the locked backend pool
+	bool  IsPerCpu() const { return m_cpus != nullptr; }
+
+	// blocks waiting in the caches of every CPU, approximate while other
+	// threads use the cache
+	size_t GetCachedBlockCount() const;
+
+	// whether the calling thread can use restartable sequences
+	static bool IsRseqAvailable();
+
+	// shared by the whole process, built with the default pool config
+	static PerCpuCache* Instance();
+
+	static const size_t DEFAULT_MAX_SLOTS       = 32;
+	static const size_t DEFAULT_MAX_CLASS_BYTES = 16 * 1024;
+
+private:
+	// the free blocks of one class on one CPU, a stack
+	struct Slab
+	{
+		uintptr_t count;
+		void*     blocks[1];
+	};
+
+	Slab* GetSlab(uint32_t cpu, int cls) const {
+		return reinterpret_cast<Slab*>(m_cpus + cpu * m_cpu_stride + m_slab_offsets[cls]);
+	}
+
+	// false when the current CPU's slab is empty, or full
+	bool PopLocal(int cls, void*& p);
+	bool PushLocal(int cls, void* p);
+
+	void* Refill(int cls, size_t size);
+	void  Flush(int cls, void* p, size_t size);
+
+	// disable copy & assignment
+	PerCpuCache(const PerCpuCache&) = delete;
+	PerCpuCache& operator = (const PerCpuCache&) = delete;
+
+private:
+	std::mutex         m_mutex;
+	BlockAllocatorPool m_backend;
+
+	// the slabs of every class per CPU, each CPU on its own cache lines;
+	// null when every call goes to the backend
+	uint8_t*  m_cpus;
+	size_t    m_cpu_stride;
+	uint32_t  m_num_cpus;
+
+	// per class
+	size_t*   m_slab_offsets;
+	uintptr_t* m_capacities;
+	size_t*   m_data_sizes;
+	size_t    m_num_classes;
+
+}; // PerCpuCache
+
+}
+
+#endif // _MEMMGR_PER_CPU_CACHE_H_
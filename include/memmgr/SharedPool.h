@@ -0,0 +1,100 @@
+#ifndef _MEMMGR_SHARED_POOL_H_
+#define _MEMMGR_SHARED_POOL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace mm
+{
+
+// A block pool in shared memory, for handing messages between processes
+// without copying them. A producer allocates a block and writes the
+// message in place, sends its offset over any channel, and the consumer
+// maps the offset back and frees the block into the same pool.
+//
+// The region comes from memfd_create(), or from shm_open() when named.
+// Processes map it at different addresses, so only offsets, and offset_ptr
+// links inside the region, mean the same thing everywhere. Each power of
+// two size class has a free list whose head is an offset and an ABA tag in
+// one 64-bit word; allocating and freeing are a compare-and-swap on it, so
+// no process ever holds a lock that could die with it. A process that dies
+// holding blocks only leaks them. Empty lists are refilled with a chunk
+// carved from the untouched end of the region. A freed block is only
+// reused by its own class, and memory is never given back to the system
+// before the region is destroyed, so size the region for the peak of
+// every class.
+//
+// POSIX only, Create() returns nullptr elsewhere.
+class SharedPool
+{
+public:
+	// An anonymous region, shared with the processes forked after, or
+	// with those the descriptor is passed to. 'max_block_size' is the
+	// largest block Allocate() can serve.
+	static SharedPool* Create(size_t size, size_t max_block_size = DEFAULT_MAX_BLOCK_SIZE);
+	// a region other processes open by name, until Unlink()
+	static SharedPool* Create(const char* name, size_t size, size_t max_block_size = DEFAULT_MAX_BLOCK_SIZE);
+	static SharedPool* Open(const char* name);
+	// maps the region behind a descriptor from GetFd() of another process
+	static SharedPool* Attach(int fd);
+	static bool Unlink(const char* name);
+
+	SharedPool(const SharedPool&) = delete;
+	SharedPool& operator = (const SharedPool&) = delete;
+	// unmaps the region, which lives on while others have it mapped
+	~SharedPool();
+
+	// nullptr when 'size' is above the largest class or the region is full
+	void* Allocate(size_t size);
+	// from any process that maps the region
+	void  Free(void* p);
+
+	// offset 0 is never a block
+	uint64_t ToOffset(const void* p) const {
+		return p ? static_cast<uint64_t>(static_cast<const uint8_t*>(p) - m_base) : 0;
+	}
+	void* FromOffset(uint64_t offset) const {
+		return offset ? m_base + offset : nullptr;
+	}
+	template<typename T>
+	T* FromOffset(uint64_t offset) const { return static_cast<T*>(FromOffset(offset)); }
+
+	bool Contains(const void* p) const {
+		return static_cast<const uint8_t*>(p) >= m_base && static_cast<const uint8_t*>(p) < m_base + m_size;
+	}
+
+	int    GetFd() const { return m_fd; }
+	size_t GetSize() const { return m_size; }
+	// bytes carved into blocks so far
+	size_t GetCarvedSize() const;
+	// blocks handed out and not freed, by every process
+	size_t GetLiveBlockCount() const;
+
+	void DumpMemoryStats(const char* prefix = "") const;
+
+	static const size_t DEFAULT_MAX_BLOCK_SIZE = 1024 * 1024;
+
+private:
+	struct Header;
+	struct BlockHeader;
+
+	SharedPool();
+
+	static SharedPool* Map(int fd, bool init, size_t size, size_t max_block_size);
+
+	Header* GetHeader() const { return reinterpret_cast<Header*>(m_base); }
+
+	BlockHeader* Pop(uint32_t cls);
+	void Push(uint32_t cls, BlockHeader* first, BlockHeader* last);
+	BlockHeader* Refill(uint32_t cls);
+
+private:
+	uint8_t* m_base;
+	size_t   m_size;
+	int      m_fd;
+
+}; // SharedPool
+
+}
+
+#endif // _MEMMGR_SHARED_POOL_H_
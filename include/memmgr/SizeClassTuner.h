@@ -0,0 +1,60 @@
+#ifndef _MEMMGR_SIZE_CLASS_TUNER_H_
+#define _MEMMGR_SIZE_CLASS_TUNER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+namespace mm
+{
+
+class BlockAllocatorPool;
+
+// Picks BlockAllocatorPool size classes for a request size histogram, such
+// as the one the pool collects with Config::collect_histogram. The table
+// can be handed to Config::block_sizes at run time, or written as source
+// and compiled in with -DMEMMGR_BLOCK_SIZES="\"path\"".
+class SizeClassTuner
+{
+public:
+	// adds 'count' requests of 'size' bytes
+	void AddRequests(size_t size, uint64_t count);
+	// adds counts[s] requests of s bytes for every s < n; for a pool's
+	// GetHistogram(), n is GetMaxBlockSize() + 1, without the last entry
+	// that counts the larger requests
+	void AddHistogram(const uint64_t* counts, size_t n);
+	// adds the requests the pool collected with Config::collect_histogram,
+	// except those above its largest class
+	void AddHistogram(const BlockAllocatorPool& pool);
+	// reads "size count" lines, '#' starts a comment
+	bool LoadHistogram(const char* filepath);
+
+	void Clear() { m_counts.clear(); }
+
+	// Fills 'sizes' with at most 'max_classes' ascending multiples of
+	// 'alignment' that minimize the bytes lost to rounding requests up to
+	// their class; the last class holds the largest request. Returns the
+	// number of classes, fewer when the histogram has fewer distinct sizes.
+	size_t Optimize(size_t max_classes, size_t alignment, uint32_t* sizes) const;
+
+	// average bytes lost per request under a table; requests above the
+	// largest class are not counted
+	double CalcExpectedWaste(const uint32_t* sizes, size_t n) const;
+
+	// one size per line
+	static bool   DumpClassTable(const char* filepath, const uint32_t* sizes, size_t n);
+	static size_t LoadClassTable(const char* filepath, uint32_t* sizes, size_t max_count);
+	// the table as the kBlockSizes definition BlockAllocatorPool.cpp
+	// includes in place of its own
+	static bool   DumpClassTableSource(const char* filepath, const uint32_t* sizes, size_t n);
+
+private:
+	// requests by size
+	std::vector<uint64_t> m_counts;
+
+}; // SizeClassTuner
+
+}
+
+#endif // _MEMMGR_SIZE_CLASS_TUNER_H_
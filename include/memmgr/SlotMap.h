@@ -0,0 +1,256 @@
+#ifndef _MEMMGR_SLOT_MAP_H_
+#define _MEMMGR_SLOT_MAP_H_
+
+#include "memmgr/BlockAllocatorPool.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace mm
+{
+
+// Objects addressed by stable 64-bit handles, stored densely. Insert,
+// erase and lookup are O(1): a handle names a slot, the slot holds the
+// generation the handle must match and where the object sits. Objects are
+// packed at the front of chunks of CHUNK_SIZE, so iterating visits only
+// live ones, in order of memory; erasing moves the last object into the
+// hole. Chunks come from a BlockAllocatorPool and never move, so pointers
+// stay valid until the object or the last one is erased.
+//
+// Not thread-safe. The chunks go back to their pool from any thread.
+template <typename T, size_t CHUNK_SIZE = 256>
+class SlotMap
+{
+	static_assert((CHUNK_SIZE & (CHUNK_SIZE - 1)) == 0, "CHUNK_SIZE must be a power of two");
+
+public:
+	struct Handle
+	{
+		uint32_t index;
+		// odd while the object lives, 0 for the null handle
+		uint32_t generation;
+
+		Handle() : index(0), generation(0) {}
+		Handle(uint32_t index, uint32_t generation) : index(index), generation(generation) {}
+
+		bool IsNull() const { return generation == 0; }
+
+		// one integer, to store or hash
+		uint64_t ToId() const { return (static_cast<uint64_t>(generation) << 32) | index; }
+		static Handle FromId(uint64_t id) { return Handle(static_cast<uint32_t>(id), static_cast<uint32_t>(id >> 32)); }
+
+		bool operator == (const Handle& h) const { return index == h.index && generation == h.generation; }
+		bool operator != (const Handle& h) const { return !(*this == h); }
+	};
+
+	template <typename Map, typename V>
+	class Iterator
+	{
+	public:
+		Iterator(Map* map, size_t pos) : m_map(map), m_pos(pos) {}
+
+		V& operator * () const { return m_map->at_dense(m_pos); }
+		V* operator -> () const { return &m_map->at_dense(m_pos); }
+		Iterator& operator ++ () { ++m_pos; return *this; }
+
+		bool operator == (const Iterator& it) const { return m_pos == it.m_pos; }
+		bool operator != (const Iterator& it) const { return m_pos != it.m_pos; }
+
+		Handle handle() const { return m_map->handle_at(m_pos); }
+
+	private:
+		Map*   m_map;
+		size_t m_pos;
+	};
+
+	typedef T value_type;
+	typedef Iterator<SlotMap, T> iterator;
+	typedef Iterator<const SlotMap, const T> const_iterator;
+
+public:
+	explicit SlotMap(BlockAllocatorPool* pool = BlockAllocatorPool::Instance())
+		: m_pool(pool), m_size(0), m_slot_count(0), m_free_slot(NO_SLOT) {}
+	SlotMap(const SlotMap&) = delete;
+	SlotMap& operator = (const SlotMap&) = delete;
+
+	~SlotMap()
+	{
+		clear();
+		for (Chunk* chunk : m_chunks) {
+			m_pool->FreeRemote(chunk, sizeof(Chunk));
+		}
+		for (Slot* slots : m_slots) {
+			m_pool->FreeRemote(slots, sizeof(Slot) * CHUNK_SIZE);
+		}
+	}
+
+	template <typename... Args>
+	Handle emplace(Args&&... args)
+	{
+		if (m_size == m_chunks.size() * CHUNK_SIZE) {
+			m_chunks.push_back(static_cast<Chunk*>(allocate(sizeof(Chunk))));
+		}
+
+		uint32_t index = m_free_slot;
+		if (index != NO_SLOT)
+		{
+			m_free_slot = slot(index).pos;
+		}
+		else
+		{
+			if (m_slot_count == m_slots.size() * CHUNK_SIZE) {
+				m_slots.push_back(static_cast<Slot*>(allocate(sizeof(Slot) * CHUNK_SIZE)));
+			}
+			index = m_slot_count++;
+			slot(index).generation = 0;
+		}
+
+		size_t pos = m_size;
+		new (&at_dense(pos)) T(std::forward<Args>(args)...);
+		owner(pos) = index;
+		++m_size;
+
+		Slot& s = slot(index);
+		s.pos = static_cast<uint32_t>(pos);
+		// even to odd
+		++s.generation;
+		return Handle(index, s.generation);
+	}
+
+	Handle insert(const T& v) { return emplace(v); }
+	Handle insert(T&& v) { return emplace(std::move(v)); }
+
+	bool erase(Handle h)
+	{
+		if (!contains(h)) {
+			return false;
+		}
+
+		Slot& s = slot(h.index);
+		size_t pos = s.pos;
+		size_t last = m_size - 1;
+		if (pos != last)
+		{
+			at_dense(pos) = std::move(at_dense(last));
+			owner(pos) = owner(last);
+			slot(owner(pos)).pos = static_cast<uint32_t>(pos);
+		}
+		at_dense(last).~T();
+		--m_size;
+
+		// odd to even, stale handles no longer match
+		++s.generation;
+		s.pos = m_free_slot;
+		m_free_slot = h.index;
+		return true;
+	}
+
+	bool contains(Handle h) const
+	{
+		return h.index < m_slot_count && slot(h.index).generation == h.generation && (h.generation & 1);
+	}
+
+	T* get(Handle h) { return contains(h) ? &at_dense(slot(h.index).pos) : nullptr; }
+	const T* get(Handle h) const { return contains(h) ? &at_dense(slot(h.index).pos) : nullptr; }
+
+	// 'h' must be live
+	T& operator [] (Handle h) { return at_dense(slot(h.index).pos); }
+	const T& operator [] (Handle h) const { return at_dense(slot(h.index).pos); }
+
+	size_t size() const { return m_size; }
+	bool empty() const { return m_size == 0; }
+
+	// erases everything, the chunks are kept
+	void clear()
+	{
+		while (m_size > 0) {
+			erase(handle_at(m_size - 1));
+		}
+	}
+
+	void reserve(size_t n)
+	{
+		while (m_chunks.size() * CHUNK_SIZE < n) {
+			m_chunks.push_back(static_cast<Chunk*>(allocate(sizeof(Chunk))));
+		}
+	}
+
+	iterator begin() { return iterator(this, 0); }
+	iterator end() { return iterator(this, m_size); }
+	const_iterator begin() const { return const_iterator(this, 0); }
+	const_iterator end() const { return const_iterator(this, m_size); }
+
+	// Calls fn(T* first, size_t count) on each run of contiguous objects,
+	// for loops the compiler can vectorize.
+	template <typename Fn>
+	void for_each_chunk(Fn fn)
+	{
+		for (size_t pos = 0; pos < m_size; pos += CHUNK_SIZE)
+		{
+			size_t count = m_size - pos < CHUNK_SIZE ? m_size - pos : CHUNK_SIZE;
+			fn(&at_dense(pos), count);
+		}
+	}
+
+	// the handle of the object at position 'pos' of the iteration order
+	Handle handle_at(size_t pos) const
+	{
+		uint32_t index = owner(pos);
+		return Handle(index, slot(index).generation);
+	}
+
+	T& at_dense(size_t pos) { return *reinterpret_cast<T*>(&m_chunks[pos / CHUNK_SIZE]->values[pos % CHUNK_SIZE]); }
+	const T& at_dense(size_t pos) const { return *reinterpret_cast<const T*>(&m_chunks[pos / CHUNK_SIZE]->values[pos % CHUNK_SIZE]); }
+
+private:
+	struct Slot
+	{
+		uint32_t generation;
+		// where the object is while live, the next free slot otherwise
+		uint32_t pos;
+	};
+
+	struct Chunk
+	{
+		typename std::aligned_storage<sizeof(T), alignof(T)>::type values[CHUNK_SIZE];
+		// the slot of each object
+		uint32_t slots[CHUNK_SIZE];
+	};
+
+	static const uint32_t NO_SLOT = 0xffffffff;
+
+	void* allocate(size_t size)
+	{
+		void* p = m_pool->Allocate(size);
+		if (!p) {
+			throw std::bad_alloc();
+		}
+		return p;
+	}
+
+	Slot& slot(uint32_t index) { return m_slots[index / CHUNK_SIZE][index % CHUNK_SIZE]; }
+	const Slot& slot(uint32_t index) const { return m_slots[index / CHUNK_SIZE][index % CHUNK_SIZE]; }
+
+	uint32_t& owner(size_t pos) { return m_chunks[pos / CHUNK_SIZE]->slots[pos % CHUNK_SIZE]; }
+	uint32_t owner(size_t pos) const { return m_chunks[pos / CHUNK_SIZE]->slots[pos % CHUNK_SIZE]; }
+
+private:
+	BlockAllocatorPool* m_pool;
+
+	std::vector<Chunk*> m_chunks;
+	std::vector<Slot*>  m_slots;
+
+	size_t   m_size;
+	uint32_t m_slot_count;
+	uint32_t m_free_slot;
+
+}; // SlotMap
+
+}
+
+#endif // _MEMMGR_SLOT_MAP_H_
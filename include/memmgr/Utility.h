@@ -11,6 +11,19 @@ class Utility
 public:
 	static const char* ToSize(size_t value, float& result);
 
+	// 'alignment' must be a power of two
+	static void* AlignedAlloc(size_t size, size_t alignment);
+	static void  AlignedFree(void* p);
+
+	// Address space without backing memory. Committed memory reads as
+	// zero; decommitted memory must be committed again before it is used.
+	static size_t GetVirtualPageSize();
+	static void*  ReserveVirtual(size_t size);
+	static bool   CommitVirtual(void* p, size_t size);
+	static void   DecommitVirtual(void* p, size_t size);
+	// gives back a whole range from ReserveVirtual()
+	static void   ReleaseVirtual(void* p, size_t size);
+
 }; // Utility
 
 }
@@ -0,0 +1,485 @@
+#include "memmgr/AllocTrace.h"
+#include "memmgr/Utility.h"
+
+#include <logger.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif // _WIN32
+
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace mm
+{
+
+static const char     kTraceMagic[4] = { 'M', 'M', 'T', 'R' };
+static const uint32_t kTraceVersion  = 1;
+
+// records per thread buffer, 64KB
+static const uint32_t kBufferRecords = 4096;
+
+// replays sample the resident set every this many operations
+static const uint64_t kRssSampleOps = 4096;
+
+struct TraceFileHeader
+{
+	char     magic[4];
+	uint32_t version;
+	// bytes of the file in use, header included
+	uint64_t size;
+};
+
+struct TraceBuffer
+{
+	uint32_t session;
+	uint32_t thread;
+	uint32_t count;
+	uint64_t base_ns;
+	uint64_t last_ns;
+
+	AllocTrace::Record records[kBufferRecords];
+};
+
+std::atomic<bool> AllocTrace::m_active(false);
+
+static std::mutex s_trace_mutex;
+
+static uint8_t* s_map = nullptr;
+static size_t   s_capacity = 0;
+#ifdef _WIN32
+static HANDLE   s_file = INVALID_HANDLE_VALUE;
+static HANDLE   s_mapping = nullptr;
+#else
+static int      s_fd = -1;
+#endif // _WIN32
+
+static std::atomic<uint32_t> s_session(0);
+static std::atomic<uint32_t> s_next_thread(0);
+// next free byte of the file, and the end of the last chunk that fit
+static std::atomic<size_t>   s_write(0);
+static std::atomic<size_t>   s_end(0);
+// threads copying a chunk into the mapping
+static std::atomic<int>      s_writers(0);
+static std::atomic<uint64_t> s_dropped(0);
+
+static uint64_t NowNs()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void FlushBuffer(TraceBuffer& buf)
+{
+	if (buf.count == 0) {
+		return;
+	}
+
+	// pairs with Stop() clearing m_active before it waits for writers
+	s_writers.fetch_add(1);
+	if (AllocTrace::IsActive() && buf.session == s_session.load())
+	{
+		size_t bytes = sizeof(AllocTrace::ChunkHeader) + buf.count * sizeof(AllocTrace::Record);
+		size_t offset = s_write.fetch_add(bytes);
+		if (offset + bytes <= s_capacity)
+		{
+			AllocTrace::ChunkHeader header;
+			header.thread  = buf.thread;
+			header.count   = buf.count;
+			header.base_ns = buf.base_ns;
+			memcpy(s_map + offset, &header, sizeof(header));
+			memcpy(s_map + offset + sizeof(header), buf.records, buf.count * sizeof(AllocTrace::Record));
+
+			size_t end = s_end.load();
+			while (offset + bytes > end && !s_end.compare_exchange_weak(end, offset + bytes)) {
+			}
+		}
+		else
+		{
+			s_dropped.fetch_add(buf.count);
+		}
+	}
+	s_writers.fetch_sub(1);
+
+	buf.count = 0;
+}
+
+// owns the calling thread's buffer and flushes it on thread exit
+struct TraceBufferHolder
+{
+	TraceBuffer* buf;
+
+	TraceBufferHolder() : buf(nullptr) {}
+	~TraceBufferHolder()
+	{
+		if (buf) {
+			FlushBuffer(*buf);
+			free(buf);
+		}
+	}
+
+	TraceBuffer* Get()
+	{
+		if (!buf)
+		{
+			buf = static_cast<TraceBuffer*>(malloc(sizeof(TraceBuffer)));
+			if (buf) {
+				buf->session = s_session.load();
+				buf->thread  = s_next_thread.fetch_add(1);
+				buf->count   = 0;
+			}
+		}
+		return buf;
+	}
+};
+
+static thread_local TraceBufferHolder t_trace_buffer;
+
+bool AllocTrace::Start(const char* filepath, size_t max_bytes)
+{
+	std::lock_guard<std::mutex> lock(s_trace_mutex);
+	if (IsActive() || max_bytes < sizeof(TraceFileHeader)) {
+		return false;
+	}
+
+#ifdef _WIN32
+	s_file = CreateFileA(filepath, GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (s_file == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+	uint64_t size = max_bytes;
+	s_mapping = CreateFileMappingA(s_file, nullptr, PAGE_READWRITE,
+		static_cast<DWORD>(size >> 32), static_cast<DWORD>(size), nullptr);
+	s_map = s_mapping ? static_cast<uint8_t*>(MapViewOfFile(s_mapping, FILE_MAP_WRITE, 0, 0, max_bytes)) : nullptr;
+	if (!s_map)
+	{
+		if (s_mapping) {
+			CloseHandle(s_mapping);
+		}
+		CloseHandle(s_file);
+		s_mapping = nullptr;
+		s_file = INVALID_HANDLE_VALUE;
+		return false;
+	}
+#else
+	s_fd = open(filepath, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (s_fd < 0) {
+		return false;
+	}
+	void* map = MAP_FAILED;
+	if (ftruncate(s_fd, max_bytes) == 0) {
+		map = mmap(nullptr, max_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, s_fd, 0);
+	}
+	if (map == MAP_FAILED)
+	{
+		close(s_fd);
+		s_fd = -1;
+		return false;
+	}
+	s_map = static_cast<uint8_t*>(map);
+#endif // _WIN32
+
+	s_capacity = max_bytes;
+	s_write.store(sizeof(TraceFileHeader));
+	s_end.store(sizeof(TraceFileHeader));
+	s_dropped.store(0);
+	// buffers left from an earlier trace are discarded on their next use
+	s_session.fetch_add(1);
+
+	m_active.store(true);
+	return true;
+}
+
+void AllocTrace::Stop()
+{
+	std::lock_guard<std::mutex> lock(s_trace_mutex);
+	if (!IsActive()) {
+		return;
+	}
+
+	Flush();
+
+	m_active.store(false);
+	while (s_writers.load() > 0) {
+		std::this_thread::yield();
+	}
+
+	TraceFileHeader header;
+	memcpy(header.magic, kTraceMagic, sizeof(header.magic));
+	header.version = kTraceVersion;
+	header.size    = s_end.load();
+	memcpy(s_map, &header, sizeof(header));
+
+#ifdef _WIN32
+	UnmapViewOfFile(s_map);
+	CloseHandle(s_mapping);
+	LARGE_INTEGER end;
+	end.QuadPart = static_cast<LONGLONG>(header.size);
+	SetFilePointerEx(s_file, end, nullptr, FILE_BEGIN);
+	SetEndOfFile(s_file);
+	CloseHandle(s_file);
+	s_mapping = nullptr;
+	s_file = INVALID_HANDLE_VALUE;
+#else
+	munmap(s_map, s_capacity);
+	if (ftruncate(s_fd, header.size) != 0) {
+		LOGW("AllocTrace: can't trim the trace file");
+	}
+	close(s_fd);
+	s_fd = -1;
+#endif // _WIN32
+
+	s_map = nullptr;
+	s_capacity = 0;
+
+	uint64_t dropped = s_dropped.load();
+	if (dropped) {
+		LOGW("AllocTrace: %llu records didn't fit the trace file", static_cast<unsigned long long>(dropped));
+	}
+}
+
+void AllocTrace::Flush()
+{
+	if (t_trace_buffer.buf) {
+		FlushBuffer(*t_trace_buffer.buf);
+	}
+}
+
+void AllocTrace::Append(Op op, Source source, const void* p, size_t size)
+{
+	TraceBuffer* buf = t_trace_buffer.Get();
+	if (!buf) {
+		return;
+	}
+
+	uint32_t session = s_session.load(std::memory_order_relaxed);
+	if (buf->session != session) {
+		buf->session = session;
+		buf->count = 0;
+	}
+
+	uint64_t now = NowNs();
+	if (buf->count > 0 && now - buf->last_ns > DELTA_MASK) {
+		FlushBuffer(*buf);
+	}
+	if (buf->count == 0) {
+		buf->base_ns = now;
+		buf->last_ns = now;
+	}
+
+	AllocTrace::Record& rec = buf->records[buf->count];
+	rec.ptr  = reinterpret_cast<uint64_t>(p);
+	rec.size = size > UINT32_MAX ? UINT32_MAX : static_cast<uint32_t>(size);
+	rec.info = (static_cast<uint32_t>(op) << 30) | (static_cast<uint32_t>(source) << 28)
+		| static_cast<uint32_t>(now - buf->last_ns);
+	buf->last_ns = now;
+
+	if (++buf->count == kBufferRecords) {
+		FlushBuffer(*buf);
+	}
+}
+
+uint64_t AllocTrace::GetDroppedCount()
+{
+	return s_dropped.load();
+}
+
+//////////////////////////////////////////////////////////////////////////
+// replay
+//////////////////////////////////////////////////////////////////////////
+
+struct ReplayEvent
+{
+	uint64_t time;
+	AllocTrace::Record rec;
+};
+
+// resident set in bytes, 0 when unknown
+static size_t GetResidentBytes()
+{
+#if defined(__linux__)
+	FILE* fp = fopen("/proc/self/statm", "r");
+	if (!fp) {
+		return 0;
+	}
+	unsigned long total = 0, resident = 0;
+	int n = fscanf(fp, "%lu %lu", &total, &resident);
+	fclose(fp);
+	return n == 2 ? resident * static_cast<size_t>(sysconf(_SC_PAGESIZE)) : 0;
+#elif defined(_WIN32)
+	// would need psapi
+	return 0;
+#else
+	return 0;
+#endif
+}
+
+static bool LoadTrace(const char* filepath, std::vector<ReplayEvent>& events)
+{
+	FILE* fp = fopen(filepath, "rb");
+	if (!fp) {
+		return false;
+	}
+
+	std::vector<uint8_t> data;
+	uint8_t tmp[65536];
+	size_t n;
+	while ((n = fread(tmp, 1, sizeof(tmp), fp)) > 0) {
+		data.insert(data.end(), tmp, tmp + n);
+	}
+	fclose(fp);
+
+	TraceFileHeader header;
+	if (data.size() < sizeof(header)) {
+		return false;
+	}
+	memcpy(&header, data.data(), sizeof(header));
+	if (memcmp(header.magic, kTraceMagic, sizeof(header.magic)) != 0 || header.version != kTraceVersion ||
+		header.size > data.size()) {
+		LOGE("AllocTrace: %s is not a trace", filepath);
+		return false;
+	}
+
+	size_t offset = sizeof(header);
+	while (offset + sizeof(AllocTrace::ChunkHeader) <= header.size)
+	{
+		AllocTrace::ChunkHeader chunk;
+		memcpy(&chunk, data.data() + offset, sizeof(chunk));
+		offset += sizeof(chunk);
+		if (offset + chunk.count * sizeof(AllocTrace::Record) > header.size) {
+			LOGE("AllocTrace: %s is truncated", filepath);
+			return false;
+		}
+
+		uint64_t time = chunk.base_ns;
+		for (uint32_t i = 0; i < chunk.count; ++i)
+		{
+			ReplayEvent ev;
+			memcpy(&ev.rec, data.data() + offset, sizeof(ev.rec));
+			offset += sizeof(ev.rec);
+			time += ev.rec.GetDelta();
+			ev.time = time;
+			events.push_back(ev);
+		}
+	}
+
+	// chunks are in flush order, a stable sort keeps each thread's order
+	std::stable_sort(events.begin(), events.end(),
+		[](const ReplayEvent& a, const ReplayEvent& b) { return a.time < b.time; });
+	return true;
+}
+
+bool AllocTrace::Replay(const char* filepath, ReplayTarget target, const BlockAllocatorPool::Config* cfg,
+	                    uint32_t source_mask, ReplayResult& result)
+{
+	std::vector<ReplayEvent> events;
+	if (!LoadTrace(filepath, events)) {
+		return false;
+	}
+
+	BlockAllocatorPool* pool = nullptr;
+	if (target == REPLAY_POOL) {
+		pool = new BlockAllocatorPool(cfg ? *cfg : BlockAllocatorPool::GetDefaultConfig());
+	}
+
+	struct LiveBlock
+	{
+		void*    p;
+		uint32_t size;
+	};
+	std::unordered_map<uint64_t, LiveBlock> live;
+	live.reserve(events.size() / 2 + 1);
+
+	memset(&result, 0, sizeof(result));
+	size_t live_bytes = 0;
+	size_t rss_base = GetResidentBytes();
+
+	auto release = [&](const LiveBlock& b) {
+		if (pool) {
+			pool->Free(b.p, b.size);
+		} else {
+			free(b.p);
+		}
+		live_bytes -= b.size;
+	};
+
+	uint64_t start = NowNs();
+	for (const ReplayEvent& ev : events)
+	{
+		if (!(source_mask & (1u << ev.rec.GetSource()))) {
+			continue;
+		}
+
+		if (ev.rec.GetOp() == OP_ALLOC)
+		{
+			void* p = pool ? pool->Allocate(ev.rec.size) : malloc(ev.rec.size);
+			if (!p) {
+				continue;
+			}
+			// the address was reused without a recorded free
+			auto itr = live.find(ev.rec.ptr);
+			if (itr != live.end()) {
+				release(itr->second);
+				live.erase(itr);
+			}
+			LiveBlock b = { p, ev.rec.size };
+			live.insert(std::make_pair(ev.rec.ptr, b));
+			live_bytes += ev.rec.size;
+			if (live_bytes > result.peak_live) {
+				result.peak_live = live_bytes;
+			}
+		}
+		else
+		{
+			auto itr = live.find(ev.rec.ptr);
+			if (itr == live.end()) {
+				continue;
+			}
+			release(itr->second);
+			live.erase(itr);
+		}
+
+		if (++result.ops % kRssSampleOps == 0)
+		{
+			size_t rss = GetResidentBytes();
+			if (rss > rss_base && rss - rss_base > result.peak_rss) {
+				result.peak_rss = rss - rss_base;
+			}
+		}
+	}
+	result.elapsed_ns = NowNs() - start;
+
+	for (auto& itr : live) {
+		release(itr.second);
+	}
+	delete pool;
+
+	if (result.peak_rss > result.peak_live) {
+		result.fragmentation = 1.0f - static_cast<float>(result.peak_live) / static_cast<float>(result.peak_rss);
+	}
+	return true;
+}
+
+void AllocTrace::DumpReplayResult(const ReplayResult& result, const char* prefix)
+{
+	float pretty_live, pretty_rss;
+	const char* suffix_live = Utility::ToSize(result.peak_live, pretty_live);
+	const char* suffix_rss  = Utility::ToSize(result.peak_rss, pretty_rss);
+	LOGI("%s%llu ops in %.3f ms, peak live %.2f%s, peak rss %.2f%s, fragmentation %.1f%%", prefix,
+		static_cast<unsigned long long>(result.ops), result.elapsed_ns / 1000000.0,
+		pretty_live, suffix_live, pretty_rss, suffix_rss, result.fragmentation * 100.0f);
+}
+
+}
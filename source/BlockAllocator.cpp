@@ -1,4 +1,7 @@
 #include "memmgr/BlockAllocator.h"
+#include "memmgr/MemoryBudget.h"
+#include "memmgr/PageRegion.h"
+#include "memmgr/Utility.h"
 
 #include <assert.h>
 #include <stdlib.h>
@@ -6,6 +9,13 @@
 
 #include <stdio.h>
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
 #ifndef ALIGN
 #define ALIGN(x, a)         (((x) + ((a) - 1)) & ~((a) - 1))
 #endif
@@ -15,17 +25,72 @@
 namespace mm
 {
 
+static inline uint32_t CountTrailingZeros(uint64_t x)
+{
+#if defined(_MSC_VER)
+    unsigned long idx;
+#if defined(_WIN64)
+    _BitScanForward64(&idx, x);
+#else
+    if (_BitScanForward(&idx, static_cast<unsigned long>(x))) {
+        return idx;
+    }
+    _BitScanForward(&idx, static_cast<unsigned long>(x >> 32));
+    idx += 32;
+#endif
+    return idx;
+#else
+    return __builtin_ctzll(x);
+#endif
+}
+
+// first non-zero word in [begin, end), or 'end'
+static inline size_t FindNonZeroWord(const uint64_t* words, size_t begin, size_t end)
+{
+    size_t i = begin;
+#if defined(__AVX2__)
+    for (; i + 4 <= end; i += 4)
+    {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(words + i));
+        if (!_mm256_testz_si256(v, v)) {
+            break;
+        }
+    }
+#endif
+    for (; i < end; ++i) {
+        if (words[i]) {
+            break;
+        }
+    }
+    return i;
+}
+
+static inline size_t BitmapWords(size_t blocks)
+{
+    return (blocks + 63) / 64;
+}
+
 BlockAllocator::BlockAllocator()
-        : m_pPageList(nullptr), m_pFreeList(nullptr),
+        : m_pCurrent(nullptr),
         m_szDataSize(0), m_szPageSize(0),
-        m_szAlignmentSize(0), m_szBlockSize(0), m_nBlocksPerPage(0)
+        m_szAlignmentSize(0), m_szBlockSize(0), m_nBlocksPerPage(0),
+        m_eMode(MODE_FREELIST), m_szBlocksOffset(0), m_nBitmapWords(0), m_nBlockRecip(0),
+        m_bColoring(false), m_nColors(1), m_nNextColor(0),
+        m_pBudget(nullptr), m_pRegion(nullptr),
+        m_nPages(0), m_nBlocks(0), m_nFreeBlocks(0), m_nPeakUsed(0),
+        m_nEmptyPages(0), m_nMaxEmptyPages(1)
 {
+    memset(m_pLists, 0, sizeof(m_pLists));
 }
 
-BlockAllocator::BlockAllocator(size_t data_size, size_t page_size, size_t alignment)
-        : m_pPageList(nullptr), m_pFreeList(nullptr)
+BlockAllocator::BlockAllocator(size_t data_size, size_t page_size, size_t alignment, Mode mode)
+        : m_pCurrent(nullptr), m_bColoring(false), m_nColors(1), m_nNextColor(0),
+        m_pBudget(nullptr), m_pRegion(nullptr),
+        m_nPages(0), m_nBlocks(0), m_nFreeBlocks(0), m_nPeakUsed(0),
+        m_nEmptyPages(0), m_nMaxEmptyPages(1)
 {
-    Reset(data_size, page_size, alignment);
+    memset(m_pLists, 0, sizeof(m_pLists));
+    Reset(data_size, page_size, alignment, mode);
 }
 
 BlockAllocator::~BlockAllocator()
@@ -33,25 +98,72 @@ BlockAllocator::~BlockAllocator()
     FreeAll();
 }
 
-void BlockAllocator::Reset(size_t data_size, size_t page_size, size_t alignment)
+void BlockAllocator::Reset(size_t data_size, size_t page_size, size_t alignment, Mode mode)
 {
     FreeAll();
 
+    // a region only serves one page size
+    m_pRegion = nullptr;
+
+    // pages are found by masking block addresses
+    assert(page_size > 0 && ((page_size & (page_size-1))) == 0);
+
     m_szDataSize = data_size;
     m_szPageSize = page_size;
 
     size_t minimal_size = (sizeof(BlockHeader) > m_szDataSize) ? sizeof(BlockHeader) : m_szDataSize;
+    m_szBlockSize = CalcBlockSize(data_size, alignment);
+
+    m_szAlignmentSize = m_szBlockSize - minimal_size;
+
+    m_eMode = mode;
+    m_nBlocksPerPage = CalcBlocksPerPage(m_szBlockSize, m_szPageSize, mode, alignment);
+    if (mode == MODE_BITMAP)
+    {
+        m_nBitmapWords   = BitmapWords(m_nBlocksPerPage);
+        m_szBlocksOffset = ALIGN(PageHeader::BITMAP_OFFSET + m_nBitmapWords * sizeof(uint64_t), alignment);
+        // exact for every offset inside the page, see BlockIndex()
+        assert(static_cast<uint64_t>(m_szPageSize) * m_szBlockSize <= (static_cast<uint64_t>(1) << 32));
+        m_nBlockRecip    = ((static_cast<uint64_t>(1) << 32) + m_szBlockSize - 1) / m_szBlockSize;
+    }
+    else
+    {
+        m_nBitmapWords   = 0;
+        m_szBlocksOffset = ALIGN(sizeof(PageHeader), alignment);
+        m_nBlockRecip    = 0;
+    }
+
+    SetColoring(m_bColoring);
+}
+
+size_t BlockAllocator::CalcBlockSize(size_t data_size, size_t alignment)
+{
+    size_t minimal_size = (sizeof(BlockHeader) > data_size) ? sizeof(BlockHeader) : data_size;
     // this magic only works when alignment is 2^n, which should general be the case
     // because most CPU/GPU also requires the aligment be in 2^n
     // but still we use a assert to guarantee it
 #if defined(_DEBUG)
     assert(alignment > 0 && ((alignment & (alignment-1))) == 0);
 #endif
-    m_szBlockSize = ALIGN(minimal_size, alignment);
+    return ALIGN(minimal_size, alignment);
+}
 
-    m_szAlignmentSize = m_szBlockSize - minimal_size;
+size_t BlockAllocator::CalcBlocksPerPage(size_t block_size, size_t page_size, Mode mode, size_t alignment)
+{
+    if (mode == MODE_FREELIST) {
+        size_t offset = ALIGN(sizeof(PageHeader), alignment);
+        return page_size > offset ? (page_size - offset) / block_size : 0;
+    }
 
-    m_nBlocksPerPage = (m_szPageSize - sizeof(PageHeader)) / m_szBlockSize;
+    // the bitmap shares the page with the blocks
+    if (page_size <= PageHeader::BITMAP_OFFSET) {
+        return 0;
+    }
+    size_t n = (page_size - PageHeader::BITMAP_OFFSET) / block_size;
+    while (n > 0 && ALIGN(PageHeader::BITMAP_OFFSET + BitmapWords(n) * sizeof(uint64_t), alignment) + n * block_size > page_size) {
+        --n;
+    }
+    return n;
 }
 
 #ifdef DUMP_INFO
@@ -62,49 +174,57 @@ static int TOT_FREE_SZ = 0;
 
 void* BlockAllocator::Allocate()
 {
-    if (!m_pFreeList)
-	{
-		assert(m_nFreeBlocks == 0);
-
-#ifdef DUMP_INFO
-		printf("mem new page sz %d, count %d free count %d   pages(8kb) %f\n", m_szBlockSize, TOT_COUNT++, TOT_FREE_COUNT, TOT_FREE_SZ / 8192.0f);
-#endif // DUMP_INFO
-
-        // allocate a new page
-        PageHeader* pNewPage = reinterpret_cast<PageHeader*>(new uint8_t[m_szPageSize]);
-        ++m_nPages;
-        m_nBlocks     += m_nBlocksPerPage;
-        m_nFreeBlocks += m_nBlocksPerPage;
-
-#ifdef DUMP_INFO
-		TOT_FREE_COUNT += m_nBlocksPerPage;
-		TOT_FREE_SZ    += m_szBlockSize * m_nBlocksPerPage;
-#endif // DUMP_INFO
+    bool fresh;
+    return AllocateBlock(fresh);
+}
 
-#if defined(_DEBUG)
-        FillFreePage(pNewPage);
-#endif
+void* BlockAllocator::AllocateZeroed()
+{
+    bool fresh;
+    BlockHeader* block = AllocateBlock(fresh);
+    if (!block) {
+        return nullptr;
+    }
 
-        if (m_pPageList) {
-            pNewPage->pNext = m_pPageList;
-        }
+    if (!fresh) {
+        memset(block, 0, m_szDataSize);
+    } else if (m_eMode == MODE_FREELIST) {
+        block->pNext = nullptr;
+    }
+    return block;
+}
 
-        m_pPageList = pNewPage;
+BlockHeader* BlockAllocator::AllocateBlock(bool& fresh)
+{
+    PageHeader* pPage = m_pCurrent;
+    if (!pPage || pPage->nUsed == m_nBlocksPerPage)
+	{
+		pPage = NextPage();
+		if (!pPage) {
+			return nullptr;
+		}
+    }
 
-        BlockHeader* pBlock = pNewPage->Blocks();
-        // link each block in the page
-        for (uint32_t i = 0; i < m_nBlocksPerPage - 1; i++) {
-            pBlock->pNext = NextBlock(pBlock);
-            pBlock = NextBlock(pBlock);
-        }
-        pBlock->pNext = nullptr;
+    BlockHeader* freeBlock;
+    if (m_eMode == MODE_FREELIST) {
+        freeBlock = pPage->pFreeList;
+        pPage->pFreeList = freeBlock->pNext;
+    } else {
+        freeBlock = TakeBitmapBlock(pPage);
+    }
+    ++pPage->nUsed;
+    --m_nFreeBlocks;
 
-        m_pFreeList = pNewPage->Blocks();
+    uint32_t offset = static_cast<uint32_t>(reinterpret_cast<uint8_t*>(freeBlock) - reinterpret_cast<uint8_t*>(pPage));
+    fresh = offset >= pPage->nFresh;
+    if (fresh) {
+        pPage->nFresh = offset + static_cast<uint32_t>(m_szBlockSize);
     }
 
-    BlockHeader* freeBlock = m_pFreeList;
-    m_pFreeList = m_pFreeList->pNext;
-    --m_nFreeBlocks;
+    uint32_t nUsed = m_nBlocks - m_nFreeBlocks;
+    if (nUsed > m_nPeakUsed) {
+        m_nPeakUsed = nUsed;
+    }
 
 #ifdef DUMP_INFO
 	TOT_FREE_COUNT--;
@@ -115,53 +235,382 @@ void* BlockAllocator::Allocate()
     FillAllocatedBlock(freeBlock);
 #endif
 
-    return reinterpret_cast<void*>(freeBlock);
+    return freeBlock;
 }
 
 void BlockAllocator::Free(void* p)
 {
     BlockHeader* block = reinterpret_cast<BlockHeader*>(p);
+    PageHeader* pPage = PageOf(p);
 
+    if (m_eMode == MODE_FREELIST)
+    {
 #if defined(_DEBUG)
-    FillFreeBlock(block);
+        FillFreeBlock(block);
 #endif
-
-    block->pNext = m_pFreeList;
-    m_pFreeList = block;
+        block->pNext = pPage->pFreeList;
+        pPage->pFreeList = block;
+    }
+    else
+    {
+        PutBitmapBlock(pPage, block);
+    }
+    uint32_t nUsed = --pPage->nUsed;
     ++m_nFreeBlocks;
 
 #ifdef DUMP_INFO
 	TOT_FREE_COUNT++;
 	TOT_FREE_SZ += m_szBlockSize;
 #endif // DUMP_INFO
+
+    if (pPage == m_pCurrent) {
+        return;
+    }
+
+    // move the page to the list matching its new fill level
+    if (nUsed == 0)
+    {
+        UnlinkPage(pPage);
+        if (m_nEmptyPages < m_nMaxEmptyPages) {
+            PushPage(pPage, LIST_EMPTY);
+        } else {
+            ReleasePage(pPage);
+        }
+    }
+    else
+    {
+        uint32_t bin = PartialBin(nUsed);
+        if (pPage->nList != bin) {
+            UnlinkPage(pPage);
+            PushPage(pPage, bin);
+        }
+    }
 }
 
 void BlockAllocator::FreeAll()
 {
-    PageHeader* pPage = m_pPageList;
-    while(pPage) {
-        PageHeader* _p = pPage;
-        pPage = pPage->pNext;
-
-        delete[] reinterpret_cast<uint8_t*>(_p);
+    if (m_pCurrent) {
+        ReleasePage(m_pCurrent);
+        m_pCurrent = nullptr;
+    }
+    for (uint32_t i = 0; i < NUM_LISTS; ++i)
+    {
+        while (PageHeader* pPage = m_pLists[i]) {
+            UnlinkPage(pPage);
+            ReleasePage(pPage);
+        }
     }
-
-    m_pPageList = nullptr;
-    m_pFreeList = nullptr;
 
     m_nPages        = 0;
     m_nBlocks       = 0;
     m_nFreeBlocks   = 0;
+    m_nPeakUsed     = 0;
+    m_nEmptyPages   = 0;
 }
 
+void BlockAllocator::Trim()
+{
+    if (m_pCurrent && m_pCurrent->nUsed == 0) {
+        ReleasePage(m_pCurrent);
+        m_pCurrent = nullptr;
+    }
+    while (PageHeader* pPage = m_pLists[LIST_EMPTY]) {
+        UnlinkPage(pPage);
+        ReleasePage(pPage);
+    }
+}
+
+void BlockAllocator::Reserve(size_t count)
+{
+    const size_t sysPage = Utility::GetVirtualPageSize();
+    while (m_nFreeBlocks < count)
+    {
+        PageHeader* pPage = AllocatePage();
+        if (!pPage) {
+            break;
+        }
+        // MODE_BITMAP only writes the header, so fault in the system pages
+        // of the blocks behind it; free blocks hold nothing, and a zero
+        // keeps a zeroed page zeroed
+        if (m_eMode == MODE_BITMAP) {
+            volatile uint8_t* pBytes = reinterpret_cast<volatile uint8_t*>(pPage);
+            for (size_t offset = ALIGN(m_szBlocksOffset, sysPage); offset < m_szPageSize; offset += sysPage) {
+                pBytes[offset] = 0;
+            }
+        }
+        PushPage(pPage, LIST_EMPTY);
+    }
+}
+
+bool BlockAllocator::IsLive(const void* p) const
+{
+    if (m_eMode != MODE_BITMAP) {
+        return false;
+    }
+
+    PageHeader* pPage = PageOf(const_cast<void*>(p));
+    size_t offset = reinterpret_cast<size_t>(p) - reinterpret_cast<size_t>(pPage);
+    if (offset < m_szBlocksOffset + pPage->nColor) {
+        return false;
+    }
+    size_t idx = BlockIndex(pPage, p);
+    if (idx >= m_nBlocksPerPage) {
+        return false;
+    }
+    return (pPage->Bitmap()[idx / 64] & (static_cast<uint64_t>(1) << (idx % 64))) == 0;
+}
+
+bool BlockAllocator::Walk(WalkCallback cb, void* ud) const
+{
+    if (m_eMode != MODE_BITMAP) {
+        return false;
+    }
+
+    if (m_pCurrent) {
+        WalkPage(m_pCurrent, cb, ud);
+    }
+    // the empty list has nothing live
+    for (uint32_t i = 0; i < NUM_LISTS; ++i)
+    {
+        if (i == LIST_EMPTY) {
+            continue;
+        }
+        for (PageHeader* pPage = m_pLists[i]; pPage; pPage = pPage->pNext) {
+            WalkPage(pPage, cb, ud);
+        }
+    }
+    return true;
+}
+
+void BlockAllocator::SetBudget(MemoryBudget* budget)
+{
+    assert(m_nPages == 0);
+    m_pBudget = budget;
+}
+
+void BlockAllocator::SetPageRegion(PageRegion* region)
+{
+    assert(m_nPages == 0);
+    assert(!region || region->GetPageSize() == m_szPageSize);
+    m_pRegion = region;
+}
+
+void BlockAllocator::SetColoring(bool enable)
+{
+    assert(m_nPages == 0);
+    m_bColoring  = enable;
+    m_nColors    = 1;
+    m_nNextColor = 0;
+    if (enable && m_nBlocksPerPage > 0)
+    {
+        size_t tail = m_szPageSize - m_szBlocksOffset - m_nBlocksPerPage * m_szBlockSize;
+        m_nColors = static_cast<uint32_t>(tail / CACHE_LINE_SIZE + 1);
+    }
+}
+
+PageHeader* BlockAllocator::NextPage()
+{
+    if (m_pCurrent) {
+        PushPage(m_pCurrent, LIST_FULL);
+        m_pCurrent = nullptr;
+    }
+
+    PageHeader* pPage = nullptr;
+    for (int bin = NUM_PARTIAL_BINS - 1; bin >= 0 && !pPage; --bin) {
+        pPage = m_pLists[bin];
+    }
+    if (!pPage) {
+        pPage = m_pLists[LIST_EMPTY];
+    }
+
+    if (pPage) {
+        UnlinkPage(pPage);
+    } else {
+        pPage = AllocatePage();
+        if (!pPage) {
+            return nullptr;
+        }
+    }
+
+    pPage->nList = LIST_CURRENT;
+    m_pCurrent = pPage;
+    return pPage;
+}
+
+PageHeader* BlockAllocator::AllocatePage()
+{
+    if (m_pBudget && !m_pBudget->Acquire(m_szPageSize)) {
+        return nullptr;
+    }
+
+#ifdef DUMP_INFO
+	printf("mem new page sz %d, count %d, free count %d   pages(8kb) %f\n", m_szBlockSize, TOT_COUNT++, TOT_FREE_COUNT, TOT_FREE_SZ / 8192.0f);
+#endif // DUMP_INFO
+
+    // allocate a new page
+    bool zeroed = false;
+    PageHeader* pNewPage = reinterpret_cast<PageHeader*>(m_pRegion ? m_pRegion->AllocatePage(&zeroed)
+                                                                    : Utility::AlignedAlloc(m_szPageSize, m_szPageSize));
+    if (!pNewPage)
+    {
+        if (m_pBudget) {
+            m_pBudget->Release(m_szPageSize);
+        }
+        return nullptr;
+    }
+    ++m_nPages;
+    m_nBlocks     += m_nBlocksPerPage;
+    m_nFreeBlocks += m_nBlocksPerPage;
+
+#ifdef DUMP_INFO
+	TOT_FREE_COUNT += m_nBlocksPerPage;
+	TOT_FREE_SZ    += m_szBlockSize * m_nBlocksPerPage;
+#endif // DUMP_INFO
+
+    pNewPage->nColor = m_nNextColor * CACHE_LINE_SIZE;
+    if (++m_nNextColor == m_nColors) {
+        m_nNextColor = 0;
+    }
+
 #if defined(_DEBUG)
-void BlockAllocator::FillFreePage(PageHeader *pPage)
+    FillFreePage(pNewPage);
+    zeroed = false;
+#endif
+
+    pNewPage->pNext = nullptr;
+    pNewPage->pPrev = nullptr;
+    pNewPage->nUsed = 0;
+    pNewPage->nList = LIST_EMPTY;
+    pNewPage->nFresh = static_cast<uint32_t>(zeroed ? m_szBlocksOffset + pNewPage->nColor : m_szPageSize);
+
+    if (m_eMode == MODE_BITMAP)
+    {
+        // every block free, the bits past the last block stay clear
+        uint64_t* pBits = pNewPage->Bitmap();
+        memset(pBits, 0xFF, m_nBitmapWords * sizeof(uint64_t));
+        size_t tail = m_nBlocksPerPage % 64;
+        if (tail) {
+            pBits[m_nBitmapWords - 1] = (static_cast<uint64_t>(1) << tail) - 1;
+        }
+        pNewPage->nHint = 0;
+        return pNewPage;
+    }
+
+    BlockHeader* pBlock = FirstBlock(pNewPage);
+    // link each block in the page
+    for (uint32_t i = 0; i < m_nBlocksPerPage - 1; i++) {
+        pBlock->pNext = NextBlock(pBlock);
+        pBlock = NextBlock(pBlock);
+    }
+    pBlock->pNext = nullptr;
+
+    pNewPage->pFreeList = FirstBlock(pNewPage);
+
+    return pNewPage;
+}
+
+void BlockAllocator::ReleasePage(PageHeader* pPage)
+{
+    --m_nPages;
+    m_nBlocks     -= m_nBlocksPerPage;
+    m_nFreeBlocks -= m_nBlocksPerPage - pPage->nUsed;
+
+    if (m_pRegion) {
+        m_pRegion->FreePage(pPage);
+    } else {
+        Utility::AlignedFree(pPage);
+    }
+
+    if (m_pBudget) {
+        m_pBudget->Release(m_szPageSize);
+    }
+}
+
+void BlockAllocator::PushPage(PageHeader* pPage, uint32_t list)
+{
+    pPage->nList = list;
+    pPage->pPrev = nullptr;
+    pPage->pNext = m_pLists[list];
+    if (pPage->pNext) {
+        pPage->pNext->pPrev = pPage;
+    }
+    m_pLists[list] = pPage;
+
+    if (list == LIST_EMPTY) {
+        ++m_nEmptyPages;
+    }
+}
+
+void BlockAllocator::UnlinkPage(PageHeader* pPage)
+{
+    if (pPage->pPrev) {
+        pPage->pPrev->pNext = pPage->pNext;
+    } else {
+        m_pLists[pPage->nList] = pPage->pNext;
+    }
+    if (pPage->pNext) {
+        pPage->pNext->pPrev = pPage->pPrev;
+    }
+
+    if (pPage->nList == LIST_EMPTY) {
+        --m_nEmptyPages;
+    }
+}
+
+BlockHeader* BlockAllocator::TakeBitmapBlock(PageHeader* pPage)
 {
-    // page header
-    pPage->pNext = nullptr;
+    uint64_t* pBits = pPage->Bitmap();
+    size_t word = FindNonZeroWord(pBits, pPage->nHint, m_nBitmapWords);
+    assert(word < m_nBitmapWords);
+
+    uint64_t bits = pBits[word];
+    uint32_t bit  = CountTrailingZeros(bits);
+    pBits[word]   = bits & (bits - 1);
+    pPage->nHint  = word;
 
+    return reinterpret_cast<BlockHeader*>(reinterpret_cast<uint8_t*>(FirstBlock(pPage)) + (word * 64 + bit) * m_szBlockSize);
+}
+
+void BlockAllocator::PutBitmapBlock(PageHeader* pPage, BlockHeader* pBlock)
+{
+    size_t idx = BlockIndex(pPage, pBlock);
+    assert(idx < m_nBlocksPerPage);
+
+    uint64_t mask = static_cast<uint64_t>(1) << (idx % 64);
+    uint64_t* pWord = pPage->Bitmap() + idx / 64;
+    // double free
+    assert((*pWord & mask) == 0);
+    *pWord |= mask;
+
+    if (idx / 64 < pPage->nHint) {
+        pPage->nHint = idx / 64;
+    }
+}
+
+void BlockAllocator::WalkPage(PageHeader* pPage, WalkCallback cb, void* ud) const
+{
+    const uint64_t* pBits = pPage->Bitmap();
+    uint8_t* pBlocks = reinterpret_cast<uint8_t*>(FirstBlock(pPage));
+    for (size_t word = 0; word < m_nBitmapWords; ++word)
+    {
+        uint64_t live = ~pBits[word];
+        if (word == m_nBitmapWords - 1 && m_nBlocksPerPage % 64) {
+            live &= (static_cast<uint64_t>(1) << (m_nBlocksPerPage % 64)) - 1;
+        }
+        while (live)
+        {
+            size_t idx = word * 64 + CountTrailingZeros(live);
+            live &= live - 1;
+            cb(pBlocks + idx * m_szBlockSize, m_szDataSize, ud);
+        }
+    }
+}
+
+#if defined(_DEBUG)
+void BlockAllocator::FillFreePage(PageHeader *pPage)
+{
     // blocks
-    BlockHeader *pBlock = pPage->Blocks();
+    BlockHeader *pBlock = FirstBlock(pPage);
     for (uint32_t i = 0; i < m_nBlocksPerPage; i++)
     {
         FillFreeBlock(pBlock);
@@ -191,7 +640,7 @@ void BlockAllocator::FillAllocatedBlock(BlockHeader *pBlock)
 
 #endif
 
-BlockHeader* BlockAllocator::NextBlock(BlockHeader *pBlock)
+BlockHeader* BlockAllocator::NextBlock(BlockHeader *pBlock) const
 {
     return reinterpret_cast<BlockHeader *>(reinterpret_cast<uint8_t*>(pBlock) + m_szBlockSize);
 }
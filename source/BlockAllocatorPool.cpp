@@ -1,19 +1,31 @@
 #include "memmgr/BlockAllocatorPool.h"
+#include "memmgr/AllocTrace.h"
+#include "memmgr/BuddyAllocator.h"
+#include "memmgr/EpochReclaimer.h"
+#include "memmgr/MemoryBudget.h"
+#include "memmgr/MemoryTags.h"
+#include "memmgr/PageRegion.h"
+#include "memmgr/Utility.h"
+
+#include <logger.h>
 
 //extern "C" void* malloc(size_t size);
 //extern "C" void  free(void* p);
+#include <stdint.h>
 #include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
 
+#include <mutex>
 #include <thread>
+#include <vector>
 
 #if defined(__MINGW32__) && !defined(_GLIBCXX_HAS_GTHREADS)
 #else
 #define CHECK_MT
 #endif // __MINGW32__
 
-#ifdef CHECK_MT
 #include <assert.h>
-#endif // CHECK_MT
 
 #ifndef ALIGN
 #define ALIGN(x, a)         (((x) + ((a) - 1)) & ~((a) - 1))
@@ -21,6 +33,10 @@
 
 namespace mm
 {
+#ifdef MEMMGR_BLOCK_SIZES
+// a table written by SizeClassTuner::DumpClassTableSource()
+#include MEMMGR_BLOCK_SIZES
+#else
 static const uint32_t kBlockSizes[] = {
     // 4-increments
     4,  8, 12, 16, 20, 24, 28, 32, 36, 40, 44, 48,
@@ -33,133 +49,1032 @@ static const uint32_t kBlockSizes[] = {
     // 64-increments
     704, 768, 832, 896, 960, 1024
 };
+#endif // MEMMGR_BLOCK_SIZES
 
 static const uint32_t kPageSize  = 8192;
 static const uint32_t kAlignment = 4;
 
+static const uint32_t kMaxPageSize     = 65536;
+static const uint32_t kMinBlocksPerPage = 8;
+static const float    kMaxWasteRatio   = 0.02f;
+
+static const size_t   kBuddyMaxSize    = 1024 * 1024;
+static const size_t   kBuddyRegionSize = 4 * 1024 * 1024;
+
 // number of elements in the block size array
 static const uint32_t kNumBlockSizes =
     sizeof(kBlockSizes) / sizeof(kBlockSizes[0]);
 
-// largest valid block size
-static const uint32_t kMaxBlockSize =
-    kBlockSizes[kNumBlockSizes - 1];
+// the largest power of two a size_t holds
+static const size_t   kMaxPowerOfTwo = ~(SIZE_MAX >> 1);
 
-thread_local size_t*             BlockAllocatorPool::m_pBlockSizeLookup;
-thread_local BlockAllocator*     BlockAllocatorPool::m_pAllocators;
-thread_local BlockAllocatorPool* BlockAllocatorPool::m_instance;
+static bool IsPowerOfTwo(size_t x)
+{
+    return x != 0 && (x & (x - 1)) == 0;
+}
 
-#ifdef CHECK_MT
-thread_local static std::thread::id THIS_ID;
-#endif // CHECK_MT
+static size_t CeilPowerOfTwo(size_t x)
+{
+    if (x > kMaxPowerOfTwo) {
+        return kMaxPowerOfTwo;
+    }
+    size_t ret = 1;
+    while (ret < x) {
+        ret *= 2;
+    }
+    return ret;
+}
+
+static BlockAllocatorPool::Config s_default_config;
+// bumped by SetDefaultConfig(), orphans built from an older config aren't
+// adopted
+static uint32_t s_default_config_generation = 0;
+
+static std::mutex                        s_orphan_mutex;
+static std::vector<BlockAllocatorPool*>  s_orphans;
+
+struct BlockAllocatorPool::ThreadInstance
+{
+	BlockAllocatorPool* pool = nullptr;
+
+	~ThreadInstance()
+	{
+		if (pool) {
+			ReleaseInstance(pool);
+			pool = nullptr;
+		}
+	}
+};
+
+thread_local BlockAllocatorPool::ThreadInstance BlockAllocatorPool::m_instance;
+
+BlockAllocatorPool::Config::Config()
+    : min_page_size(kPageSize)
+    , max_page_size(kMaxPageSize)
+    , min_blocks_per_page(kMinBlocksPerPage)
+    , max_waste_ratio(kMaxWasteRatio)
+    , select_mode(nullptr)
+    , region_size(0)
+    , block_sizes(nullptr)
+    , num_block_sizes(0)
+    , collect_histogram(false)
+    , cache_coloring(true)
+    , buddy_max_size(kBuddyMaxSize)
+    , buddy_region_size(kBuddyRegionSize)
+{
+}
 
 BlockAllocatorPool::BlockAllocatorPool()
+    : m_pBlockSizeLookup(nullptr)
+    , m_pAllocators(nullptr)
+    , m_pCacheAllocators(nullptr)
+    , m_pBlockSizes(nullptr)
+    , m_nNumBlockSizes(0)
+    , m_szMaxBlockSize(0)
+    , m_pHistogram(nullptr)
+    , m_pBuddy(nullptr)
+    , m_szLargeBytes(0)
+    , m_pRemoteFrees(nullptr)
+    , m_config(s_default_config)
+    , m_pBudget(nullptr)
+    , m_pRegions(nullptr)
+    , m_bInitialized(false)
+    , m_nConfigGeneration(s_default_config_generation)
 {
 	Initialize();
 }
 
+BlockAllocatorPool::BlockAllocatorPool(const Config& cfg)
+    : m_pBlockSizeLookup(nullptr)
+    , m_pAllocators(nullptr)
+    , m_pCacheAllocators(nullptr)
+    , m_pBlockSizes(nullptr)
+    , m_nNumBlockSizes(0)
+    , m_szMaxBlockSize(0)
+    , m_pHistogram(nullptr)
+    , m_pBuddy(nullptr)
+    , m_szLargeBytes(0)
+    , m_pRemoteFrees(nullptr)
+    , m_config(cfg)
+    , m_pBudget(nullptr)
+    , m_pRegions(nullptr)
+    , m_bInitialized(false)
+    , m_nConfigGeneration(0)
+{
+	Initialize();
+}
+
+BlockAllocatorPool::~BlockAllocatorPool()
+{
+	Finalize();
+}
+
 int BlockAllocatorPool::Initialize()
 {
     // one-time initialization
-    thread_local static bool s_bInitialized = false;
-    if (!s_bInitialized)
+    if (!m_bInitialized)
 	{
+        // CalcPageSize() walks the powers of two from min to max; release
+        // builds round a bad config to the nearest valid one
+        assert(IsPowerOfTwo(m_config.min_page_size) && IsPowerOfTwo(m_config.max_page_size)
+            && m_config.min_page_size <= m_config.max_page_size);
+        m_config.min_page_size = CeilPowerOfTwo(m_config.min_page_size);
+        m_config.max_page_size = CeilPowerOfTwo(m_config.max_page_size);
+        if (m_config.max_page_size < m_config.min_page_size) {
+            m_config.max_page_size = m_config.min_page_size;
+        }
+
+        // the class table, copied so the config needn't keep it alive
+        const uint32_t* sizes = kBlockSizes;
+        m_nNumBlockSizes = kNumBlockSizes;
+        if (m_config.block_sizes && m_config.num_block_sizes > 0) {
+            sizes = m_config.block_sizes;
+            m_nNumBlockSizes = m_config.num_block_sizes;
+        }
+        m_pBlockSizes = new uint32_t[m_nNumBlockSizes];
+        for (size_t i = 0; i < m_nNumBlockSizes; i++) {
+            assert(sizes[i] > 0 && (i == 0 || sizes[i] > sizes[i - 1]));
+            m_pBlockSizes[i] = sizes[i];
+        }
+        m_szMaxBlockSize = m_pBlockSizes[m_nNumBlockSizes - 1];
+
         // initialize block size lookup table
-        m_pBlockSizeLookup = new size_t[kMaxBlockSize + 1];
+        m_pBlockSizeLookup = new size_t[m_szMaxBlockSize + 1];
         size_t j = 0;
-        for (size_t i = 0; i <= kMaxBlockSize; i++) {
-            if (i > kBlockSizes[j]) ++j;
+        for (size_t i = 0; i <= m_szMaxBlockSize; i++) {
+            if (i > m_pBlockSizes[j]) ++j;
             m_pBlockSizeLookup[i] = j;
         }
 
         // initialize the allocators
-        m_pAllocators = new BlockAllocator[kNumBlockSizes];
-        for (size_t i = 0; i < kNumBlockSizes; i++) {
-            m_pAllocators[i].Reset(kBlockSizes[i], kPageSize, kAlignment);
+        m_pAllocators = new BlockAllocator[m_nNumBlockSizes];
+        for (size_t i = 0; i < m_nNumBlockSizes; i++) {
+            BlockAllocator::Mode mode = m_config.select_mode ? m_config.select_mode(m_pBlockSizes[i]) : BlockAllocator::MODE_FREELIST;
+            size_t block_size = BlockAllocator::CalcBlockSize(m_pBlockSizes[i], kAlignment);
+            m_pAllocators[i].Reset(m_pBlockSizes[i], CalcPageSize(m_config, block_size, mode), kAlignment, mode);
+            m_pAllocators[i].SetBudget(m_pBudget);
+            m_pAllocators[i].SetColoring(m_config.cache_coloring);
         }
 
-		THIS_ID = std::this_thread::get_id();
+        // whole cache lines, starting on a line in every page
+        const size_t kCacheLine = BlockAllocator::CACHE_LINE_SIZE;
+        size_t num_cache_classes = CACHE_ALIGNED_MAX_SIZE / kCacheLine;
+        m_pCacheAllocators = new BlockAllocator[num_cache_classes];
+        for (size_t i = 0; i < num_cache_classes; i++) {
+            size_t block_size = (i + 1) * kCacheLine;
+            size_t page_size = CalcPageSize(m_config, block_size);
+            while (BlockAllocator::CalcBlocksPerPage(block_size, page_size, BlockAllocator::MODE_FREELIST, kCacheLine) == 0) {
+                page_size *= 2;
+            }
+            m_pCacheAllocators[i].Reset(block_size, page_size, kCacheLine);
+            m_pCacheAllocators[i].SetBudget(m_pBudget);
+            m_pCacheAllocators[i].SetColoring(m_config.cache_coloring);
+        }
 
-        s_bInitialized = true;
+        if (m_config.region_size)
+        {
+            size_t* page_sizes = new size_t[m_nNumBlockSizes];
+            for (size_t i = 0; i < m_nNumBlockSizes; i++) {
+                page_sizes[i] = m_pAllocators[i].GetPageSize();
+            }
+            m_pRegions = ClassRegions::Acquire(m_nNumBlockSizes, m_config.region_size, page_sizes);
+            delete[] page_sizes;
+            if (m_pRegions) {
+                for (size_t i = 0; i < m_nNumBlockSizes; i++) {
+                    m_pAllocators[i].SetPageRegion(m_pRegions->GetRegion(i));
+                }
+            } else {
+                LOGW("BlockAllocatorPool: page layout differs from the process regions, using the heap");
+            }
+        }
+
+        if (m_config.collect_histogram) {
+            m_pHistogram = new uint64_t[m_szMaxBlockSize + 2];
+            memset(m_pHistogram, 0, sizeof(uint64_t) * (m_szMaxBlockSize + 2));
+        }
+
+        if (m_config.buddy_max_size > m_szMaxBlockSize)
+        {
+            BuddyAllocator::Config buddy_cfg;
+            while (buddy_cfg.min_block_size > m_szMaxBlockSize * 2 && buddy_cfg.min_block_size > 64) {
+                buddy_cfg.min_block_size /= 2;
+            }
+            buddy_cfg.max_block_size = m_config.buddy_max_size;
+            buddy_cfg.region_size    = m_config.buddy_region_size;
+            m_pBuddy = new BuddyAllocator(buddy_cfg);
+        }
+
+        m_pRemoteFrees = new std::atomic<RemoteBlock*>[m_nNumBlockSizes + 1];
+        for (size_t i = 0; i <= m_nNumBlockSizes; i++) {
+            m_pRemoteFrees[i].store(nullptr, std::memory_order_relaxed);
+        }
+
+		m_owner = std::this_thread::get_id();
+
+        m_bInitialized = true;
     }
 
     return 0;
 }
 
+int BlockAllocatorPool::Initialize(const Config& cfg)
+{
+    Finalize();
+    m_config = cfg;
+    return Initialize();
+}
+
 void BlockAllocatorPool::Finalize()
 {
+    // large blocks still queued go back to the system
+    DrainRemoteFrees();
+    delete[] m_pRemoteFrees;
+    m_pRemoteFrees = nullptr;
+
     delete[] m_pAllocators;
+    delete[] m_pCacheAllocators;
     delete[] m_pBlockSizeLookup;
+    delete[] m_pBlockSizes;
+    delete[] m_pHistogram;
+    delete m_pBuddy;
+
+    m_pAllocators = nullptr;
+    m_pCacheAllocators = nullptr;
+    m_pBlockSizeLookup = nullptr;
+    m_pBlockSizes = nullptr;
+    m_nNumBlockSizes = 0;
+    m_szMaxBlockSize = 0;
+    m_pHistogram = nullptr;
+    m_pBuddy = nullptr;
+    m_pRegions = nullptr;
+
+    m_bInitialized = false;
 }
 
 void BlockAllocatorPool::Tick()
 {
+    DrainRemoteFrees();
+    EpochReclaimer::Collect();
 }
 
 BlockAllocator* BlockAllocatorPool::LookUpAllocator(size_t size)
 {
     // check eligibility for lookup
-    if (size <= kMaxBlockSize)
+    if (size <= m_szMaxBlockSize)
         return m_pAllocators + m_pBlockSizeLookup[size];
     else
         return nullptr;
 }
 
+size_t BlockAllocatorPool::GetLargeCharge(size_t size) const
+{
+    if (m_pBuddy && size <= m_pBuddy->GetMaxBlockSize()) {
+        return m_pBuddy->GetBlockSize(size);
+    }
+    return size;
+}
+
+void* BlockAllocatorPool::AllocateLarge(size_t size, bool zeroed)
+{
+    const size_t charge = GetLargeCharge(size);
+    if (m_pBudget && !m_pBudget->Acquire(charge)) {
+        return nullptr;
+    }
+
+    void* p = nullptr;
+    if (m_pBuddy && size <= m_pBuddy->GetMaxBlockSize())
+    {
+        p = m_pBuddy->Allocate(size);
+        if (p && zeroed) {
+            memset(p, 0, size);
+        }
+    }
+    // calloc() knows when fresh memory is already zero
+    if (!p) {
+        p = zeroed ? calloc(1, size) : malloc(size);
+    }
+    if (!p)
+    {
+        if (m_pBudget) {
+            m_pBudget->Release(charge);
+        }
+        return nullptr;
+    }
+    m_szLargeBytes += charge;
+    return p;
+}
+
+void BlockAllocatorPool::FreeLarge(void* p, size_t size)
+{
+    if (p)
+    {
+        const size_t charge = GetLargeCharge(size);
+        m_szLargeBytes -= charge;
+        if (m_pBudget) {
+            m_pBudget->Release(charge);
+        }
+    }
+    if (m_pBuddy && size <= m_pBuddy->GetMaxBlockSize() && m_pBuddy->Owns(p)) {
+        m_pBuddy->Free(p, size);
+    } else {
+        free(p);
+    }
+}
+
+void* BlockAllocatorPool::ReallocateLarge(void* p, size_t old_size, size_t new_size)
+{
+    if (m_pBuddy && (new_size <= m_pBuddy->GetMaxBlockSize() ||
+        (old_size <= m_pBuddy->GetMaxBlockSize() && m_pBuddy->Owns(p))))
+    {
+        // stays in its buddy block while that is big enough, and costs
+        // nothing more: the whole block is charged already
+        if (old_size <= m_pBuddy->GetMaxBlockSize() && new_size <= m_pBuddy->GetMaxBlockSize() &&
+            m_pBuddy->GetBlockSize(old_size) == m_pBuddy->GetBlockSize(new_size) && m_pBuddy->Owns(p))
+        {
+            return p;
+        }
+
+        void* ret = AllocateLarge(new_size);
+        if (ret)
+        {
+            memcpy(ret, p, old_size < new_size ? old_size : new_size);
+            FreeLarge(p, old_size);
+        }
+        return ret;
+    }
+
+    // a buddy-sized block the system served was charged its buddy block
+    const size_t old_charge = GetLargeCharge(old_size);
+    if (new_size > old_charge && m_pBudget && !m_pBudget->Acquire(new_size - old_charge)) {
+        return nullptr;
+    }
+
+    void* ret = realloc(p, new_size);
+    if (!ret)
+    {
+        if (new_size > old_charge && m_pBudget) {
+            m_pBudget->Release(new_size - old_charge);
+        }
+        return nullptr;
+    }
+    if (new_size < old_charge && m_pBudget) {
+        m_pBudget->Release(old_charge - new_size);
+    }
+    m_szLargeBytes = m_szLargeBytes - old_charge + new_size;
+    return ret;
+}
+
 void* BlockAllocatorPool::Allocate(size_t size)
+{
+	return Allocate(size, MEMMGR_CURRENT_TAG);
+}
+
+void* BlockAllocatorPool::Allocate(size_t size, MemoryTag tag)
 {
 #ifdef CHECK_MT
-	assert(std::this_thread::get_id() == THIS_ID);
+	assert(std::this_thread::get_id() == m_owner);
 #endif // CHECK_MT
 
+	if (m_pHistogram) {
+		CountRequest(size);
+	}
+
 	void* ret = nullptr;
     BlockAllocator* pAlloc = LookUpAllocator(size);
 	if (pAlloc) {
 		ret = pAlloc->Allocate();
 	}
     else
-        ret = malloc(size);
+        ret = AllocateLarge(size);
 
+	if (ret) {
+		MEMMGR_TRACE_ALLOC(SOURCE_POOL, ret, size);
+		MEMMGR_TAG_ALLOC(tag, pAlloc ? pAlloc->GetDataSize() : GetLargeCharge(size));
+	}
 	return ret;
 }
 
 void* BlockAllocatorPool::Allocate(size_t size, size_t alignment)
 {
 #ifdef CHECK_MT
-	assert(std::this_thread::get_id() == THIS_ID);
+	assert(std::this_thread::get_id() == m_owner);
 #endif // CHECK_MT
 
     uint8_t* p;
     size += alignment;
+    if (m_pHistogram) {
+        CountRequest(size);
+    }
     BlockAllocator* pAlloc = LookUpAllocator(size);
     if (pAlloc)
         p = reinterpret_cast<uint8_t*>(pAlloc->Allocate());
     else
-        p = reinterpret_cast<uint8_t*>(malloc(size));
+        p = reinterpret_cast<uint8_t*>(AllocateLarge(size));
 
-    p = reinterpret_cast<uint8_t*>(ALIGN(reinterpret_cast<size_t>(p), alignment));
+    if (p) {
+        p = reinterpret_cast<uint8_t*>(ALIGN(reinterpret_cast<size_t>(p), alignment));
+        MEMMGR_TRACE_ALLOC(SOURCE_POOL, p, size);
+        MEMMGR_TAG_ALLOC(MEMMGR_CURRENT_TAG, pAlloc ? pAlloc->GetDataSize() : GetLargeCharge(size));
+    }
 
     return static_cast<void*>(p);
 }
 
 void BlockAllocatorPool::Free(void* p, size_t size)
+{
+    Free(p, size, MEMMGR_CURRENT_TAG);
+}
+
+void BlockAllocatorPool::Free(void* p, size_t size, MemoryTag tag)
 {
 #ifdef CHECK_MT
-	assert(std::this_thread::get_id() == THIS_ID);
+	assert(std::this_thread::get_id() == m_owner);
 #endif // CHECK_MT
 
+    MEMMGR_TRACE_FREE(SOURCE_POOL, p, size);
+
     BlockAllocator* pAlloc = LookUpAllocator(size);
+    if (p) {
+        MEMMGR_TAG_FREE(tag, pAlloc ? pAlloc->GetDataSize() : GetLargeCharge(size));
+    }
+    // catches a wrong size, or a block of another allocator
+    assert(!m_pRegions || ClassOf(p) == (pAlloc ? pAlloc - m_pAllocators : -1));
     if (pAlloc)
         pAlloc->Free(p);
     else
-        free(p);
+        FreeLarge(p, size);
+}
+
+void* BlockAllocatorPool::AllocateZeroed(size_t size)
+{
+#ifdef CHECK_MT
+	assert(std::this_thread::get_id() == m_owner);
+#endif // CHECK_MT
+
+	if (m_pHistogram) {
+		CountRequest(size);
+	}
+
+	void* ret;
+	BlockAllocator* pAlloc = LookUpAllocator(size);
+	if (pAlloc) {
+		ret = pAlloc->AllocateZeroed();
+	} else {
+		ret = AllocateLarge(size, true);
+	}
+
+	if (ret) {
+		MEMMGR_TRACE_ALLOC(SOURCE_POOL, ret, size);
+		MEMMGR_TAG_ALLOC(MEMMGR_CURRENT_TAG, pAlloc ? pAlloc->GetDataSize() : GetLargeCharge(size));
+	}
+	return ret;
+}
+
+void* BlockAllocatorPool::Reallocate(void* p, size_t old_size, size_t new_size)
+{
+#ifdef CHECK_MT
+	assert(std::this_thread::get_id() == m_owner);
+#endif // CHECK_MT
+
+	if (!p) {
+		return Allocate(new_size);
+	}
+
+	BlockAllocator* pOld = LookUpAllocator(old_size);
+	BlockAllocator* pNew = LookUpAllocator(new_size);
+	if (pOld == pNew)
+	{
+		void* ret = pOld ? p : ReallocateLarge(p, old_size, new_size);
+		if (ret)
+		{
+			if (m_pHistogram) {
+				CountRequest(new_size);
+			}
+			MEMMGR_TRACE_FREE(SOURCE_POOL, p, old_size);
+			MEMMGR_TRACE_ALLOC(SOURCE_POOL, ret, new_size);
+			if (!pOld)
+			{
+				MEMMGR_TAG_FREE(MEMMGR_CURRENT_TAG, GetLargeCharge(old_size));
+				MEMMGR_TAG_ALLOC(MEMMGR_CURRENT_TAG, GetLargeCharge(new_size));
+			}
+		}
+		return ret;
+	}
+
+	// across classes, or between a class and the large blocks
+	void* ret = Allocate(new_size);
+	if (ret)
+	{
+		memcpy(ret, p, old_size < new_size ? old_size : new_size);
+		Free(p, old_size);
+	}
+	return ret;
+}
+
+void* BlockAllocatorPool::AllocateCacheAligned(size_t size)
+{
+#ifdef CHECK_MT
+	assert(std::this_thread::get_id() == m_owner);
+#endif // CHECK_MT
+
+	const size_t kCacheLine = BlockAllocator::CACHE_LINE_SIZE;
+	size = ALIGN(size ? size : 1, kCacheLine);
+
+	void* ret;
+	if (size <= CACHE_ALIGNED_MAX_SIZE)
+	{
+		ret = m_pCacheAllocators[size / kCacheLine - 1].Allocate();
+	}
+	else
+	{
+		if (m_pBudget && !m_pBudget->Acquire(size)) {
+			return nullptr;
+		}
+		ret = Utility::AlignedAlloc(size, kCacheLine);
+		if (!ret) {
+			if (m_pBudget) {
+				m_pBudget->Release(size);
+			}
+			return nullptr;
+		}
+		m_szLargeBytes += size;
+	}
+
+	if (ret) {
+		MEMMGR_TRACE_ALLOC(SOURCE_POOL, ret, size);
+		MEMMGR_TAG_ALLOC(MEMMGR_CURRENT_TAG, size);
+	}
+	return ret;
+}
+
+void BlockAllocatorPool::FreeCacheAligned(void* p, size_t size)
+{
+#ifdef CHECK_MT
+	assert(std::this_thread::get_id() == m_owner);
+#endif // CHECK_MT
+
+	if (!p) {
+		return;
+	}
+
+	const size_t kCacheLine = BlockAllocator::CACHE_LINE_SIZE;
+	size = ALIGN(size ? size : 1, kCacheLine);
+	MEMMGR_TRACE_FREE(SOURCE_POOL, p, size);
+	MEMMGR_TAG_FREE(MEMMGR_CURRENT_TAG, size);
+
+	if (size <= CACHE_ALIGNED_MAX_SIZE)
+	{
+		m_pCacheAllocators[size / kCacheLine - 1].Free(p);
+	}
+	else
+	{
+		m_szLargeBytes -= size;
+		if (m_pBudget) {
+			m_pBudget->Release(size);
+		}
+		Utility::AlignedFree(p);
+	}
+}
+
+size_t BlockAllocatorPool::GetUsableSize(size_t size) const
+{
+	if (m_pAllocators && size <= m_szMaxBlockSize) {
+		return m_pAllocators[m_pBlockSizeLookup[size]].GetDataSize();
+	}
+	return size;
+}
+
+void BlockAllocatorPool::Free(void* p)
+{
+#ifdef CHECK_MT
+	assert(std::this_thread::get_id() == m_owner);
+#endif // CHECK_MT
+
+    int cls = ClassOf(p);
+    if (cls < 0)
+    {
+        LOGE("BlockAllocatorPool: free of %p, which is not a pooled block", p);
+        assert(false);
+        return;
+    }
+    MEMMGR_TRACE_FREE(SOURCE_POOL, p, m_pAllocators[cls].GetDataSize());
+    MEMMGR_TAG_FREE(MEMMGR_CURRENT_TAG, m_pAllocators[cls].GetDataSize());
+    m_pAllocators[cls].Free(p);
+}
+
+void BlockAllocatorPool::FreeRemote(void* p, size_t size)
+{
+    if (!p) {
+        return;
+    }
+    if (std::this_thread::get_id() == m_owner.load(std::memory_order_relaxed)) {
+        Free(p, size);
+        return;
+    }
+
+    // the class table doesn't change after Initialize()
+    BlockAllocator* pAlloc = LookUpAllocator(size);
+    // counted on the freeing thread, the drain doesn't count again
+    MEMMGR_TAG_FREE(MEMMGR_CURRENT_TAG, pAlloc ? pAlloc->GetDataSize() : GetLargeCharge(size));
+    std::atomic<RemoteBlock*>& head = m_pRemoteFrees[pAlloc ? pAlloc - m_pAllocators : m_nNumBlockSizes];
+
+    RemoteBlock* block = static_cast<RemoteBlock*>(p);
+    if (!pAlloc) {
+        block->size = size;
+    }
+    block->next = head.load(std::memory_order_relaxed);
+    while (!head.compare_exchange_weak(block->next, block, std::memory_order_release, std::memory_order_relaxed)) {
+    }
+}
+
+void BlockAllocatorPool::DrainRemoteFrees()
+{
+#ifdef CHECK_MT
+	assert(std::this_thread::get_id() == m_owner);
+#endif // CHECK_MT
+
+    for (size_t i = 0; m_pRemoteFrees && i <= m_nNumBlockSizes; i++)
+    {
+        if (!m_pRemoteFrees[i].load(std::memory_order_relaxed)) {
+            continue;
+        }
+        RemoteBlock* block = m_pRemoteFrees[i].exchange(nullptr, std::memory_order_acquire);
+        while (block)
+        {
+            RemoteBlock* next = block->next;
+            if (i < m_nNumBlockSizes) {
+                MEMMGR_TRACE_FREE(SOURCE_POOL, block, m_pAllocators[i].GetDataSize());
+                m_pAllocators[i].Free(block);
+            } else {
+                MEMMGR_TRACE_FREE(SOURCE_POOL, block, block->size);
+                FreeLarge(block, block->size);
+            }
+            block = next;
+        }
+    }
+}
+
+int BlockAllocatorPool::ClassOf(const void* p) const
+{
+    return m_pRegions ? m_pRegions->ClassOf(p) : -1;
+}
+
+int BlockAllocatorPool::GetClassIndex(size_t size) const
+{
+    if (size <= m_szMaxBlockSize)
+        return static_cast<int>(m_pBlockSizeLookup[size]);
+    else
+        return -1;
+}
+
+void BlockAllocatorPool::SetOwnerThread()
+{
+    m_owner = std::this_thread::get_id();
+}
+
+void BlockAllocatorPool::Trim()
+{
+#ifdef CHECK_MT
+	assert(std::this_thread::get_id() == m_owner);
+#endif // CHECK_MT
+
+    for (size_t i = 0; m_pAllocators && i < m_nNumBlockSizes; i++) {
+        m_pAllocators[i].Trim();
+    }
+    for (size_t i = 0; m_pCacheAllocators && i < CACHE_ALIGNED_MAX_SIZE / BlockAllocator::CACHE_LINE_SIZE; i++) {
+        m_pCacheAllocators[i].Trim();
+    }
+    if (m_pBuddy) {
+        m_pBuddy->Trim();
+    }
+}
+
+size_t BlockAllocatorPool::GetLiveBlockCount() const
+{
+    size_t count = 0;
+    for (size_t i = 0; m_pAllocators && i < m_nNumBlockSizes; i++) {
+        count += m_pAllocators[i].GetBlockCount() - m_pAllocators[i].GetFreeBlockCount();
+    }
+    for (size_t i = 0; m_pCacheAllocators && i < CACHE_ALIGNED_MAX_SIZE / BlockAllocator::CACHE_LINE_SIZE; i++) {
+        count += m_pCacheAllocators[i].GetBlockCount() - m_pCacheAllocators[i].GetFreeBlockCount();
+    }
+    return count;
+}
+
+void BlockAllocatorPool::WalkHeap(BlockAllocator::WalkCallback cb, void* ud) const
+{
+    for (size_t i = 0; m_pAllocators && i < m_nNumBlockSizes; i++) {
+        m_pAllocators[i].Walk(cb, ud);
+    }
+}
+
+bool BlockAllocatorPool::IsLive(const void* p, size_t size) const
+{
+    if (!m_pAllocators || size > m_szMaxBlockSize) {
+        return false;
+    }
+    return m_pAllocators[m_pBlockSizeLookup[size]].IsLive(p);
+}
+
+void BlockAllocatorPool::SetBudget(MemoryBudget* budget)
+{
+    m_pBudget = budget;
+    for (size_t i = 0; m_pAllocators && i < m_nNumBlockSizes; i++) {
+        m_pAllocators[i].SetBudget(budget);
+    }
+    for (size_t i = 0; m_pCacheAllocators && i < CACHE_ALIGNED_MAX_SIZE / BlockAllocator::CACHE_LINE_SIZE; i++) {
+        m_pCacheAllocators[i].SetBudget(budget);
+    }
+}
+
+void BlockAllocatorPool::Reserve(size_t size, size_t count)
+{
+#ifdef CHECK_MT
+	assert(std::this_thread::get_id() == m_owner);
+#endif // CHECK_MT
+
+    BlockAllocator* pAlloc = LookUpAllocator(size);
+    if (pAlloc) {
+        pAlloc->Reserve(count);
+    }
+}
+
+void BlockAllocatorPool::Prewarm(const ProfileEntry* profile, size_t count)
+{
+    for (size_t i = 0; i < count; ++i) {
+        Reserve(profile[i].size, profile[i].count);
+    }
+}
+
+bool BlockAllocatorPool::Prewarm(const char* filepath)
+{
+    FILE* fp = fopen(filepath, "r");
+    if (!fp) {
+        return false;
+    }
+
+    char line[128];
+    while (fgets(line, sizeof(line), fp))
+    {
+        unsigned int size, count;
+        if (line[0] != '#' && sscanf(line, "%u %u", &size, &count) == 2) {
+            Reserve(size, count);
+        }
+    }
+
+    fclose(fp);
+    return true;
+}
+
+size_t BlockAllocatorPool::GetProfile(ProfileEntry* profile, size_t max_count) const
+{
+    size_t n = 0;
+    for (size_t i = 0; i < m_nNumBlockSizes && n < max_count; ++i)
+    {
+        uint32_t peak = m_pAllocators ? m_pAllocators[i].GetPeakUsedCount() : 0;
+        if (peak > 0) {
+            profile[n].size  = m_pBlockSizes[i];
+            profile[n].count = peak;
+            ++n;
+        }
+    }
+    return n;
+}
+
+bool BlockAllocatorPool::DumpProfile(const char* filepath) const
+{
+    FILE* fp = fopen(filepath, "w");
+    if (!fp) {
+        return false;
+    }
+
+    ProfileEntry* profile = new ProfileEntry[m_nNumBlockSizes];
+    size_t n = GetProfile(profile, m_nNumBlockSizes);
+    fprintf(fp, "# size count\n");
+    for (size_t i = 0; i < n; ++i) {
+        fprintf(fp, "%u %u\n", profile[i].size, profile[i].count);
+    }
+    delete[] profile;
+
+    fclose(fp);
+    return true;
+}
+
+void BlockAllocatorPool::ResetHistogram()
+{
+    if (m_pHistogram) {
+        memset(m_pHistogram, 0, sizeof(uint64_t) * GetHistogramSize());
+    }
+}
+
+bool BlockAllocatorPool::DumpHistogram(const char* filepath) const
+{
+    if (!m_pHistogram) {
+        return false;
+    }
+
+    FILE* fp = fopen(filepath, "w");
+    if (!fp) {
+        return false;
+    }
+
+    fprintf(fp, "# size count\n");
+    for (size_t i = 0; i <= m_szMaxBlockSize; ++i) {
+        if (m_pHistogram[i]) {
+            fprintf(fp, "%zu %llu\n", i, static_cast<unsigned long long>(m_pHistogram[i]));
+        }
+    }
+    fprintf(fp, "# larger than %zu: %llu\n", m_szMaxBlockSize,
+        static_cast<unsigned long long>(m_pHistogram[m_szMaxBlockSize + 1]));
+
+    fclose(fp);
+    return true;
+}
+
+size_t BlockAllocatorPool::GetClassCount() const
+{
+    return m_nNumBlockSizes;
+}
+
+bool BlockAllocatorPool::GetClassInfo(size_t idx, ClassInfo& info) const
+{
+    if (!m_pAllocators || idx >= m_nNumBlockSizes) {
+        return false;
+    }
+
+    const BlockAllocator& alloc = m_pAllocators[idx];
+    info.data_size       = alloc.GetDataSize();
+    info.block_size      = alloc.GetBlockSize();
+    info.page_size       = alloc.GetPageSize();
+    info.blocks_per_page = alloc.GetBlocksPerPage();
+    info.page_waste      = info.page_size - info.blocks_per_page * info.block_size;
+    info.mode            = alloc.GetMode();
+    info.pages           = alloc.GetPageCount();
+    info.blocks          = alloc.GetBlockCount();
+    info.free_blocks     = alloc.GetFreeBlockCount();
+    info.peak_used       = alloc.GetPeakUsedCount();
+    return true;
+}
+
+void BlockAllocatorPool::DumpMemoryStats(const char* prefix) const
+{
+    size_t tot_pages = 0, tot_waste = 0, tot_free = 0;
+
+    LOGI("%s%6s %6s %7s %6s %6s %6s %6s %4s", prefix,
+        "size", "block", "page", "blocks", "waste", "waste%", "pages", "mode");
+    for (size_t i = 0; i < m_nNumBlockSizes; ++i)
+    {
+        ClassInfo info;
+        GetClassInfo(i, info);
+        LOGI("%s%6zu %6zu %7zu %6zu %6zu %5.1f%% %6u %4s", prefix,
+            info.data_size, info.block_size, info.page_size, info.blocks_per_page,
+            info.page_waste, (float)info.page_waste / (float)info.page_size * 100.0f,
+            info.pages, info.mode == BlockAllocator::MODE_BITMAP ? "bits" : "list");
+
+        tot_pages += info.page_size * info.pages;
+        tot_waste += info.page_waste * info.pages;
+        tot_free  += info.block_size * info.free_blocks;
+    }
+
+    float pretty_size;
+    const char* pretty_suffix;
+    pretty_suffix = Utility::ToSize(tot_pages, pretty_size);
+    LOGI("%sTotal pages: %.2f%s", prefix, pretty_size, pretty_suffix);
+    pretty_suffix = Utility::ToSize(tot_waste, pretty_size);
+    LOGI("%sPage waste: %.2f%s", prefix, pretty_size, pretty_suffix);
+    pretty_suffix = Utility::ToSize(tot_free, pretty_size);
+    LOGI("%sFree blocks: %.2f%s", prefix, pretty_size, pretty_suffix);
+
+    if (m_pBuddy) {
+        m_pBuddy->DumpMemoryStats(prefix);
+    }
+
+#ifdef MEMMGR_TAGS
+    // every allocator's, not only this pool's
+    MemoryTags::DumpMemoryStats(prefix);
+#endif // MEMMGR_TAGS
+}
+
+void BlockAllocatorPool::SetDefaultConfig(const Config& cfg)
+{
+    s_default_config = cfg;
+    ++s_default_config_generation;
+}
+
+const BlockAllocatorPool::Config& BlockAllocatorPool::GetDefaultConfig()
+{
+    return s_default_config;
+}
+
+size_t BlockAllocatorPool::CalcPageSize(const Config& cfg, size_t block_size, BlockAllocator::Mode mode)
+{
+    size_t best_page = 0;
+    float  best_ratio = 1.0f;
+    for (size_t page = cfg.min_page_size; page != 0 && page <= cfg.max_page_size; page *= 2)
+    {
+        size_t n = BlockAllocator::CalcBlocksPerPage(block_size, page, mode);
+        if (n == 0) {
+            continue;
+        }
+
+        float ratio = (float)(page - n * block_size) / (float)page;
+        if (n >= cfg.min_blocks_per_page && ratio <= cfg.max_waste_ratio) {
+            return page;
+        }
+        if (!best_page || ratio < best_ratio) {
+            best_page  = page;
+            best_ratio = ratio;
+        }
+    }
+
+    if (!best_page) {
+        // not even one block fits in max_page_size
+        best_page = cfg.max_page_size;
+        while (BlockAllocator::CalcBlocksPerPage(block_size, best_page, mode) == 0) {
+            best_page *= 2;
+        }
+    }
+    return best_page;
+}
+
+const uint32_t* BlockAllocatorPool::GetDefaultBlockSizes(size_t& count)
+{
+    count = kNumBlockSizes;
+    return kBlockSizes;
 }
 
 BlockAllocatorPool* BlockAllocatorPool::Instance()
 {
-	if (!m_instance) {
-		m_instance = new BlockAllocatorPool();
+	BlockAllocatorPool* pool = m_instance.pool;
+	if (pool) {
+		return pool;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(s_orphan_mutex);
+		for (size_t i = 0; i < s_orphans.size(); ++i)
+		{
+			if (s_orphans[i]->m_nConfigGeneration == s_default_config_generation) {
+				pool = s_orphans[i];
+				s_orphans.erase(s_orphans.begin() + i);
+				break;
+			}
+		}
+	}
+
+	if (pool) {
+		pool->m_owner = std::this_thread::get_id();
+		// blocks freed since the previous owner exited
+		pool->DrainRemoteFrees();
+	} else {
+		pool = new BlockAllocatorPool();
+	}
+	m_instance.pool = pool;
+	return pool;
+}
+
+void BlockAllocatorPool::ReleaseInstance(BlockAllocatorPool* pool)
+{
+	pool->DrainRemoteFrees();
+	pool->Trim();
+	// large blocks count too, one could still come back through FreeRemote()
+	if (pool->GetLiveBlockCount() == 0 && pool->m_szLargeBytes == 0) {
+		delete pool;
+		return;
 	}
-	return m_instance;
+
+	std::lock_guard<std::mutex> lock(s_orphan_mutex);
+	pool->m_owner = std::thread::id();
+	s_orphans.push_back(pool);
+}
+
+size_t BlockAllocatorPool::ReclaimOrphans()
+{
+	std::lock_guard<std::mutex> lock(s_orphan_mutex);
+	size_t i = 0;
+	while (i < s_orphans.size())
+	{
+		// the lock stands in for the owner thread
+		BlockAllocatorPool* pool = s_orphans[i];
+		pool->m_owner = std::this_thread::get_id();
+		pool->DrainRemoteFrees();
+		pool->Trim();
+
+		if (pool->GetLiveBlockCount() == 0 && pool->m_szLargeBytes == 0) {
+			delete pool;
+			s_orphans.erase(s_orphans.begin() + i);
+		} else {
+			pool->m_owner = std::thread::id();
+			++i;
+		}
+	}
+	return s_orphans.size();
+}
+
+size_t BlockAllocatorPool::GetOrphanCount()
+{
+	std::lock_guard<std::mutex> lock(s_orphan_mutex);
+	return s_orphans.size();
 }
 
 }
@@ -0,0 +1,363 @@
+#include "memmgr/BuddyAllocator.h"
+#include "memmgr/Utility.h"
+
+#include <logger.h>
+
+#include <assert.h>
+#include <string.h>
+
+#include <algorithm>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace mm
+{
+
+static inline uint32_t CountTrailingZeros(uint32_t x)
+{
+#if defined(_MSC_VER)
+	unsigned long idx;
+	_BitScanForward(&idx, x);
+	return idx;
+#else
+	return __builtin_ctz(x);
+#endif
+}
+
+static inline uint32_t Log2(size_t x)
+{
+	uint32_t n = 0;
+	while ((static_cast<size_t>(1) << n) < x) {
+		++n;
+	}
+	return n;
+}
+
+struct BuddyAllocator::Region
+{
+	uint8_t*  base;
+	// bytes of allocated blocks
+	size_t    live;
+	// a bit per block of every order, set while the block is free
+	uint64_t* bits;
+};
+
+struct BuddyAllocator::FreeBlock
+{
+	FreeBlock* prev;
+	FreeBlock* next;
+	Region*    region;
+};
+
+BuddyAllocator::Config::Config()
+	: min_block_size(1024)
+	, max_block_size(1024 * 1024)
+	, region_size(4 * 1024 * 1024)
+{
+}
+
+BuddyAllocator::BuddyAllocator()
+	: BuddyAllocator(Config())
+{
+}
+
+BuddyAllocator::BuddyAllocator(const Config& cfg)
+	: m_config(cfg)
+	, m_nonempty(0)
+	, m_bitmap_words(0)
+	, m_empty_regions(0)
+	, m_live_bytes(0)
+	, m_live_blocks(0)
+{
+	assert(sizeof(FreeBlock) <= m_config.min_block_size);
+	assert(m_config.min_block_size <= m_config.max_block_size && m_config.max_block_size <= m_config.region_size);
+
+	m_min_order    = Log2(m_config.min_block_size);
+	m_max_order    = Log2(m_config.max_block_size);
+	m_region_order = Log2(m_config.region_size);
+	assert(m_region_order < 32);
+
+	memset(m_free, 0, sizeof(m_free));
+	memset(m_bitmap_offsets, 0, sizeof(m_bitmap_offsets));
+	for (uint32_t order = m_min_order; order <= m_region_order; ++order)
+	{
+		m_bitmap_offsets[order] = m_bitmap_words;
+		size_t blocks = static_cast<size_t>(1) << (m_region_order - order);
+		m_bitmap_words += (blocks + 63) / 64;
+	}
+}
+
+BuddyAllocator::~BuddyAllocator()
+{
+	if (m_live_blocks > 0) {
+		LOGW("BuddyAllocator: %zu blocks still live", m_live_blocks);
+	}
+	for (Region* region : m_regions)
+	{
+		Utility::ReleaseVirtual(region->base, m_config.region_size);
+		delete[] region->bits;
+		delete region;
+	}
+}
+
+uint32_t BuddyAllocator::OrderOf(size_t size) const
+{
+	uint32_t order = m_min_order;
+	while ((static_cast<size_t>(1) << order) < size) {
+		++order;
+	}
+	return order;
+}
+
+size_t BuddyAllocator::GetBlockSize(size_t size) const
+{
+	return static_cast<size_t>(1) << OrderOf(size);
+}
+
+void* BuddyAllocator::Allocate(size_t size)
+{
+	if (size > m_config.max_block_size) {
+		return nullptr;
+	}
+	uint32_t order = OrderOf(size);
+
+	// the smallest order with a free block that fits
+	uint32_t avail = m_nonempty & ~((1u << order) - 1);
+	if (!avail)
+	{
+		if (!NewRegion()) {
+			return nullptr;
+		}
+		avail = m_nonempty & ~((1u << order) - 1);
+	}
+	uint32_t k = CountTrailingZeros(avail);
+
+	FreeBlock* block = Pop(k);
+	Region* region = block->region;
+	if (k == m_region_order) {
+		--m_empty_regions;
+	}
+
+	// the upper halves go back down the orders
+	uint8_t* p = reinterpret_cast<uint8_t*>(block);
+	while (k > order)
+	{
+		--k;
+		Push(region, p + (static_cast<size_t>(1) << k), k);
+	}
+
+	size_t block_size = static_cast<size_t>(1) << order;
+	region->live += block_size;
+	m_live_bytes += block_size;
+	++m_live_blocks;
+	return p;
+}
+
+void BuddyAllocator::Free(void* p, size_t size)
+{
+	if (!p) {
+		return;
+	}
+	Region* region = FindRegion(p);
+	assert(region && size <= m_config.max_block_size);
+
+	uint32_t order = OrderOf(size);
+	size_t block_size = static_cast<size_t>(1) << order;
+	size_t offset = static_cast<size_t>(static_cast<uint8_t*>(p) - region->base) & ~(block_size - 1);
+	assert(!TestBit(region, order, offset));
+
+	region->live -= block_size;
+	m_live_bytes -= block_size;
+	--m_live_blocks;
+
+	// merges while the buddy is free as a whole
+	while (order < m_region_order)
+	{
+		size_t buddy = offset ^ (static_cast<size_t>(1) << order);
+		if (!TestBit(region, order, buddy)) {
+			break;
+		}
+		Remove(reinterpret_cast<FreeBlock*>(region->base + buddy), order);
+		offset &= ~(static_cast<size_t>(1) << order);
+		++order;
+	}
+
+	if (order == m_region_order && m_empty_regions > 0)
+	{
+		// one whole region is kept already
+		ReleaseRegion(region);
+		return;
+	}
+	if (order == m_region_order) {
+		++m_empty_regions;
+	}
+	Push(region, region->base + offset, order);
+}
+
+void BuddyAllocator::Trim()
+{
+	size_t i = 0;
+	while (m_empty_regions > 0 && i < m_regions.size())
+	{
+		Region* region = m_regions[i];
+		if (region->live > 0)
+		{
+			++i;
+			continue;
+		}
+		Remove(reinterpret_cast<FreeBlock*>(region->base), m_region_order);
+		--m_empty_regions;
+		ReleaseRegion(region);
+	}
+}
+
+BuddyAllocator::Region* BuddyAllocator::NewRegion()
+{
+	void* base = Utility::ReserveVirtual(m_config.region_size);
+	if (!base) {
+		return nullptr;
+	}
+	if (!Utility::CommitVirtual(base, m_config.region_size))
+	{
+		Utility::ReleaseVirtual(base, m_config.region_size);
+		return nullptr;
+	}
+
+	Region* region = new Region;
+	region->base = static_cast<uint8_t*>(base);
+	region->live = 0;
+	region->bits = new uint64_t[m_bitmap_words];
+	memset(region->bits, 0, sizeof(uint64_t) * m_bitmap_words);
+
+	m_regions.insert(std::upper_bound(m_regions.begin(), m_regions.end(), region,
+		[](const Region* a, const Region* b) { return a->base < b->base; }), region);
+
+	Push(region, region->base, m_region_order);
+	++m_empty_regions;
+	return region;
+}
+
+void BuddyAllocator::ReleaseRegion(Region* region)
+{
+	m_regions.erase(std::find(m_regions.begin(), m_regions.end(), region));
+	Utility::ReleaseVirtual(region->base, m_config.region_size);
+	delete[] region->bits;
+	delete region;
+}
+
+BuddyAllocator::Region* BuddyAllocator::FindRegion(const void* p) const
+{
+	const uint8_t* ptr = static_cast<const uint8_t*>(p);
+	std::vector<Region*>::const_iterator itr = std::upper_bound(m_regions.begin(), m_regions.end(), ptr,
+		[](const uint8_t* ptr, const Region* region) { return ptr < region->base; });
+	if (itr == m_regions.begin()) {
+		return nullptr;
+	}
+	Region* region = *(itr - 1);
+	return ptr < region->base + m_config.region_size ? region : nullptr;
+}
+
+void BuddyAllocator::Push(Region* region, uint8_t* p, uint32_t order)
+{
+	FreeBlock* block = reinterpret_cast<FreeBlock*>(p);
+	block->prev   = nullptr;
+	block->next   = m_free[order];
+	block->region = region;
+	if (block->next) {
+		block->next->prev = block;
+	}
+	m_free[order] = block;
+	m_nonempty |= 1u << order;
+	SetBit(region, order, static_cast<size_t>(p - region->base), true);
+}
+
+void BuddyAllocator::Remove(FreeBlock* block, uint32_t order)
+{
+	if (block->prev) {
+		block->prev->next = block->next;
+	} else {
+		m_free[order] = block->next;
+	}
+	if (block->next) {
+		block->next->prev = block->prev;
+	}
+	if (!m_free[order]) {
+		m_nonempty &= ~(1u << order);
+	}
+
+	Region* region = block->region;
+	SetBit(region, order, static_cast<size_t>(reinterpret_cast<uint8_t*>(block) - region->base), false);
+}
+
+BuddyAllocator::FreeBlock* BuddyAllocator::Pop(uint32_t order)
+{
+	FreeBlock* block = m_free[order];
+	assert(block);
+	Remove(block, order);
+	return block;
+}
+
+bool BuddyAllocator::TestBit(const Region* region, uint32_t order, size_t offset) const
+{
+	size_t idx = offset >> order;
+	return (region->bits[m_bitmap_offsets[order] + idx / 64] >> (idx % 64)) & 1;
+}
+
+void BuddyAllocator::SetBit(Region* region, uint32_t order, size_t offset, bool free)
+{
+	size_t idx = offset >> order;
+	uint64_t& word = region->bits[m_bitmap_offsets[order] + idx / 64];
+	uint64_t mask = static_cast<uint64_t>(1) << (idx % 64);
+	if (free) {
+		word |= mask;
+	} else {
+		word &= ~mask;
+	}
+}
+
+BuddyAllocator::Stats BuddyAllocator::GetStats() const
+{
+	Stats stats;
+	stats.regions      = m_regions.size();
+	stats.region_bytes = m_regions.size() * m_config.region_size;
+	stats.live_bytes   = m_live_bytes;
+	stats.live_blocks  = m_live_blocks;
+	stats.free_bytes   = stats.region_bytes - m_live_bytes;
+	stats.largest_free = 0;
+	for (uint32_t order = m_max_order + 1; order-- > m_min_order; )
+	{
+		if (m_nonempty & ~((1u << order) - 1))
+		{
+			stats.largest_free = static_cast<size_t>(1) << order;
+			break;
+		}
+	}
+	return stats;
+}
+
+void BuddyAllocator::DumpMemoryStats(const char* prefix) const
+{
+	Stats stats = GetStats();
+
+	LOGI("%s  block   free", prefix);
+	for (uint32_t order = m_min_order; order <= m_region_order; ++order)
+	{
+		size_t count = 0;
+		for (const FreeBlock* block = m_free[order]; block; block = block->next) {
+			++count;
+		}
+		if (count) {
+			LOGI("%s%7zu %6zu", prefix, static_cast<size_t>(1) << order, count);
+		}
+	}
+
+	float pretty_regions, pretty_live;
+	const char* regions_suffix = Utility::ToSize(stats.region_bytes, pretty_regions);
+	const char* live_suffix    = Utility::ToSize(stats.live_bytes, pretty_live);
+	LOGI("%sBuddy regions %zu, %.2f%s, live %.2f%s in %zu blocks", prefix, stats.regions,
+		pretty_regions, regions_suffix, pretty_live, live_suffix, stats.live_blocks);
+}
+
+}
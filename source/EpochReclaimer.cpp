@@ -0,0 +1,255 @@
+#include "memmgr/EpochReclaimer.h"
+#include "memmgr/BlockAllocatorPool.h"
+
+#include <assert.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace mm
+{
+
+namespace
+{
+
+struct Retired
+{
+	BlockAllocatorPool* pool;
+	void*    p;
+	size_t   size;
+	EpochReclaimer::Destructor dtor;
+	uint64_t epoch;
+};
+
+// One per thread that ever entered a Guard or retired a block, reused
+// after the thread exits. Records are never unlinked, so the epoch scan
+// needs no lock.
+struct ThreadRecord
+{
+	// (epoch << 1) | 1 while inside a Guard, 0 outside
+	std::atomic<uint64_t> state;
+	std::atomic<bool>     in_use;
+	ThreadRecord*         next;
+};
+
+}
+
+static std::atomic<uint64_t>      s_epoch(1);
+static std::atomic<ThreadRecord*> s_records(nullptr);
+
+// retired blocks of exited threads
+static std::mutex           s_orphan_mutex;
+static std::vector<Retired> s_orphans;
+
+static std::mutex              s_background_mutex;
+static std::condition_variable s_background_cv;
+static std::thread             s_background;
+static bool                    s_background_stop = false;
+
+static ThreadRecord* AcquireRecord()
+{
+	for (ThreadRecord* rec = s_records.load(std::memory_order_acquire); rec; rec = rec->next)
+	{
+		bool expected = false;
+		if (!rec->in_use.load(std::memory_order_relaxed) &&
+			rec->in_use.compare_exchange_strong(expected, true)) {
+			return rec;
+		}
+	}
+
+	ThreadRecord* rec = new ThreadRecord();
+	rec->state.store(0);
+	rec->in_use.store(true);
+	rec->next = s_records.load(std::memory_order_relaxed);
+	while (!s_records.compare_exchange_weak(rec->next, rec, std::memory_order_release, std::memory_order_relaxed)) {
+	}
+	return rec;
+}
+
+static void Reclaim(const Retired& r)
+{
+	if (r.dtor) {
+		r.dtor(r.p);
+	}
+	r.pool->FreeRemote(r.p, r.size);
+}
+
+// frees the leading entries retired at least two epochs ago; entries are
+// in retire order, so their epochs never decrease
+static void ReclaimList(std::vector<Retired>& list, uint64_t epoch)
+{
+	size_t n = 0;
+	while (n < list.size() && list[n].epoch + 2 <= epoch) {
+		Reclaim(list[n]);
+		++n;
+	}
+	if (n > 0) {
+		list.erase(list.begin(), list.begin() + n);
+	}
+}
+
+static void ReclaimOrphans(uint64_t epoch)
+{
+	std::lock_guard<std::mutex> lock(s_orphan_mutex);
+	if (!s_orphans.empty()) {
+		ReclaimList(s_orphans, epoch);
+	}
+}
+
+struct ThreadState
+{
+	ThreadRecord* record;
+	uint32_t      depth;
+	size_t        since_collect;
+	std::vector<Retired> retired;
+
+	ThreadState() : record(nullptr), depth(0), since_collect(0) {}
+	~ThreadState()
+	{
+		if (!retired.empty())
+		{
+			std::lock_guard<std::mutex> lock(s_orphan_mutex);
+			s_orphans.insert(s_orphans.end(), retired.begin(), retired.end());
+		}
+		if (record)
+		{
+			record->state.store(0, std::memory_order_release);
+			record->in_use.store(false, std::memory_order_release);
+		}
+	}
+
+	ThreadRecord* Record()
+	{
+		if (!record) {
+			record = AcquireRecord();
+		}
+		return record;
+	}
+};
+
+static thread_local ThreadState t_state;
+
+void EpochReclaimer::Enter()
+{
+	ThreadState& ts = t_state;
+	if (ts.depth++ == 0)
+	{
+		ThreadRecord* rec = ts.Record();
+		rec->state.store((s_epoch.load(std::memory_order_relaxed) << 1) | 1, std::memory_order_relaxed);
+		// the announcement must be visible before any shared pointer is read
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+	}
+}
+
+void EpochReclaimer::Leave()
+{
+	ThreadState& ts = t_state;
+	assert(ts.depth > 0);
+	if (--ts.depth == 0) {
+		ts.record->state.store(0, std::memory_order_release);
+	}
+}
+
+void EpochReclaimer::Retire(BlockAllocatorPool* pool, void* p, size_t size, Destructor dtor)
+{
+	if (!p) {
+		return;
+	}
+	assert(pool);
+
+	ThreadState& ts = t_state;
+	Retired r;
+	r.pool  = pool;
+	r.p     = p;
+	r.size  = size;
+	r.dtor  = dtor;
+	r.epoch = s_epoch.load(std::memory_order_acquire);
+	ts.retired.push_back(r);
+
+	if (++ts.since_collect >= RETIRE_BATCH) {
+		Collect();
+	}
+}
+
+bool EpochReclaimer::TryAdvance()
+{
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+
+	uint64_t epoch = s_epoch.load(std::memory_order_relaxed);
+	for (ThreadRecord* rec = s_records.load(std::memory_order_acquire); rec; rec = rec->next)
+	{
+		uint64_t state = rec->state.load(std::memory_order_relaxed);
+		if ((state & 1) && (state >> 1) != epoch) {
+			return false;
+		}
+	}
+
+	std::atomic_thread_fence(std::memory_order_acquire);
+	return s_epoch.compare_exchange_strong(epoch, epoch + 1);
+}
+
+void EpochReclaimer::Collect()
+{
+	ThreadState& ts = t_state;
+	ts.since_collect = 0;
+
+	TryAdvance();
+	uint64_t epoch = s_epoch.load(std::memory_order_acquire);
+	if (!ts.retired.empty()) {
+		ReclaimList(ts.retired, epoch);
+	}
+	ReclaimOrphans(epoch);
+}
+
+bool EpochReclaimer::StartBackground(uint32_t interval_ms)
+{
+	std::lock_guard<std::mutex> lock(s_background_mutex);
+	if (s_background.joinable()) {
+		return false;
+	}
+
+	s_background_stop = false;
+	s_background = std::thread([interval_ms]()
+	{
+		std::unique_lock<std::mutex> lock(s_background_mutex);
+		while (!s_background_stop)
+		{
+			s_background_cv.wait_for(lock, std::chrono::milliseconds(interval_ms));
+			if (!s_background_stop)
+			{
+				TryAdvance();
+				ReclaimOrphans(s_epoch.load(std::memory_order_acquire));
+			}
+		}
+	});
+	return true;
+}
+
+void EpochReclaimer::StopBackground()
+{
+	std::thread background;
+	{
+		std::lock_guard<std::mutex> lock(s_background_mutex);
+		s_background_stop = true;
+		background.swap(s_background);
+	}
+	s_background_cv.notify_all();
+	if (background.joinable()) {
+		background.join();
+	}
+}
+
+uint64_t EpochReclaimer::GetEpoch()
+{
+	return s_epoch.load(std::memory_order_acquire);
+}
+
+size_t EpochReclaimer::GetPendingCount()
+{
+	return t_state.retired.size();
+}
+
+}
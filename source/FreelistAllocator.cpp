@@ -1,8 +1,12 @@
 #include "memmgr/FreelistAllocator.h"
+#include "memmgr/AllocTrace.h"
+#include "memmgr/MemoryBudget.h"
+#include "memmgr/MemoryTags.h"
 #include "memmgr/Utility.h"
 
 #include <logger.h>
 
+#include <atomic>
 #include <cstdint>
 
 #include <assert.h>
@@ -21,36 +25,31 @@ class FreelistAllocator::Page
 public:
 	Page()
 		: m_block_sz(0)
-		, m_header(nullptr)
 		, m_freelist(nullptr)
+		, m_remote(nullptr)
 	{}
 	Page(const Page&) = delete;
 	Page& operator = (const Page&) = delete;
-	~Page() { FreeAll(); }
+	~Page() { FreeAll(nullptr); }
 
 	void Reset(size_t block_sz)
 	{
 		if (m_block_sz != block_sz) {
-			FreeAll();
+			FreeAll(nullptr);
 			m_block_sz = block_sz;
 		}
 	}
 
 	void* Allocate(FreelistAllocator& alloc)
 	{
+		if (!m_freelist && m_remote.load(std::memory_order_relaxed)) {
+			DrainRemote(alloc);
+		}
 		if (!m_freelist)
 		{
-			size_t sz = m_block_sz + sizeof(Block);
-			Block* new_block = reinterpret_cast<Block*>(new uint8_t[sz]);
-			if (!new_block) {
+			if (!NewBlock(alloc)) {
 				return nullptr;
 			}
-			new_block->next = nullptr;
-			new_block->data = reinterpret_cast<void*>(new_block + 1);
-			m_freelist = new_block;
-
-			alloc.m_tot_allocated += sz;
-			alloc.m_page_count++;
 		}
 		else
 		{
@@ -61,6 +60,21 @@ public:
 		return free->data;
 	}
 
+	void Reserve(size_t n, FreelistAllocator& alloc)
+	{
+		size_t count = 0;
+		for (Block* b = m_freelist; b && count < n; b = b->next) {
+			++count;
+		}
+		for ( ; count < n; ++count)
+		{
+			if (!NewBlock(alloc)) {
+				break;
+			}
+			alloc.m_wasted_space += (m_block_sz + sizeof(Block));
+		}
+	}
+
 	void Free(void* p, FreelistAllocator& alloc)
 	{
 		if (!p) {
@@ -72,24 +86,78 @@ public:
 		alloc.m_wasted_space += (m_block_sz + sizeof(Block));
 	}
 
-	static const int HEADER_SIZE = 16;
+	// called on any thread but the owner's
+	void FreeRemote(void* p)
+	{
+		if (!p) {
+			return;
+		}
+		Block* block = reinterpret_cast<Block*>(reinterpret_cast<uint8_t*>(p) - sizeof(Block));
+		Block* head = m_remote.load(std::memory_order_relaxed);
+		do {
+			block->next = head;
+		} while (!m_remote.compare_exchange_weak(head, block, std::memory_order_release, std::memory_order_relaxed));
+	}
 
-private:
-	void FreeAll()
+	// moves the blocks freed on other threads to the free list
+	void DrainRemote(FreelistAllocator& alloc)
 	{
-		Block* block = m_header;
+		Block* block = m_remote.exchange(nullptr, std::memory_order_acquire);
+		while (block) {
+			Block* next = block->next;
+			block->next = m_freelist;
+			m_freelist = block;
+			alloc.m_wasted_space += (m_block_sz + sizeof(Block));
+			block = next;
+		}
+	}
+
+	// blocks still handed out at this point are leaked
+	void FreeAll(MemoryBudget* budget)
+	{
+		Block* block = m_remote.exchange(nullptr, std::memory_order_acquire);
+		while (block) {
+			Block* next = block->next;
+			block->next = m_freelist;
+			m_freelist = block;
+			block = next;
+		}
+
+		block = m_freelist;
 		while (block) {
 			Block* b = block;
 			block = block->next;
 			delete[] reinterpret_cast<uint8_t*>(b);
+			if (budget) {
+				budget->Release(m_block_sz + sizeof(Block));
+			}
 		}
 
 		m_block_sz = 0;
 
-		m_header = nullptr;
 		m_freelist = nullptr;
 	}
 
+	static const int HEADER_SIZE = 16;
+
+private:
+	// pushes a fresh block to the free list
+	bool NewBlock(FreelistAllocator& alloc)
+	{
+		size_t sz = m_block_sz + sizeof(Block);
+		if (alloc.m_budget && !alloc.m_budget->Acquire(sz)) {
+			return false;
+		}
+		Block* new_block = reinterpret_cast<Block*>(new uint8_t[sz]);
+		new_block->next = m_freelist;
+		new_block->data = reinterpret_cast<void*>(new_block + 1);
+		m_freelist = new_block;
+
+		alloc.m_tot_allocated += sz;
+		alloc.m_page_count++;
+		return true;
+	}
+
 private:
 	struct Block
 	{
@@ -100,14 +168,17 @@ private:
 private:
 	size_t m_block_sz;
 
-	Block* m_header;
 	Block* m_freelist;
+	// freed on other threads, taken over by the owner
+	std::atomic<Block*> m_remote;
 
 }; // Page
 
 FreelistAllocator::FreelistAllocator(size_t min_page_sz, size_t max_page_sz)
 	: m_min_page_sz(min_page_sz)
 	, m_max_page_sz(max_page_sz)
+	, m_budget(nullptr)
+	, m_owner(std::this_thread::get_id())
 	, m_tot_allocated(0)
 	, m_wasted_space(0)
 	, m_page_count(0)
@@ -123,20 +194,60 @@ FreelistAllocator::FreelistAllocator(size_t min_page_sz, size_t max_page_sz)
 
 FreelistAllocator::~FreelistAllocator()
 {
-	delete m_pages;
+	for (int i = 0, n = m_max_page_sz - m_min_page_sz + 1; i < n; ++i) {
+		m_pages[i].FreeAll(m_budget);
+	}
+	delete[] m_pages;
+}
+
+void FreelistAllocator::SetBudget(MemoryBudget* budget)
+{
+	assert(m_page_count == 0);
+	m_budget = budget;
 }
 
 void* FreelistAllocator::Allocate(size_t size)
+{
+	return Allocate(size, MEMMGR_CURRENT_TAG);
+}
+
+void* FreelistAllocator::Allocate(size_t size, MemoryTag tag)
 {
 	int idx = QueryPageIdx(size);
-	return idx < 0 ? nullptr : m_pages[idx].Allocate(*this);
+	void* ret = idx < 0 ? nullptr : m_pages[idx].Allocate(*this);
+	if (ret) {
+		MEMMGR_TRACE_ALLOC(SOURCE_FREELIST, ret, size);
+		MEMMGR_TAG_ALLOC(tag, size);
+	}
+	return ret;
 }
 
 void FreelistAllocator::Free(void* p, size_t size)
 {
+	Free(p, size, MEMMGR_CURRENT_TAG);
+}
+
+void FreelistAllocator::Free(void* p, size_t size, MemoryTag tag)
+{
+	MEMMGR_TRACE_FREE(SOURCE_FREELIST, p, size);
+
 	int idx = QueryPageIdx(size);
-	if (idx >= 0) {
+	if (idx < 0 || !p) {
+		return;
+	}
+	MEMMGR_TAG_FREE(tag, size);
+	if (std::this_thread::get_id() == m_owner) {
 		m_pages[idx].Free(p, *this);
+	} else {
+		m_pages[idx].FreeRemote(p);
+	}
+}
+
+void FreelistAllocator::Reserve(size_t size, size_t n)
+{
+	int idx = QueryPageIdx(size);
+	if (idx >= 0) {
+		m_pages[idx].Reserve(n, *this);
 	}
 }
 
@@ -0,0 +1,447 @@
+#include "memmgr/HandleAllocator.h"
+#include "memmgr/MemoryBudget.h"
+#include "memmgr/Utility.h"
+
+#include <logger.h>
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+
+#ifndef ALIGN
+#define ALIGN(x, a)         (((x) + ((a) - 1)) & ~((a) - 1))
+#endif
+
+namespace mm
+{
+
+static const uint32_t kNoEntry   = 0xffffffff;
+// the index of a block that was freed or moved out
+static const uint32_t kFreeBlock = 0xffffffff;
+static const size_t   kAlignment = 16;
+// the first block starts after the page header
+static const size_t   kPageHeaderSize = 32;
+
+struct HandleAllocator::Page
+{
+	// bytes bumped from the page start, the header included
+	size_t   used;
+	// bytes of live blocks
+	size_t   live;
+	uint32_t pinned;
+	// position in m_pages
+	uint32_t slot;
+};
+
+struct HandleAllocator::BlockHeader
+{
+	// the entry of the block, kFreeBlock once it's gone
+	uint32_t index;
+	// with the header
+	uint32_t size;
+	uint64_t reserved;
+};
+
+HandleAllocator::Config::Config()
+	: page_size(1024 * 1024)
+	, max_block_size(256 * 1024)
+	, compact_threshold(0.5f)
+{
+}
+
+HandleAllocator::HandleAllocator()
+	: HandleAllocator(Config())
+{
+}
+
+HandleAllocator::HandleAllocator(const Config& cfg)
+	: m_config(cfg)
+	, m_free_entry(kNoEntry)
+	, m_current(nullptr)
+	, m_victim(nullptr)
+	, m_victim_offset(0)
+	, m_budget(nullptr)
+	, m_large_bytes(0)
+	, m_moved_bytes(0)
+	, m_moved_blocks(0)
+	, m_freed_pages(0)
+{
+	static_assert(sizeof(Page) <= kPageHeaderSize && sizeof(BlockHeader) % kAlignment == 0, "HandleAllocator headers");
+	assert((m_config.page_size & (m_config.page_size - 1)) == 0);
+	// a block must fit a page
+	size_t max_block_size = m_config.page_size - kPageHeaderSize - sizeof(BlockHeader);
+	if (m_config.max_block_size > max_block_size) {
+		m_config.max_block_size = max_block_size;
+	}
+}
+
+HandleAllocator::~HandleAllocator()
+{
+	for (Entry& e : m_entries)
+	{
+		if (e.ptr && e.large)
+		{
+			free(e.ptr);
+			if (m_budget) {
+				m_budget->Release(e.size);
+			}
+		}
+	}
+	while (!m_pages.empty()) {
+		FreePage(m_pages.back());
+	}
+}
+
+HandleAllocator::Handle HandleAllocator::Allocate(size_t size)
+{
+	Handle h;
+
+	void* ptr;
+	bool large = size > m_config.max_block_size;
+	if (large)
+	{
+		if (m_budget && !m_budget->Acquire(size)) {
+			return h;
+		}
+		ptr = malloc(size);
+		if (!ptr)
+		{
+			if (m_budget) {
+				m_budget->Release(size);
+			}
+			return h;
+		}
+		m_large_bytes += size;
+	}
+	else
+	{
+		size_t block_size = ALIGN(size, kAlignment) + sizeof(BlockHeader);
+		BlockHeader* block = Bump(block_size);
+		if (!block) {
+			return h;
+		}
+		block->size = static_cast<uint32_t>(block_size);
+		PageOf(block)->live += block_size;
+		ptr = block + 1;
+	}
+
+	uint32_t index = m_free_entry;
+	if (index != kNoEntry)
+	{
+		m_free_entry = m_entries[index].next_free;
+	}
+	else
+	{
+		index = static_cast<uint32_t>(m_entries.size());
+		m_entries.push_back(Entry());
+		m_entries.back().generation = 1;
+	}
+
+	Entry& e = m_entries[index];
+	e.ptr       = ptr;
+	e.size      = static_cast<uint32_t>(size);
+	e.pins      = 0;
+	e.next_free = kNoEntry;
+	e.large     = large;
+	if (!large) {
+		(static_cast<BlockHeader*>(ptr) - 1)->index = index;
+	}
+
+	h.index      = index;
+	h.generation = e.generation;
+	return h;
+}
+
+void HandleAllocator::Free(Handle h)
+{
+	Entry* e = Lookup(h);
+	if (!e) {
+		return;
+	}
+	assert(e->pins == 0);
+
+	if (e->large)
+	{
+		free(e->ptr);
+		m_large_bytes -= e->size;
+		if (m_budget) {
+			m_budget->Release(e->size);
+		}
+	}
+	else
+	{
+		BlockHeader* block = static_cast<BlockHeader*>(e->ptr) - 1;
+		Page* page = PageOf(block);
+		page->live -= block->size;
+		block->index = kFreeBlock;
+		ReleaseIfEmpty(page);
+	}
+
+	e->ptr = nullptr;
+	// 0 stays the null handle's
+	if (++e->generation == 0) {
+		e->generation = 1;
+	}
+	e->next_free = m_free_entry;
+	m_free_entry = h.index;
+}
+
+HandleAllocator::Entry* HandleAllocator::Lookup(Handle h)
+{
+	if (h.index >= m_entries.size()) {
+		return nullptr;
+	}
+	Entry& e = m_entries[h.index];
+	return e.ptr && e.generation == h.generation ? &e : nullptr;
+}
+
+const HandleAllocator::Entry* HandleAllocator::Lookup(Handle h) const
+{
+	return const_cast<HandleAllocator*>(this)->Lookup(h);
+}
+
+void* HandleAllocator::Get(Handle h) const
+{
+	const Entry* e = Lookup(h);
+	return e ? e->ptr : nullptr;
+}
+
+size_t HandleAllocator::GetSize(Handle h) const
+{
+	const Entry* e = Lookup(h);
+	return e ? e->size : 0;
+}
+
+void* HandleAllocator::Pin(Handle h)
+{
+	Entry* e = Lookup(h);
+	if (!e) {
+		return nullptr;
+	}
+	if (e->pins++ == 0 && !e->large) {
+		++PageOf(e->ptr)->pinned;
+	}
+	return e->ptr;
+}
+
+void HandleAllocator::Unpin(Handle h)
+{
+	Entry* e = Lookup(h);
+	if (!e) {
+		return;
+	}
+	assert(e->pins > 0);
+	if (--e->pins == 0 && !e->large) {
+		--PageOf(e->ptr)->pinned;
+	}
+}
+
+HandleAllocator::Page* HandleAllocator::PageOf(const void* p) const
+{
+	return reinterpret_cast<Page*>(reinterpret_cast<uintptr_t>(p) & ~(m_config.page_size - 1));
+}
+
+HandleAllocator::BlockHeader* HandleAllocator::Bump(size_t size)
+{
+	if (!m_current || m_current->used + size > m_config.page_size)
+	{
+		Page* page = NewPage();
+		if (!page) {
+			return nullptr;
+		}
+		Page* prev = m_current;
+		m_current = page;
+		if (prev) {
+			ReleaseIfEmpty(prev);
+		}
+	}
+
+	BlockHeader* block = reinterpret_cast<BlockHeader*>(reinterpret_cast<uint8_t*>(m_current) + m_current->used);
+	m_current->used += size;
+	return block;
+}
+
+HandleAllocator::Page* HandleAllocator::NewPage()
+{
+	if (m_budget && !m_budget->Acquire(m_config.page_size)) {
+		return nullptr;
+	}
+	Page* page = static_cast<Page*>(Utility::AlignedAlloc(m_config.page_size, m_config.page_size));
+	if (!page)
+	{
+		if (m_budget) {
+			m_budget->Release(m_config.page_size);
+		}
+		return nullptr;
+	}
+
+	page->used   = kPageHeaderSize;
+	page->live   = 0;
+	page->pinned = 0;
+	page->slot   = static_cast<uint32_t>(m_pages.size());
+	m_pages.push_back(page);
+	return page;
+}
+
+void HandleAllocator::FreePage(Page* page)
+{
+	Page* last = m_pages.back();
+	m_pages[page->slot] = last;
+	last->slot = page->slot;
+	m_pages.pop_back();
+
+	if (page == m_current) {
+		m_current = nullptr;
+	}
+	if (page == m_victim) {
+		m_victim = nullptr;
+	}
+
+	Utility::AlignedFree(page);
+	if (m_budget) {
+		m_budget->Release(m_config.page_size);
+	}
+	++m_freed_pages;
+}
+
+void HandleAllocator::ReleaseIfEmpty(Page* page)
+{
+	if (page->live > 0) {
+		return;
+	}
+	if (page == m_current) {
+		// starts over instead
+		page->used = kPageHeaderSize;
+	} else {
+		FreePage(page);
+	}
+}
+
+HandleAllocator::Page* HandleAllocator::PickVictim() const
+{
+	Page* victim = nullptr;
+	float min_ratio = m_config.compact_threshold;
+	for (Page* page : m_pages)
+	{
+		if (page == m_current || page->pinned > 0) {
+			continue;
+		}
+		float ratio = static_cast<float>(page->live) / static_cast<float>(page->used - kPageHeaderSize);
+		if (ratio < min_ratio)
+		{
+			min_ratio = ratio;
+			victim = page;
+		}
+	}
+	return victim;
+}
+
+bool HandleAllocator::EvacuateNext()
+{
+	Page* page = m_victim;
+	while (m_victim_offset < page->used)
+	{
+		BlockHeader* block = reinterpret_cast<BlockHeader*>(reinterpret_cast<uint8_t*>(page) + m_victim_offset);
+		if (block->index == kFreeBlock || m_entries[block->index].pins > 0)
+		{
+			m_victim_offset += block->size;
+			continue;
+		}
+
+		size_t size = block->size;
+		BlockHeader* dst = Bump(size);
+		if (!dst) {
+			return false;
+		}
+		memcpy(dst, block, size);
+		m_entries[block->index].ptr = dst + 1;
+		PageOf(dst)->live += size;
+
+		block->index = kFreeBlock;
+		m_victim_offset += size;
+		m_moved_bytes += size;
+		++m_moved_blocks;
+
+		page->live -= size;
+		// frees the page, and with it the victim, once it's through
+		ReleaseIfEmpty(page);
+		return true;
+	}
+
+	// left with pinned blocks
+	m_victim = nullptr;
+	return true;
+}
+
+size_t HandleAllocator::Tick(uint32_t budget_us)
+{
+	typedef std::chrono::steady_clock clock;
+	clock::time_point deadline = clock::now() + std::chrono::microseconds(budget_us);
+
+	uint64_t moved = m_moved_bytes;
+	for (;;)
+	{
+		if (!m_victim)
+		{
+			m_victim = PickVictim();
+			if (!m_victim) {
+				break;
+			}
+			m_victim_offset = kPageHeaderSize;
+		}
+		if (!EvacuateNext()) {
+			break;
+		}
+		if (budget_us && clock::now() >= deadline) {
+			break;
+		}
+	}
+	return static_cast<size_t>(m_moved_bytes - moved);
+}
+
+void HandleAllocator::SetBudget(MemoryBudget* budget)
+{
+	assert(m_pages.empty() && m_large_bytes == 0);
+	m_budget = budget;
+}
+
+HandleAllocator::Stats HandleAllocator::GetStats() const
+{
+	Stats stats;
+	memset(&stats, 0, sizeof(stats));
+	for (const Page* page : m_pages) {
+		stats.live_bytes += page->live;
+	}
+	stats.pages      = static_cast<uint32_t>(m_pages.size());
+	stats.page_bytes = m_pages.size() * m_config.page_size;
+	stats.large_bytes = m_large_bytes;
+	for (const Entry& e : m_entries) {
+		stats.handles += e.ptr ? 1 : 0;
+	}
+	stats.fragmentation = stats.page_bytes ? 1.0f - static_cast<float>(stats.live_bytes) / static_cast<float>(stats.page_bytes) : 0.0f;
+
+	stats.moved_bytes  = m_moved_bytes;
+	stats.moved_blocks = m_moved_blocks;
+	stats.freed_pages  = m_freed_pages;
+	return stats;
+}
+
+void HandleAllocator::DumpMemoryStats(const char* prefix) const
+{
+	Stats stats = GetStats();
+
+	float pretty_size;
+	const char* pretty_suffix;
+	pretty_suffix = Utility::ToSize(stats.page_bytes, pretty_size);
+	LOGI("%sPages %u, %.2f%s, fragmentation %.1f%%", prefix, stats.pages, pretty_size, pretty_suffix,
+		stats.fragmentation * 100.0f);
+	pretty_suffix = Utility::ToSize(stats.large_bytes, pretty_size);
+	LOGI("%sHandles %u, large blocks %.2f%s", prefix, stats.handles, pretty_size, pretty_suffix);
+	pretty_suffix = Utility::ToSize(static_cast<size_t>(stats.moved_bytes), pretty_size);
+	LOGI("%sMoved %.2f%s in %llu blocks, %llu pages freed", prefix, pretty_size, pretty_suffix,
+		static_cast<unsigned long long>(stats.moved_blocks), static_cast<unsigned long long>(stats.freed_pages));
+}
+
+}
@@ -26,6 +26,10 @@
 #define LOG_NDEBUG 1
 
 #include "memmgr/LinearAllocator.h"
+#include "memmgr/AllocTrace.h"
+#include "memmgr/LinearPageRecycler.h"
+#include "memmgr/MappedArena.h"
+#include "memmgr/MemoryBudget.h"
 #include "memmgr/Utility.h"
 
 #include <logger.h>
@@ -33,17 +37,6 @@
 #include <stdlib.h>
 #include <assert.h>
 
-// The ideal size of a page allocation (these need to be multiples of 8)
-#define INITIAL_PAGE_SIZE ((size_t)512) // 512b
-#define MAX_PAGE_SIZE ((size_t)131072) // 128kb
-
-// The maximum amount of wasted space we can have per page
-// Allocations exceeding this will have their own dedicated page
-// If this is too low, we will malloc too much
-// Too high, and we may waste too much space
-// Must be smaller than INITIAL_PAGE_SIZE
-#define MAX_WASTE_RATIO (0.5f)
-
 #if ALIGN_DOUBLE
 #define ALIGN_SZ (sizeof(double))
 #else
@@ -83,15 +76,37 @@ static void _addAllocation(int count) {
 
 #define min(x,y) (((x) < (y)) ? (x) : (y))
 
+// Addresses per destructor chunk, about 2kb
+#define DTOR_CHUNK_CAPACITY 254
+
 namespace mm {
 
+struct LinearAllocator::DestructorChunk {
+    DestructorChunk* prev;
+    size_t count;
+    // null where an older object was destroyed early
+    void* addrs[DTOR_CHUNK_CAPACITY];
+};
+
+struct LinearAllocator::DestructorGroup {
+    Destructor dtor;
+    // the newest chunk, the only one that isn't full
+    DestructorChunk* chunks;
+    DestructorGroup* next;
+};
+
 class LinearAllocator::Page {
 public:
     Page* next() { return mNextPage; }
     void setNext(Page* next) { mNextPage = next; }
 
-	Page(int pageSize = -1)
+	Page(size_t pageSize, FreelistAllocator* pool, LinearPageRecycler* recycler, MappedArena* arena,
+		MemoryTag tag)
 		: mPageSize(pageSize)
+		, mPool(pool)
+		, mRecycler(recycler)
+		, mArena(arena)
+		, mTag(tag)
 		, mNextPage(0)
 	{}
 
@@ -105,91 +120,264 @@ public:
         return (void*) (((size_t)start()) + pageSize);
     }
 
-	int GetPageSize() const { return mPageSize; }
+	size_t GetPageSize() const { return mPageSize; }
+	// the FreelistAllocator the page was taken from, nullptr for malloc
+	FreelistAllocator* GetPool() const { return mPool; }
+	// where a malloc'd page goes back to, nullptr to free it
+	LinearPageRecycler* GetRecycler() const { return mRecycler; }
+	// the mapped file the page was carved from, where it stays
+	MappedArena* GetArena() const { return mArena; }
+	// what the page is charged to
+	MemoryTag GetTag() const { return mTag; }
 
 private:
     Page(const Page& /*other*/) {}
 
-	int mPageSize;
+	size_t mPageSize;
+	FreelistAllocator* mPool;
+	LinearPageRecycler* mRecycler;
+	MappedArena* mArena;
+	MemoryTag mTag;
 
     Page* mNextPage;
 };
 
+static LinearAllocator::Policy sDefaultPolicy = {
+    512,    // 512b
+    131072, // 128kb
+    0.5f,
+    nullptr,
+    false,
+    nullptr,
+};
+
+const LinearAllocator::Policy& LinearAllocator::defaultPolicy() {
+    return sDefaultPolicy;
+}
+
+void LinearAllocator::setDefaultPolicy(const Policy& policy) {
+    sDefaultPolicy = policy;
+}
+
 LinearAllocator::LinearAllocator()
-    : mPageSize(INITIAL_PAGE_SIZE)
-    , mMaxAllocSize(static_cast<size_t>(INITIAL_PAGE_SIZE * MAX_WASTE_RATIO))
-    , mNext(0)
-    , mCurrentPage(0)
-    , mPages(0)
-    , mTotalAllocated(0)
-    , mWastedSpace(0)
-    , mPageCount(0)
-    , mDedicatedPageCount(0) {}
+    : LinearAllocator(sDefaultPolicy) {}
 
 LinearAllocator::LinearAllocator(FreelistAllocator* alloc)
-	: mPageSize(INITIAL_PAGE_SIZE)
-	, mMaxAllocSize(static_cast<size_t>(INITIAL_PAGE_SIZE * MAX_WASTE_RATIO))
+	: LinearAllocator(sDefaultPolicy, alloc)
+{
+}
+
+LinearAllocator::LinearAllocator(size_t initialCapacity, FreelistAllocator* alloc)
+	: LinearAllocator(sDefaultPolicy, alloc)
+{
+	// the Page header sits at the start of the page, in front of the data
+	size_t pageSize = ALIGN(sizeof(Page)) + ALIGN(initialCapacity);
+	if (pageSize > mPageSize) {
+		mPageSize = pageSize;
+		mMaxAllocSize = static_cast<size_t>(mPageSize * mPolicy.maxWasteRatio);
+	}
+	ensureNext(0);
+}
+
+LinearAllocator::LinearAllocator(const Policy& policy, FreelistAllocator* alloc)
+	: mPolicy(policy)
+	, mPageSize(ALIGN(policy.initialPageSize))
 	, mNext(0)
 	, mCurrentPage(0)
 	, mPages(0)
+	, m_alloc(alloc)
+	, mTag(MEMMGR_CURRENT_TAG)
 	, mTotalAllocated(0)
 	, mWastedSpace(0)
 	, mPageCount(0)
 	, mDedicatedPageCount(0)
-	, m_alloc(alloc)
 {
+	if (mPolicy.adaptiveInitialSize && mPolicy.recycler) {
+		// stay on the ladder so the pages can be recycled between arenas
+		size_t suggested = mPolicy.recycler->GetSuggestedSize();
+		if (suggested > 0) {
+			suggested += sizeof(Page);
+		}
+		while (mPageSize < suggested && mPageSize < mPolicy.maxPageSize) {
+			mPageSize = ALIGN(min(mPolicy.maxPageSize, mPageSize * 2));
+		}
+	}
+	mMaxAllocSize = static_cast<size_t>(mPageSize * mPolicy.maxWasteRatio);
 }
 
-LinearAllocator& LinearAllocator::operator = (const LinearAllocator& alloc)
+struct LinearAllocator::Detached {
+    Page* pages;
+    DestructorGroup* dtorGroups;
+    MemoryBudget* budget;
+
+    size_t totalAllocated;
+    size_t wastedSpace;
+    size_t pageCount;
+    size_t dedicatedPageCount;
+};
+
+LinearAllocator::LinearAllocator(LinearAllocator&& other)
+	: mPolicy(other.mPolicy)
+	, mPageSize(other.mPageSize)
+	, mMaxAllocSize(other.mMaxAllocSize)
+	, m_alloc(other.m_alloc)
+	, mBudget(other.mBudget)
+	, mTag(other.mTag)
+{
+	takeFrom(other);
+}
+
+LinearAllocator& LinearAllocator::operator = (LinearAllocator&& other)
 {
-	if (this == &alloc) {
+	if (this == &other) {
 		return *this;
 	}
 
-	this->~LinearAllocator();
-
-	mPageSize     = alloc.mPageSize;
-	mMaxAllocSize = alloc.mMaxAllocSize;
-	mNext         = alloc.mNext;
-	mCurrentPage  = alloc.mCurrentPage;
-	mPages        = alloc.mPages;
-	mDtorList     = alloc.mDtorList;
-
-	m_alloc = alloc.m_alloc;
+	release();
 
-	mTotalAllocated     = alloc.mTotalAllocated;
-	mWastedSpace        = alloc.mWastedSpace;
-	mPageCount          = alloc.mPageCount;
-	mDedicatedPageCount = alloc.mDedicatedPageCount;
+	mPolicy       = other.mPolicy;
+	mPageSize     = other.mPageSize;
+	mMaxAllocSize = other.mMaxAllocSize;
 
-	const_cast<LinearAllocator&>(alloc).mDtorList = nullptr;
-	const_cast<LinearAllocator&>(alloc).mPages = nullptr;
+	m_alloc = other.m_alloc;
+	mBudget = other.mBudget;
+	mTag    = other.mTag;
 
+	takeFrom(other);
 	return *this;
 }
 
+LinearAllocator& LinearAllocator::operator = (const LinearAllocator& alloc)
+{
+	return *this = std::move(const_cast<LinearAllocator&>(alloc));
+}
+
 LinearAllocator::~LinearAllocator(void) {
-    while (mDtorList) {
-        auto node = mDtorList;
-        mDtorList = node->next;
-        node->dtor(node->addr);
+    release();
+}
+
+void LinearAllocator::release() {
+    runDestructors();
+    if (mPolicy.adaptiveInitialSize && mPolicy.recycler && mPages) {
+        mPolicy.recycler->RecordHighWater(usedSize());
     }
     Page* p = mPages;
     while (p) {
         Page* next = p->next();
-        p->~Page();
-
-		int pageSize = p->GetPageSize();
-		if (pageSize < 0) {
-			free(p);
-		} else {
-			assert(m_alloc);
-			m_alloc->Free(p, pageSize);
-		}
-
-        RM_ALLOCATION();
+        freePage(p);
         p = next;
     }
+    resetContents();
+}
+
+void LinearAllocator::takeFrom(LinearAllocator& other) {
+    mNext               = other.mNext;
+    mCurrentPage        = other.mCurrentPage;
+    mPages              = other.mPages;
+    mDtorGroups         = other.mDtorGroups;
+    mLastDtorGroup      = other.mLastDtorGroup;
+    mSpareDtorChunk     = other.mSpareDtorChunk;
+    mTotalAllocated     = other.mTotalAllocated;
+    mWastedSpace        = other.mWastedSpace;
+    mPageCount          = other.mPageCount;
+    mDedicatedPageCount = other.mDedicatedPageCount;
+
+    other.mSpareDtorChunk = nullptr;
+    other.resetContents();
+}
+
+void LinearAllocator::resetContents() {
+    mNext = 0;
+    mCurrentPage = 0;
+    mPages = 0;
+    mDtorGroups = nullptr;
+    mLastDtorGroup = nullptr;
+    mTotalAllocated = 0;
+    mWastedSpace = 0;
+    mPageCount = 0;
+    mDedicatedPageCount = 0;
+}
+
+LinearAllocator::Detached* LinearAllocator::detach() {
+    if (!mPages) {
+        return nullptr;
+    }
+    Detached* detached = (Detached*)malloc(sizeof(Detached));
+    if (!detached) {
+        return nullptr;
+    }
+    detached->pages = mPages;
+    detached->dtorGroups = mDtorGroups;
+    detached->budget = mBudget;
+    detached->totalAllocated = mTotalAllocated;
+    detached->wastedSpace = mWastedSpace;
+    detached->pageCount = mPageCount;
+    detached->dedicatedPageCount = mDedicatedPageCount;
+    resetContents();
+    return detached;
+}
+
+bool LinearAllocator::adopt(Detached* detached) {
+    if (!detached) {
+        return true;
+    }
+    if (!mBudget && mPageCount == 0) {
+        mBudget = detached->budget;
+    } else if (mBudget != detached->budget) {
+        if (mBudget && !mBudget->Acquire(detached->totalAllocated)) {
+            return false;
+        }
+        if (detached->budget) {
+            detached->budget->Release(detached->totalAllocated);
+        }
+    }
+
+    // in front of our pages: ensureNext() links new pages behind the current
+    // page, which is always the last one
+    Page* last = detached->pages;
+    while (last->next()) {
+        last = last->next();
+    }
+    last->setNext(mPages);
+    mPages = detached->pages;
+    if (!mCurrentPage) {
+        // no page of our own yet: the last adopted page becomes current and
+        // the next allocation starts a fresh page behind it
+        mCurrentPage = last;
+        mNext = 0;
+    }
+
+    while (detached->dtorGroups) {
+        DestructorGroup* group = detached->dtorGroups;
+        detached->dtorGroups = group->next;
+
+        DestructorGroup* own = mDtorGroups;
+        while (own && own->dtor != group->dtor) {
+            own = own->next;
+        }
+        if (!own) {
+            group->next = mDtorGroups;
+            mDtorGroups = group;
+            continue;
+        }
+        if (group->chunks) {
+            DestructorChunk* oldest = group->chunks;
+            while (oldest->prev) {
+                oldest = oldest->prev;
+            }
+            oldest->prev = own->chunks;
+            own->chunks = group->chunks;
+        }
+        free(group);
+    }
+
+    mTotalAllocated += detached->totalAllocated;
+    mWastedSpace += detached->wastedSpace;
+    mPageCount += detached->pageCount;
+    mDedicatedPageCount += detached->dedicatedPageCount;
+
+    free(detached);
+    return true;
 }
 
 void* LinearAllocator::start(Page* p) {
@@ -204,16 +392,22 @@ bool LinearAllocator::fitsInCurrentPage(size_t size) {
     return mNext && ((char*)mNext + size) <= end(mCurrentPage);
 }
 
-void LinearAllocator::ensureNext(size_t size) {
-    if (fitsInCurrentPage(size)) return;
+bool LinearAllocator::ensureNext(size_t size) {
+    if (fitsInCurrentPage(size)) return true;
 
-    if (mCurrentPage && mPageSize < MAX_PAGE_SIZE) {
-        mPageSize = min(MAX_PAGE_SIZE, mPageSize * 2);
-        mMaxAllocSize = static_cast<size_t>(mPageSize * MAX_WASTE_RATIO);
-        mPageSize = ALIGN(mPageSize);
+    size_t pageSize = mPageSize;
+    if (mCurrentPage && pageSize < mPolicy.maxPageSize) {
+        pageSize = ALIGN(min(mPolicy.maxPageSize, pageSize * 2));
+    }
+    Page* p = newPage(pageSize);
+    if (!p) {
+        return false;
+    }
+    if (pageSize != mPageSize) {
+        mPageSize = pageSize;
+        mMaxAllocSize = static_cast<size_t>(mPageSize * mPolicy.maxWasteRatio);
     }
     mWastedSpace += mPageSize;
-    Page* p = newPage(mPageSize);
     if (mCurrentPage) {
         mCurrentPage->setNext(p);
     }
@@ -222,6 +416,7 @@ void LinearAllocator::ensureNext(size_t size) {
         mPages = mCurrentPage;
     }
     mNext = start(mCurrentPage);
+    return true;
 }
 
 void* LinearAllocator::allocImpl(size_t size) {
@@ -229,57 +424,149 @@ void* LinearAllocator::allocImpl(size_t size) {
     if (size > mMaxAllocSize && !fitsInCurrentPage(size)) {
         LOGI("Exceeded max size %zu > %zu", size, mMaxAllocSize);
         // Allocation is too large, create a dedicated page for the allocation
-        Page* page = newPage(size);
+        Page* page = newPage(size, true);
+        if (!page) {
+            return nullptr;
+        }
         mDedicatedPageCount++;
         page->setNext(mPages);
         mPages = page;
         if (!mCurrentPage)
             mCurrentPage = mPages;
+        MEMMGR_TRACE_ALLOC(SOURCE_LINEAR, start(page), size);
         return start(page);
     }
-    ensureNext(size);
+    if (!ensureNext(size)) {
+        return nullptr;
+    }
     void* ptr = mNext;
     mNext = ((char*)mNext) + size;
     mWastedSpace -= size;
+    MEMMGR_TRACE_ALLOC(SOURCE_LINEAR, ptr, size);
     return ptr;
 }
 
-void LinearAllocator::addToDestructionList(Destructor dtor, void* addr) {
-    static_assert(std::is_standard_layout<DestructorNode>::value,
-                  "DestructorNode must have standard layout");
-    static_assert(std::is_trivially_destructible<DestructorNode>::value,
-                  "DestructorNode must be trivially destructable");
-    auto node = new (allocImpl(sizeof(DestructorNode))) DestructorNode();
-    node->dtor = dtor;
-    node->addr = addr;
-    node->next = mDtorList;
-    mDtorList = node;
+bool LinearAllocator::addToDestructionList(Destructor dtor, void* addr) {
+    DestructorGroup* group = mLastDtorGroup;
+    if (!group || group->dtor != dtor) {
+        group = mDtorGroups;
+        while (group && group->dtor != dtor) {
+            group = group->next;
+        }
+    }
+    if (!group) {
+        group = (DestructorGroup*)malloc(sizeof(DestructorGroup));
+        if (!group) {
+            return false;
+        }
+        group->dtor = dtor;
+        group->chunks = nullptr;
+        group->next = mDtorGroups;
+        mDtorGroups = group;
+    }
+
+    DestructorChunk* chunk = group->chunks;
+    if (!chunk || chunk->count == DTOR_CHUNK_CAPACITY) {
+        if (mSpareDtorChunk) {
+            chunk = mSpareDtorChunk;
+            mSpareDtorChunk = nullptr;
+        } else {
+            chunk = (DestructorChunk*)malloc(sizeof(DestructorChunk));
+            if (!chunk) {
+                return false;
+            }
+        }
+        chunk->prev = group->chunks;
+        chunk->count = 0;
+        group->chunks = chunk;
+    }
+    chunk->addrs[chunk->count++] = addr;
+    mLastDtorGroup = group;
+    return true;
 }
 
-void LinearAllocator::runDestructorFor(void* addr) {
-    auto node = mDtorList;
-    DestructorNode* previous = nullptr;
-    while (node) {
-        if (node->addr == addr) {
-            if (previous) {
-                previous->next = node->next;
+bool LinearAllocator::removeDestructor(DestructorGroup* group, void* addr) {
+    DestructorChunk* last = group->chunks;
+    if (!last) {
+        return false;
+    }
+    if (last->addrs[last->count - 1] != addr) {
+        // an older object leaves a hole, the rest keep their order
+        for (DestructorChunk* chunk = last; chunk; chunk = chunk->prev) {
+            for (size_t i = chunk->count; i-- > 0; ) {
+                if (chunk->addrs[i] == addr) {
+                    chunk->addrs[i] = nullptr;
+                    group->dtor(addr);
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+    // pop the newest object and the holes behind it
+    do {
+        if (--last->count == 0) {
+            group->chunks = last->prev;
+            if (mSpareDtorChunk) {
+                free(last);
             } else {
-                mDtorList = node->next;
+                mSpareDtorChunk = last;
             }
-            node->dtor(node->addr);
-            rewindIfLastAlloc(node, sizeof(DestructorNode));
-            break;
+            last = group->chunks;
+        }
+    } while (last && !last->addrs[last->count - 1]);
+    group->dtor(addr);
+    return true;
+}
+
+void LinearAllocator::runDestructorFor(Destructor dtor, void* addr) {
+    for (DestructorGroup* group = mDtorGroups; group; group = group->next) {
+        if (group->dtor == dtor) {
+            removeDestructor(group, addr);
+            return;
         }
-        previous = node;
-        node = node->next;
     }
 }
 
+void LinearAllocator::runDestructorFor(void* addr) {
+    // only the newest object of its type can be rewound, so the tails are enough
+    for (DestructorGroup* group = mDtorGroups; group; group = group->next) {
+        DestructorChunk* last = group->chunks;
+        if (last && last->addrs[last->count - 1] == addr) {
+            removeDestructor(group, addr);
+            return;
+        }
+    }
+}
+
+void LinearAllocator::runDestructors() {
+    while (mDtorGroups) {
+        DestructorGroup* group = mDtorGroups;
+        mDtorGroups = group->next;
+        Destructor dtor = group->dtor;
+        while (group->chunks) {
+            DestructorChunk* chunk = group->chunks;
+            group->chunks = chunk->prev;
+            for (size_t i = chunk->count; i-- > 0; ) {
+                if (chunk->addrs[i]) {
+                    dtor(chunk->addrs[i]);
+                }
+            }
+            free(chunk);
+        }
+        free(group);
+    }
+    mLastDtorGroup = nullptr;
+    free(mSpareDtorChunk);
+    mSpareDtorChunk = nullptr;
+}
+
 void LinearAllocator::rewindIfLastAlloc(void* ptr, size_t allocSize) {
-    // First run the destructor as running the destructor will
-    // also rewind for the DestructorNode allocation which will
-    // have been allocated after this void* if it has a destructor
     runDestructorFor(ptr);
+    rewindBuffer(ptr, allocSize);
+}
+
+void LinearAllocator::rewindBuffer(void* ptr, size_t allocSize) {
     // Don't bother rewinding across pages
     allocSize = ALIGN(allocSize);
     if (ptr >= start(mCurrentPage) && ptr < end(mCurrentPage)
@@ -289,21 +576,80 @@ void LinearAllocator::rewindIfLastAlloc(void* ptr, size_t allocSize) {
     }
 }
 
-LinearAllocator::Page* LinearAllocator::newPage(size_t pageSize) {
+bool LinearAllocator::tryExtend(void* ptr, size_t oldSize, size_t newSize) {
+    oldSize = ALIGN(oldSize);
+    newSize = ALIGN(newSize);
+    if (!mNext || !ptr || ptr < start(mCurrentPage) || ptr >= end(mCurrentPage)
+            || ((char*)ptr + oldSize) != mNext || ((char*)ptr + newSize) > end(mCurrentPage)) {
+        return false;
+    }
+    mWastedSpace = mWastedSpace + oldSize - newSize;
+    mNext = (char*)ptr + newSize;
+    return true;
+}
+
+LinearAllocator::Page* LinearAllocator::newPage(size_t pageSize, bool dedicated) {
     pageSize = ALIGN(pageSize + sizeof(LinearAllocator::Page));
+    if (mBudget && !mBudget->Acquire(pageSize)) {
+        return nullptr;
+    }
+	void* buf = nullptr;
+	MappedArena* arena = mPolicy.arena;
+	if (arena) {
+		buf = arena->AllocatePage(pageSize);
+	} else if (m_alloc) {
+		// charged by the FreelistAllocator
+		buf = m_alloc->Allocate(pageSize, mTag);
+	}
+	bool pooled = !arena && buf != nullptr;
+	// dedicated pages are one-off sizes, not worth caching
+	LinearPageRecycler* recycler = dedicated || arena ? nullptr : mPolicy.recycler;
+	if (!buf && !arena) {
+		buf = recycler ? recycler->Allocate(pageSize) : malloc(pageSize);
+	}
+	if (!buf) {
+		if (mBudget) {
+			mBudget->Release(pageSize);
+		}
+		return nullptr;
+	}
     ADD_ALLOCATION();
     mTotalAllocated += pageSize;
     mPageCount++;
-	void* buf = nullptr;
-	if (m_alloc) {
-		buf = m_alloc->Allocate(pageSize);
+	if (!pooled) {
+		MEMMGR_TAG_ALLOC(mTag, pageSize);
+	}
+	return new (buf) Page(pageSize, pooled ? m_alloc : nullptr, pooled ? nullptr : recycler, arena, mTag);
+}
+
+void LinearAllocator::freePage(Page* p) {
+    p->~Page();
+
+	size_t pageSize = p->GetPageSize();
+	MemoryTag tag = p->GetTag();
+	if (!p->GetPool()) {
+		MEMMGR_TAG_FREE(tag, pageSize);
 	}
-	if (buf) {
-		return new (buf) Page(pageSize);
+	if (p->GetArena()) {
+		// left in the file
+	} else if (p->GetPool()) {
+		// safe from other threads than the pool's
+		p->GetPool()->Free(p, pageSize, tag);
+	} else if (p->GetRecycler()) {
+		p->GetRecycler()->Free(p, pageSize);
 	} else {
-		buf = malloc(pageSize);
-		return new (buf) Page();
+		free(p);
+	}
+	if (mBudget) {
+		mBudget->Release(pageSize);
 	}
+
+    RM_ALLOCATION();
+}
+
+void LinearAllocator::setBudget(MemoryBudget* budget) {
+    assert(mPageCount == 0);
+    mBudget = budget;
 }
 
 void LinearAllocator::dumpMemoryStats(const char* prefix) {
@@ -0,0 +1,162 @@
+#include "memmgr/LinearPageRecycler.h"
+#include "memmgr/Utility.h"
+
+#include <logger.h>
+
+#include <stdlib.h>
+
+namespace mm
+{
+
+// 8mb
+static const size_t DEFAULT_MAX_CACHED_BYTES = 8 * 1024 * 1024;
+
+LinearPageRecycler::LinearPageRecycler(size_t max_cached_bytes)
+	: m_max_cached_bytes(max_cached_bytes)
+	, m_cached_bytes(0)
+	, m_high_water_pos(0)
+	, m_reused(0)
+	, m_allocated(0)
+{
+	for (int i = 0; i < MAX_SLOTS; ++i) {
+		m_slots[i].size  = 0;
+		m_slots[i].pages = nullptr;
+		m_slots[i].count = 0;
+	}
+	for (int i = 0; i < HIGH_WATER_COUNT; ++i) {
+		m_high_water[i] = 0;
+	}
+}
+
+LinearPageRecycler::~LinearPageRecycler()
+{
+	Trim();
+}
+
+void* LinearPageRecycler::Allocate(size_t size)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		for (int i = 0; i < MAX_SLOTS; ++i)
+		{
+			Slot& slot = m_slots[i];
+			if (slot.size == size && slot.pages)
+			{
+				FreePage* page = slot.pages;
+				slot.pages = page->next;
+				--slot.count;
+				m_cached_bytes -= size;
+				++m_reused;
+				return page;
+			}
+		}
+		++m_allocated;
+	}
+	return malloc(size);
+}
+
+void LinearPageRecycler::Free(void* p, size_t size)
+{
+	if (!p) {
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (m_cached_bytes + size <= m_max_cached_bytes)
+		{
+			// the slot of this size, or else an empty one
+			Slot* dst = nullptr;
+			for (int i = 0; i < MAX_SLOTS; ++i)
+			{
+				Slot& slot = m_slots[i];
+				if (slot.size == size) {
+					dst = &slot;
+					break;
+				}
+				if (!dst && slot.count == 0) {
+					dst = &slot;
+				}
+			}
+			if (dst)
+			{
+				FreePage* page = static_cast<FreePage*>(p);
+				page->next = dst->pages;
+				dst->pages = page;
+				dst->size = size;
+				++dst->count;
+				m_cached_bytes += size;
+				return;
+			}
+		}
+	}
+	free(p);
+}
+
+void LinearPageRecycler::Trim()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	for (int i = 0; i < MAX_SLOTS; ++i)
+	{
+		Slot& slot = m_slots[i];
+		while (slot.pages) {
+			FreePage* page = slot.pages;
+			slot.pages = page->next;
+			free(page);
+		}
+		slot.count = 0;
+	}
+	m_cached_bytes = 0;
+}
+
+void LinearPageRecycler::RecordHighWater(size_t bytes)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_high_water[m_high_water_pos] = bytes;
+	m_high_water_pos = (m_high_water_pos + 1) % HIGH_WATER_COUNT;
+}
+
+size_t LinearPageRecycler::GetSuggestedSize() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	size_t ret = 0;
+	for (int i = 0; i < HIGH_WATER_COUNT; ++i) {
+		if (m_high_water[i] > ret) {
+			ret = m_high_water[i];
+		}
+	}
+	return ret;
+}
+
+size_t LinearPageRecycler::GetCachedBytes() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_cached_bytes;
+}
+
+void LinearPageRecycler::DumpMemoryStats(const char* prefix) const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	float pretty_size;
+	const char* pretty_suffix;
+	pretty_suffix = Utility::ToSize(m_cached_bytes, pretty_size);
+	LOGI("%sCached: %.2f%s", prefix, pretty_size, pretty_suffix);
+	LOGI("%sPages reused %zu, allocated %zu", prefix, m_reused, m_allocated);
+	for (int i = 0; i < MAX_SLOTS; ++i)
+	{
+		const Slot& slot = m_slots[i];
+		if (slot.count > 0) {
+			LOGI("%s  %zu bytes: %zu pages", prefix, slot.size, slot.count);
+		}
+	}
+}
+
+LinearPageRecycler& LinearPageRecycler::Instance()
+{
+	// never destroyed, arenas may outlive static destruction
+	static LinearPageRecycler* instance = new LinearPageRecycler(DEFAULT_MAX_CACHED_BYTES);
+	return *instance;
+}
+
+}
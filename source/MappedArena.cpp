@@ -0,0 +1,311 @@
+#include "memmgr/MappedArena.h"
+
+#include <logger.h>
+
+#include <assert.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif // _WIN32
+
+#ifndef ALIGN
+#define ALIGN(x, a)         (((x) + ((a) - 1)) & ~((a) - 1))
+#endif
+
+namespace mm
+{
+
+static const char     kArenaMagic[4] = { 'M', 'M', 'A', 'R' };
+static const uint32_t kArenaVersion  = 1;
+
+static const size_t   kPageAlignment = 16;
+// the first page starts on a cache line
+static const size_t   kHeaderSize    = 64;
+
+struct MappedArena::Header
+{
+	char     magic[4];
+	uint32_t version;
+	uint64_t capacity;
+	// bytes handed out from the start of the file, the header included
+	uint64_t used;
+	// offset of the root object, 0 for none
+	uint64_t root;
+	// the address the arena was created at
+	uint64_t base;
+};
+
+MappedArena::MappedArena()
+	: m_base(nullptr)
+	, m_capacity(0)
+	, m_writable(false)
+#ifdef _WIN32
+	, m_file(INVALID_HANDLE_VALUE)
+	, m_mapping(nullptr)
+#else
+	, m_fd(-1)
+#endif // _WIN32
+{
+}
+
+MappedArena::~MappedArena()
+{
+	uint64_t used = 0;
+	if (m_base && m_writable)
+	{
+		Persist();
+		used = GetHeader()->used;
+	}
+	Unmap();
+
+#ifdef _WIN32
+	if (m_file != INVALID_HANDLE_VALUE)
+	{
+		if (used)
+		{
+			LARGE_INTEGER end;
+			end.QuadPart = static_cast<LONGLONG>(used);
+			SetFilePointerEx(m_file, end, nullptr, FILE_BEGIN);
+			SetEndOfFile(m_file);
+		}
+		CloseHandle(m_file);
+	}
+#else
+	if (m_fd >= 0)
+	{
+		if (used && ftruncate(m_fd, static_cast<off_t>(used)) != 0) {
+			LOGW("MappedArena: can't trim the arena file");
+		}
+		close(m_fd);
+	}
+#endif // _WIN32
+}
+
+MappedArena* MappedArena::Create(const char* filepath, size_t capacity, void* base)
+{
+	static_assert(sizeof(Header) <= kHeaderSize, "MappedArena header too large");
+
+	capacity = ALIGN(capacity, kPageAlignment);
+	if (capacity <= kHeaderSize) {
+		return nullptr;
+	}
+
+	MappedArena* arena = Map(filepath, true, true, capacity, base);
+	if (!arena) {
+		return nullptr;
+	}
+
+	Header* header = arena->GetHeader();
+	memcpy(header->magic, kArenaMagic, sizeof(header->magic));
+	header->version  = kArenaVersion;
+	header->capacity = capacity;
+	header->used     = kHeaderSize;
+	header->root     = 0;
+	header->base     = reinterpret_cast<uint64_t>(arena->m_base);
+	return arena;
+}
+
+MappedArena* MappedArena::Open(const char* filepath, bool writable, void* base)
+{
+	return Map(filepath, false, writable, 0, base);
+}
+
+MappedArena* MappedArena::Map(const char* filepath, bool create, bool writable, size_t capacity, void* base)
+{
+	MappedArena* arena = new MappedArena();
+	arena->m_writable = writable;
+
+	// an address asked for is a must, the recorded one a preference
+	bool fixed = base != nullptr;
+
+	Header header;
+	memset(&header, 0, sizeof(header));
+
+#ifdef _WIN32
+	HANDLE file = CreateFileA(filepath, writable ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ,
+		FILE_SHARE_READ, nullptr, create ? CREATE_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		delete arena;
+		return nullptr;
+	}
+	arena->m_file = file;
+
+	if (!create)
+	{
+		DWORD read = 0;
+		if (!ReadFile(file, &header, sizeof(header), &read, nullptr) || read != sizeof(header))
+		{
+			delete arena;
+			return nullptr;
+		}
+	}
+#else
+	int fd = open(filepath, create ? O_RDWR | O_CREAT | O_TRUNC : (writable ? O_RDWR : O_RDONLY), 0644);
+	if (fd < 0)
+	{
+		delete arena;
+		return nullptr;
+	}
+	arena->m_fd = fd;
+
+	if (!create && pread(fd, &header, sizeof(header), 0) != static_cast<ssize_t>(sizeof(header)))
+	{
+		delete arena;
+		return nullptr;
+	}
+#endif // _WIN32
+
+	if (!create)
+	{
+		if (memcmp(header.magic, kArenaMagic, sizeof(header.magic)) != 0 || header.version != kArenaVersion ||
+			header.used < kHeaderSize || header.used > header.capacity)
+		{
+			LOGW("MappedArena: %s is not an arena", filepath);
+			delete arena;
+			return nullptr;
+		}
+		// a read-only arena can't grow, it only needs what was used
+		capacity = static_cast<size_t>(writable ? header.capacity : header.used);
+		if (!base) {
+			base = reinterpret_cast<void*>(header.base);
+		}
+	}
+
+#ifdef _WIN32
+	uint64_t size = capacity;
+	arena->m_mapping = CreateFileMappingA(file, nullptr, writable ? PAGE_READWRITE : PAGE_READONLY,
+		writable ? static_cast<DWORD>(size >> 32) : 0, writable ? static_cast<DWORD>(size) : 0, nullptr);
+	void* map = nullptr;
+	if (arena->m_mapping)
+	{
+		DWORD access = writable ? FILE_MAP_WRITE : FILE_MAP_READ;
+		map = MapViewOfFileEx(arena->m_mapping, access, 0, 0, capacity, base);
+		if (!map && base && !fixed) {
+			map = MapViewOfFileEx(arena->m_mapping, access, 0, 0, capacity, nullptr);
+		}
+	}
+	if (!map)
+	{
+		delete arena;
+		return nullptr;
+	}
+#else
+	if (writable && ftruncate(fd, static_cast<off_t>(capacity)) != 0)
+	{
+		delete arena;
+		return nullptr;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < capacity)
+	{
+		LOGW("MappedArena: %s is truncated", filepath);
+		delete arena;
+		return nullptr;
+	}
+
+	int flags = MAP_SHARED;
+#ifdef MAP_FIXED_NOREPLACE
+	if (fixed) {
+		flags |= MAP_FIXED_NOREPLACE;
+	}
+#endif // MAP_FIXED_NOREPLACE
+	void* map = mmap(base, capacity, writable ? PROT_READ | PROT_WRITE : PROT_READ, flags, fd, 0);
+	if (map == MAP_FAILED)
+	{
+		delete arena;
+		return nullptr;
+	}
+	// kernels without MAP_FIXED_NOREPLACE take the address as a hint
+	if (fixed && map != base)
+	{
+		munmap(map, capacity);
+		delete arena;
+		return nullptr;
+	}
+#endif // _WIN32
+
+	arena->m_base     = static_cast<uint8_t*>(map);
+	arena->m_capacity = capacity;
+	return arena;
+}
+
+void MappedArena::Unmap()
+{
+	if (!m_base) {
+		return;
+	}
+#ifdef _WIN32
+	UnmapViewOfFile(m_base);
+	CloseHandle(m_mapping);
+	m_mapping = nullptr;
+#else
+	munmap(m_base, m_capacity);
+#endif // _WIN32
+	m_base = nullptr;
+}
+
+void* MappedArena::AllocatePage(size_t size)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (!m_writable) {
+		return nullptr;
+	}
+
+	Header* header = GetHeader();
+	size = ALIGN(size, kPageAlignment);
+	if (size > header->capacity - header->used) {
+		return nullptr;
+	}
+	void* ret = m_base + header->used;
+	header->used += size;
+	return ret;
+}
+
+void MappedArena::SetRoot(const void* p)
+{
+	assert(m_writable && (!p || Contains(p)));
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	GetHeader()->root = p ? static_cast<uint64_t>(static_cast<const uint8_t*>(p) - m_base) : 0;
+}
+
+void* MappedArena::GetRoot() const
+{
+	uint64_t root = GetHeader()->root;
+	return root ? m_base + root : nullptr;
+}
+
+bool MappedArena::Persist()
+{
+	if (!m_writable) {
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	size_t used = static_cast<size_t>(GetHeader()->used);
+#ifdef _WIN32
+	return FlushViewOfFile(m_base, used) && FlushFileBuffers(m_file);
+#else
+	return msync(m_base, used, MS_SYNC) == 0;
+#endif // _WIN32
+}
+
+size_t MappedArena::GetUsedSize() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return static_cast<size_t>(GetHeader()->used);
+}
+
+bool MappedArena::IsAtCreationBase() const
+{
+	return GetHeader()->base == reinterpret_cast<uint64_t>(m_base);
+}
+
+}
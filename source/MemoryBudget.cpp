@@ -0,0 +1,162 @@
+#include "memmgr/MemoryBudget.h"
+#include "memmgr/Utility.h"
+
+#include <logger.h>
+
+#include <string.h>
+
+#include <chrono>
+
+namespace mm
+{
+
+static std::mutex     s_registry_mutex;
+static MemoryBudget*  s_registry = nullptr;
+
+MemoryBudget::MemoryBudget(const char* name, size_t soft_limit, size_t hard_limit,
+	                       HardLimitPolicy policy)
+	: m_name(name)
+	, m_soft_limit(soft_limit)
+	, m_hard_limit(hard_limit)
+	, m_policy(policy)
+	, m_block_timeout_ms(0)
+	, m_current(0)
+	, m_peak(0)
+	, m_soft_cb(nullptr)
+	, m_soft_ud(nullptr)
+	, m_hard_cb(nullptr)
+	, m_hard_ud(nullptr)
+	, m_waiters(0)
+{
+	std::lock_guard<std::mutex> lock(s_registry_mutex);
+	m_next = s_registry;
+	s_registry = this;
+}
+
+MemoryBudget::~MemoryBudget()
+{
+	std::lock_guard<std::mutex> lock(s_registry_mutex);
+	MemoryBudget** pp = &s_registry;
+	while (*pp != this) {
+		pp = &(*pp)->m_next;
+	}
+	*pp = m_next;
+}
+
+void MemoryBudget::SetSoftLimitCallback(PressureCallback cb, void* ud)
+{
+	m_soft_cb = cb;
+	m_soft_ud = ud;
+}
+
+void MemoryBudget::SetHardLimitCallback(PressureCallback cb, void* ud)
+{
+	m_hard_cb = cb;
+	m_hard_ud = ud;
+}
+
+bool MemoryBudget::Acquire(size_t size)
+{
+	bool crossed_soft = false;
+	bool ok = TryAcquire(size, crossed_soft);
+	if (!ok && m_hard_cb)
+	{
+		m_hard_cb(*this, size, m_hard_ud);
+		ok = TryAcquire(size, crossed_soft);
+	}
+
+	if (!ok && m_policy == HARD_LIMIT_BLOCK)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		++m_waiters;
+		auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(m_block_timeout_ms);
+		while (!(ok = TryAcquire(size, crossed_soft)))
+		{
+			if (m_block_timeout_ms == 0) {
+				m_cond.wait(lock);
+			} else if (m_cond.wait_until(lock, deadline) == std::cv_status::timeout) {
+				ok = TryAcquire(size, crossed_soft);
+				break;
+			}
+		}
+		--m_waiters;
+	}
+
+	// outside of the lock, the callback is expected to release memory
+	if (crossed_soft && m_soft_cb) {
+		m_soft_cb(*this, size, m_soft_ud);
+	}
+	return ok;
+}
+
+void MemoryBudget::Release(size_t size)
+{
+	// pairs with the waiter registering before it retries
+	m_current.fetch_sub(size);
+	if (m_waiters.load() > 0)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_cond.notify_all();
+	}
+}
+
+void MemoryBudget::ResetPeak()
+{
+	m_peak.store(m_current.load(std::memory_order_relaxed), std::memory_order_relaxed);
+}
+
+void MemoryBudget::DumpMemoryStats(const char* prefix) const
+{
+	float pretty_cur, pretty_peak, pretty_hard;
+	const char* suffix_cur  = Utility::ToSize(GetCurrent(), pretty_cur);
+	const char* suffix_peak = Utility::ToSize(GetPeak(), pretty_peak);
+	const char* suffix_hard = Utility::ToSize(m_hard_limit, pretty_hard);
+	LOGI("%s%s: current %.2f%s, peak %.2f%s, limit %.2f%s", prefix, m_name,
+		pretty_cur, suffix_cur, pretty_peak, suffix_peak, pretty_hard, suffix_hard);
+}
+
+MemoryBudget* MemoryBudget::Find(const char* name)
+{
+	std::lock_guard<std::mutex> lock(s_registry_mutex);
+	for (MemoryBudget* b = s_registry; b; b = b->m_next) {
+		if (strcmp(b->m_name, name) == 0) {
+			return b;
+		}
+	}
+	return nullptr;
+}
+
+void MemoryBudget::DumpAllMemoryStats(const char* prefix)
+{
+	std::lock_guard<std::mutex> lock(s_registry_mutex);
+	for (MemoryBudget* b = s_registry; b; b = b->m_next) {
+		b->DumpMemoryStats(prefix);
+	}
+}
+
+bool MemoryBudget::TryAcquire(size_t size, bool& crossed_soft)
+{
+	size_t prev = m_current.load();
+	size_t curr;
+	do {
+		curr = prev + size;
+		if (curr > m_hard_limit) {
+			return false;
+		}
+	} while (!m_current.compare_exchange_weak(prev, curr));
+
+	UpdatePeak(curr);
+
+	crossed_soft = prev <= m_soft_limit && curr > m_soft_limit;
+	return true;
+}
+
+void MemoryBudget::UpdatePeak(size_t current)
+{
+	size_t peak = m_peak.load(std::memory_order_relaxed);
+	while (current > peak &&
+		   !m_peak.compare_exchange_weak(peak, current, std::memory_order_relaxed)) {
+	}
+}
+
+}
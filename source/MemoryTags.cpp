@@ -0,0 +1,192 @@
+#include "memmgr/MemoryTags.h"
+#include "memmgr/Utility.h"
+
+#include <logger.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <mutex>
+#include <vector>
+
+namespace mm
+{
+
+static std::mutex s_tags_mutex;
+
+static char   s_names[MemoryTags::MAX_TAGS][MemoryTags::MAX_NAME_LENGTH + 1] = { "untagged" };
+static size_t s_tag_count = 1;
+
+// the counters of running threads, and what exited ones left
+static std::vector<void*> s_threads;
+static int64_t  s_retired_live[MemoryTags::MAX_TAGS];
+static uint64_t s_retired_allocs[MemoryTags::MAX_TAGS];
+static uint64_t s_retired_frees[MemoryTags::MAX_TAGS];
+// the highest peak of any thread, and of any total a query saw
+static int64_t  s_peaks[MemoryTags::MAX_TAGS];
+
+thread_local MemoryTag MemoryTags::m_current = MEMORY_TAG_NONE;
+thread_local MemoryTags::Counters* MemoryTags::m_counters = nullptr;
+
+struct MemoryTags::ThreadExit
+{
+	~ThreadExit()
+	{
+		if (m_counters) {
+			DetachThread(m_counters);
+			m_counters = nullptr;
+		}
+	}
+};
+
+MemoryTag MemoryTags::Register(const char* name)
+{
+	std::lock_guard<std::mutex> lock(s_tags_mutex);
+	for (size_t i = 1; i < s_tag_count; ++i) {
+		if (strncmp(s_names[i], name, MAX_NAME_LENGTH) == 0) {
+			return static_cast<MemoryTag>(i);
+		}
+	}
+	if (s_tag_count == MAX_TAGS)
+	{
+		LOGW("MemoryTags: no tag left for %s", name);
+		return MEMORY_TAG_NONE;
+	}
+
+	strncpy(s_names[s_tag_count], name, MAX_NAME_LENGTH);
+	s_names[s_tag_count][MAX_NAME_LENGTH] = 0;
+	return static_cast<MemoryTag>(s_tag_count++);
+}
+
+MemoryTag MemoryTags::Find(const char* name)
+{
+	std::lock_guard<std::mutex> lock(s_tags_mutex);
+	for (size_t i = 1; i < s_tag_count; ++i) {
+		if (strncmp(s_names[i], name, MAX_NAME_LENGTH) == 0) {
+			return static_cast<MemoryTag>(i);
+		}
+	}
+	return MEMORY_TAG_NONE;
+}
+
+const char* MemoryTags::GetName(MemoryTag tag)
+{
+	// names never change once registered
+	return tag < MAX_TAGS ? s_names[tag] : "";
+}
+
+MemoryTags::Counters* MemoryTags::AttachThread()
+{
+	// only constructed here, so the fast path reads a plain pointer
+	thread_local ThreadExit exit;
+	(void)exit;
+
+	Counters* counters = new Counters;
+	for (size_t i = 0; i < MAX_TAGS; ++i)
+	{
+		counters->live_bytes[i].store(0, std::memory_order_relaxed);
+		counters->peak_bytes[i].store(0, std::memory_order_relaxed);
+		counters->alloc_count[i].store(0, std::memory_order_relaxed);
+		counters->free_count[i].store(0, std::memory_order_relaxed);
+	}
+
+	std::lock_guard<std::mutex> lock(s_tags_mutex);
+	s_threads.push_back(counters);
+	m_counters = counters;
+	return counters;
+}
+
+void MemoryTags::DetachThread(Counters* counters)
+{
+	std::lock_guard<std::mutex> lock(s_tags_mutex);
+	s_threads.erase(std::find(s_threads.begin(), s_threads.end(), counters));
+	for (size_t i = 0; i < MAX_TAGS; ++i)
+	{
+		s_retired_live[i]   += counters->live_bytes[i].load(std::memory_order_relaxed);
+		s_retired_allocs[i] += counters->alloc_count[i].load(std::memory_order_relaxed);
+		s_retired_frees[i]  += counters->free_count[i].load(std::memory_order_relaxed);
+		s_peaks[i] = std::max(s_peaks[i], counters->peak_bytes[i].load(std::memory_order_relaxed));
+	}
+	delete counters;
+}
+
+MemoryTags::Stats MemoryTags::GetStats(MemoryTag tag)
+{
+	Stats stats;
+	memset(&stats, 0, sizeof(stats));
+	if (tag >= MAX_TAGS) {
+		return stats;
+	}
+
+	std::lock_guard<std::mutex> lock(s_tags_mutex);
+	stats.live_bytes  = s_retired_live[tag];
+	stats.alloc_count = s_retired_allocs[tag];
+	stats.free_count  = s_retired_frees[tag];
+	int64_t peak = s_peaks[tag];
+	for (void* p : s_threads)
+	{
+		const Counters* c = static_cast<const Counters*>(p);
+		stats.live_bytes  += c->live_bytes[tag].load(std::memory_order_relaxed);
+		stats.alloc_count += c->alloc_count[tag].load(std::memory_order_relaxed);
+		stats.free_count  += c->free_count[tag].load(std::memory_order_relaxed);
+		peak = std::max(peak, c->peak_bytes[tag].load(std::memory_order_relaxed));
+	}
+	peak = std::max(peak, stats.live_bytes);
+	s_peaks[tag] = peak;
+	stats.peak_bytes = peak;
+	return stats;
+}
+
+void MemoryTags::DumpMemoryStats(const char* prefix)
+{
+	size_t count;
+	{
+		std::lock_guard<std::mutex> lock(s_tags_mutex);
+		count = s_tag_count;
+	}
+
+	LOGI("%s%-16s %10s %10s %10s %10s", prefix, "tag", "live", "peak", "allocs", "frees");
+	for (size_t i = 0; i < count; ++i)
+	{
+		Stats stats = GetStats(static_cast<MemoryTag>(i));
+		if (stats.alloc_count == 0) {
+			continue;
+		}
+
+		float pretty_live, pretty_peak;
+		const char* live_suffix = Utility::ToSize(static_cast<size_t>(std::max<int64_t>(stats.live_bytes, 0)), pretty_live);
+		const char* peak_suffix = Utility::ToSize(static_cast<size_t>(stats.peak_bytes), pretty_peak);
+		LOGI("%s%-16s %8.2f%-2s %8.2f%-2s %10llu %10llu", prefix, GetName(static_cast<MemoryTag>(i)),
+			pretty_live, live_suffix, pretty_peak, peak_suffix,
+			static_cast<unsigned long long>(stats.alloc_count), static_cast<unsigned long long>(stats.free_count));
+	}
+}
+
+bool MemoryTags::DumpStats(const char* filepath)
+{
+	FILE* fp = fopen(filepath, "w");
+	if (!fp) {
+		return false;
+	}
+
+	size_t count;
+	{
+		std::lock_guard<std::mutex> lock(s_tags_mutex);
+		count = s_tag_count;
+	}
+
+	fprintf(fp, "# tag live peak allocs frees\n");
+	for (size_t i = 0; i < count; ++i)
+	{
+		Stats stats = GetStats(static_cast<MemoryTag>(i));
+		fprintf(fp, "%s %lld %lld %llu %llu\n", GetName(static_cast<MemoryTag>(i)),
+			static_cast<long long>(stats.live_bytes), static_cast<long long>(stats.peak_bytes),
+			static_cast<unsigned long long>(stats.alloc_count), static_cast<unsigned long long>(stats.free_count));
+	}
+
+	fclose(fp);
+	return true;
+}
+
+}
@@ -0,0 +1,189 @@
+#include "memmgr/PageRegion.h"
+#include "memmgr/Utility.h"
+
+#include <logger.h>
+
+#include <assert.h>
+
+#ifndef ALIGN
+#define ALIGN(x, a)         (((x) + ((a) - 1)) & ~((a) - 1))
+#endif
+
+namespace mm
+{
+
+static std::mutex     s_regions_mutex;
+static ClassRegions*  s_regions = nullptr;
+
+PageRegion::PageRegion()
+	: m_base(nullptr)
+	, m_size(0)
+	, m_page_size(0)
+	, m_sys_page_size(0)
+	, m_top(nullptr)
+	, m_committed(nullptr)
+	, m_free(nullptr)
+	, m_used(0)
+	, m_exhausted_logged(false)
+{
+}
+
+void PageRegion::Init(uint8_t* base, size_t size, size_t page_size)
+{
+	assert(reinterpret_cast<size_t>(base) % page_size == 0);
+
+	m_base      = base;
+	m_size      = size;
+	m_page_size = page_size;
+	m_sys_page_size = Utility::GetVirtualPageSize();
+	m_top       = base;
+	m_committed = base;
+	m_free      = nullptr;
+	m_used      = 0;
+	m_exhausted_logged = false;
+}
+
+void* PageRegion::AllocatePage(bool* zeroed)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	uint8_t* page;
+	bool fresh = false;
+	if (m_free)
+	{
+		page = reinterpret_cast<uint8_t*>(m_free);
+		m_free = m_free->next;
+
+		// the first system page was never decommitted
+		size_t keep = m_sys_page_size;
+		if (m_page_size > keep && !Utility::CommitVirtual(page + keep, m_page_size - keep))
+		{
+			FreePageHeader* header = reinterpret_cast<FreePageHeader*>(page);
+			header->next = m_free;
+			m_free = header;
+			return nullptr;
+		}
+	}
+	else
+	{
+		if (m_top + m_page_size > m_base + m_size)
+		{
+			if (!m_exhausted_logged) {
+				LOGW("PageRegion: all %zu pages of %zu bytes in use, allocations fail", m_size / m_page_size, m_page_size);
+				m_exhausted_logged = true;
+			}
+			return nullptr;
+		}
+		// pages smaller than a system page are committed a system page
+		// at a time
+		if (m_top + m_page_size > m_committed)
+		{
+			size_t grain = m_page_size > m_sys_page_size ? m_page_size : m_sys_page_size;
+			if (!Utility::CommitVirtual(m_committed, grain)) {
+				return nullptr;
+			}
+			m_committed += grain;
+		}
+		page = m_top;
+		m_top += m_page_size;
+		fresh = true;
+	}
+
+	if (zeroed) {
+		*zeroed = fresh;
+	}
+	++m_used;
+	return page;
+}
+
+void PageRegion::FreePage(void* page)
+{
+	assert(Contains(page));
+
+	size_t keep = m_sys_page_size;
+	if (m_page_size > keep) {
+		Utility::DecommitVirtual(static_cast<uint8_t*>(page) + keep, m_page_size - keep);
+	}
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	FreePageHeader* header = static_cast<FreePageHeader*>(page);
+	header->next = m_free;
+	m_free = header;
+	--m_used;
+}
+
+ClassRegions::ClassRegions()
+	: m_base(nullptr)
+	, m_total_size(0)
+	, m_region_shift(0)
+	, m_num_classes(0)
+	, m_regions(nullptr)
+{
+}
+
+ClassRegions* ClassRegions::Acquire(size_t num_classes, size_t region_size, const size_t* page_sizes)
+{
+	std::lock_guard<std::mutex> lock(s_regions_mutex);
+
+	if (!s_regions)
+	{
+		ClassRegions* regions = new ClassRegions();
+		if (!regions->Init(num_classes, region_size, page_sizes))
+		{
+			delete regions;
+			return nullptr;
+		}
+		s_regions = regions;
+		return s_regions;
+	}
+
+	if (s_regions->m_num_classes != num_classes || s_regions->GetRegionSize() != region_size) {
+		return nullptr;
+	}
+	for (size_t i = 0; i < num_classes; ++i) {
+		if (s_regions->m_regions[i].GetPageSize() != page_sizes[i]) {
+			return nullptr;
+		}
+	}
+	return s_regions;
+}
+
+bool ClassRegions::Init(size_t num_classes, size_t region_size, const size_t* page_sizes)
+{
+	assert(region_size > 0 && (region_size & (region_size - 1)) == 0);
+
+	size_t max_page_size = 0;
+	for (size_t i = 0; i < num_classes; ++i)
+	{
+		assert(region_size % page_sizes[i] == 0);
+		if (page_sizes[i] > max_page_size) {
+			max_page_size = page_sizes[i];
+		}
+	}
+
+	// over-reserve so that every region starts on a page boundary; the
+	// reservation lives as long as the process
+	m_total_size = num_classes * region_size;
+	uint8_t* reserved = static_cast<uint8_t*>(Utility::ReserveVirtual(m_total_size + max_page_size));
+	if (!reserved)
+	{
+		LOGE("ClassRegions: can't reserve %zu bytes", m_total_size);
+		return false;
+	}
+	m_base = reinterpret_cast<uint8_t*>(ALIGN(reinterpret_cast<size_t>(reserved), max_page_size));
+
+	m_region_shift = 0;
+	while ((static_cast<size_t>(1) << m_region_shift) < region_size) {
+		++m_region_shift;
+	}
+
+	m_num_classes = num_classes;
+	m_regions = new PageRegion[num_classes];
+	for (size_t i = 0; i < num_classes; ++i) {
+		m_regions[i].Init(m_base + i * region_size, region_size, page_sizes[i]);
+	}
+	return true;
+}
+
+}
@@ -0,0 +1,396 @@
+#include "memmgr/PerCpuCache.h"
+#include "memmgr/Utility.h"
+
+#include <logger.h>
+
+#include <assert.h>
+#include <string.h>
+
+#if defined(__linux__) && defined(__x86_64__) && defined(__has_include)
+#if __has_include(<sys/rseq.h>)
+#include <sys/rseq.h>
+#include <unistd.h>
+#define MEMMGR_RSEQ
+#endif
+#endif
+
+#ifndef ALIGN
+#define ALIGN(x, a)         (((x) + ((a) - 1)) & ~((a) - 1))
+#endif
+
+namespace mm
+{
+
+static const size_t kCacheLine = BlockAllocator::CACHE_LINE_SIZE;
+
+#ifdef MEMMGR_RSEQ
+
+enum RseqResult
+{
+	RSEQ_DONE,
+	// the slab was empty, or full
+	RSEQ_FAILED,
+	// preempted, migrated or interrupted by a signal, try again
+	RSEQ_ABORTED,
+};
+
+// the area glibc registered for the calling thread
+static inline struct rseq* GetRseqArea()
+{
+	char* tp;
+	__asm__ ("movq %%fs:0, %0" : "=r"(tp));
+	return reinterpret_cast<struct rseq*>(tp + __rseq_offset);
+}
+
+// negative values, unregistered, come out above any CPU index
+static inline uint32_t ReadCpu(const struct rseq* area)
+{
+	return *reinterpret_cast<const volatile uint32_t*>(&area->cpu_id);
+}
+
+// In both sequences the store of the new count commits; the kernel sends
+// a thread preempted before it to the abort handler, which the signature
+// in front of it marks as one. The descriptor of each inlined copy goes
+// to the __rseq_cs section.
+
+static inline int RseqPop(struct rseq* area, uint32_t cpu, uintptr_t* count, void** blocks, void*& p)
+{
+	int ret;
+	__asm__ __volatile__ (
+		".pushsection __rseq_cs, \"aw\"\n\t"
+		".balign 32\n\t"
+		"3:\n\t"
+		".long 0x0, 0x0\n\t"
+		".quad 1f, (2f - 1f), 4f\n\t"
+		".popsection\n\t"
+		"leaq 3b(%%rip), %%rax\n\t"
+		"movq %%rax, %[rseq_cs]\n\t"
+		"1:\n\t"
+		"cmpl %[cpu], %[cpu_id]\n\t"
+		"jnz 4f\n\t"
+		"movq %[count], %%rax\n\t"
+		"testq %%rax, %%rax\n\t"
+		"jz 5f\n\t"
+		"movq -8(%[blocks], %%rax, 8), %[p]\n\t"
+		"decq %%rax\n\t"
+		"movq %%rax, %[count]\n\t"
+		"2:\n\t"
+		"movl %[done], %[ret]\n\t"
+		"jmp 6f\n\t"
+		"5:\n\t"
+		"movl %[failed], %[ret]\n\t"
+		"jmp 6f\n\t"
+		".pushsection __rseq_failure, \"ax\"\n\t"
+		".byte 0x0f, 0xb9, 0x3d\n\t"
+		".long %c[sig]\n\t"
+		"4:\n\t"
+		"movl %[aborted], %[ret]\n\t"
+		"jmp 6f\n\t"
+		".popsection\n\t"
+		"6:\n\t"
+		: [ret] "=&r"(ret), [p] "+&r"(p), [rseq_cs] "=m"(area->rseq_cs), [count] "+m"(*count)
+		: [cpu] "r"(cpu), [cpu_id] "m"(area->cpu_id), [blocks] "r"(blocks),
+		  [sig] "i"(RSEQ_SIG), [done] "i"(RSEQ_DONE), [failed] "i"(RSEQ_FAILED), [aborted] "i"(RSEQ_ABORTED)
+		: "rax", "memory", "cc");
+	return ret;
+}
+
+static inline int RseqPush(struct rseq* area, uint32_t cpu, uintptr_t* count, void** blocks, uintptr_t capacity, void* p)
+{
+	int ret;
+	__asm__ __volatile__ (
+		".pushsection __rseq_cs, \"aw\"\n\t"
+		".balign 32\n\t"
+		"3:\n\t"
+		".long 0x0, 0x0\n\t"
+		".quad 1f, (2f - 1f), 4f\n\t"
+		".popsection\n\t"
+		"leaq 3b(%%rip), %%rax\n\t"
+		"movq %%rax, %[rseq_cs]\n\t"
+		"1:\n\t"
+		"cmpl %[cpu], %[cpu_id]\n\t"
+		"jnz 4f\n\t"
+		"movq %[count], %%rax\n\t"
+		"cmpq %[capacity], %%rax\n\t"
+		"jae 5f\n\t"
+		"movq %[p], (%[blocks], %%rax, 8)\n\t"
+		"incq %%rax\n\t"
+		"movq %%rax, %[count]\n\t"
+		"2:\n\t"
+		"movl %[done], %[ret]\n\t"
+		"jmp 6f\n\t"
+		"5:\n\t"
+		"movl %[failed], %[ret]\n\t"
+		"jmp 6f\n\t"
+		".pushsection __rseq_failure, \"ax\"\n\t"
+		".byte 0x0f, 0xb9, 0x3d\n\t"
+		".long %c[sig]\n\t"
+		"4:\n\t"
+		"movl %[aborted], %[ret]\n\t"
+		"jmp 6f\n\t"
+		".popsection\n\t"
+		"6:\n\t"
+		: [ret] "=&r"(ret), [rseq_cs] "=m"(area->rseq_cs), [count] "+m"(*count)
+		: [cpu] "r"(cpu), [cpu_id] "m"(area->cpu_id), [blocks] "r"(blocks),
+		  [capacity] "r"(capacity), [p] "r"(p),
+		  [sig] "i"(RSEQ_SIG), [done] "i"(RSEQ_DONE), [failed] "i"(RSEQ_FAILED), [aborted] "i"(RSEQ_ABORTED)
+		: "rax", "memory", "cc");
+	return ret;
+}
+
+#endif // MEMMGR_RSEQ
+
+PerCpuCache::PerCpuCache(const BlockAllocatorPool::Config& cfg, size_t max_slots, size_t max_class_bytes)
+	: m_backend(cfg)
+	, m_cpus(nullptr)
+	, m_cpu_stride(0)
+	, m_num_cpus(0)
+	, m_slab_offsets(nullptr)
+	, m_capacities(nullptr)
+	, m_data_sizes(nullptr)
+	, m_num_classes(0)
+{
+	assert(max_slots > 0);
+
+	if (!IsRseqAvailable()) {
+		LOGI("PerCpuCache: no restartable sequences, using the shared pool");
+		return;
+	}
+
+#ifdef MEMMGR_RSEQ
+	long num_cpus = sysconf(_SC_NPROCESSORS_CONF);
+	if (num_cpus <= 0) {
+		return;
+	}
+	m_num_cpus = static_cast<uint32_t>(num_cpus);
+
+	m_num_classes  = m_backend.GetClassCount();
+	m_slab_offsets = new size_t[m_num_classes];
+	m_capacities   = new uintptr_t[m_num_classes];
+	m_data_sizes   = new size_t[m_num_classes];
+
+	size_t offset = 0;
+	for (size_t i = 0; i < m_num_classes; ++i)
+	{
+		BlockAllocatorPool::ClassInfo info;
+		m_backend.GetClassInfo(i, info);
+
+		// large classes cache fewer blocks, but at least two
+		size_t capacity = max_class_bytes / info.data_size;
+		if (capacity < 2) {
+			capacity = 2;
+		}
+		if (capacity > max_slots) {
+			capacity = max_slots;
+		}
+
+		m_slab_offsets[i] = offset;
+		m_capacities[i]   = capacity;
+		m_data_sizes[i]   = info.data_size;
+		offset += sizeof(uintptr_t) + capacity * sizeof(void*);
+	}
+
+	// no cache line is shared by two CPUs
+	m_cpu_stride = ALIGN(offset, kCacheLine);
+	m_cpus = static_cast<uint8_t*>(Utility::AlignedAlloc(m_cpu_stride * m_num_cpus, kCacheLine));
+	if (!m_cpus) {
+		LOGW("PerCpuCache: can't allocate the caches of %u CPUs, using the shared pool", m_num_cpus);
+		return;
+	}
+	memset(m_cpus, 0, m_cpu_stride * m_num_cpus);
+#endif // MEMMGR_RSEQ
+}
+
+PerCpuCache::~PerCpuCache()
+{
+	if (m_cpus)
+	{
+		m_backend.SetOwnerThread();
+		for (uint32_t cpu = 0; cpu < m_num_cpus; ++cpu)
+		{
+			for (size_t i = 0; i < m_num_classes; ++i)
+			{
+				Slab* slab = GetSlab(cpu, static_cast<int>(i));
+				for (uintptr_t j = 0; j < slab->count; ++j) {
+					m_backend.Free(slab->blocks[j], m_data_sizes[i]);
+				}
+			}
+		}
+		Utility::AlignedFree(m_cpus);
+	}
+
+	delete[] m_slab_offsets;
+	delete[] m_capacities;
+	delete[] m_data_sizes;
+}
+
+void* PerCpuCache::Allocate(size_t size)
+{
+	if (!m_cpus)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_backend.SetOwnerThread();
+		return m_backend.Allocate(size);
+	}
+
+	int cls = m_backend.GetClassIndex(size);
+	void* p;
+	if (cls >= 0 && PopLocal(cls, p)) {
+		return p;
+	}
+	return Refill(cls, size);
+}
+
+void PerCpuCache::Free(void* p, size_t size)
+{
+	if (!p) {
+		return;
+	}
+	if (!m_cpus)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_backend.SetOwnerThread();
+		m_backend.Free(p, size);
+		return;
+	}
+
+	int cls = m_backend.GetClassIndex(size);
+	if (cls >= 0 && PushLocal(cls, p)) {
+		return;
+	}
+	Flush(cls, p, size);
+}
+
+void PerCpuCache::Trim()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_backend.SetOwnerThread();
+	for (size_t i = 0; i < m_num_classes && m_cpus; ++i)
+	{
+		void* p;
+		while (PopLocal(static_cast<int>(i), p)) {
+			m_backend.Free(p, m_data_sizes[i]);
+		}
+	}
+	m_backend.Trim();
+}
+
+size_t PerCpuCache::GetCachedBlockCount() const
+{
+	size_t count = 0;
+	for (uint32_t cpu = 0; cpu < m_num_cpus && m_cpus; ++cpu) {
+		for (size_t i = 0; i < m_num_classes; ++i) {
+			count += *reinterpret_cast<const volatile uintptr_t*>(&GetSlab(cpu, static_cast<int>(i))->count);
+		}
+	}
+	return count;
+}
+
+bool PerCpuCache::PopLocal(int cls, void*& p)
+{
+#ifdef MEMMGR_RSEQ
+	struct rseq* area = GetRseqArea();
+	for (;;)
+	{
+		uint32_t cpu = ReadCpu(area);
+		if (cpu >= m_num_cpus) {
+			return false;
+		}
+		Slab* slab = GetSlab(cpu, cls);
+		int ret = RseqPop(area, cpu, &slab->count, slab->blocks, p);
+		if (ret != RSEQ_ABORTED) {
+			return ret == RSEQ_DONE;
+		}
+	}
+#else
+	return false;
+#endif // MEMMGR_RSEQ
+}
+
+bool PerCpuCache::PushLocal(int cls, void* p)
+{
+#ifdef MEMMGR_RSEQ
+	struct rseq* area = GetRseqArea();
+	for (;;)
+	{
+		uint32_t cpu = ReadCpu(area);
+		if (cpu >= m_num_cpus) {
+			return false;
+		}
+		Slab* slab = GetSlab(cpu, cls);
+		int ret = RseqPush(area, cpu, &slab->count, slab->blocks, m_capacities[cls], p);
+		if (ret != RSEQ_ABORTED) {
+			return ret == RSEQ_DONE;
+		}
+	}
+#else
+	return false;
+#endif // MEMMGR_RSEQ
+}
+
+void* PerCpuCache::Refill(int cls, size_t size)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_backend.SetOwnerThread();
+
+	void* ret = m_backend.Allocate(size);
+	if (!ret || cls < 0) {
+		return ret;
+	}
+
+	// half a cache, which leaves room for as many frees
+	size_t data_size = m_data_sizes[cls];
+	for (uintptr_t i = m_capacities[cls] / 2; i > 0; --i)
+	{
+		void* p = m_backend.Allocate(data_size);
+		if (!p) {
+			break;
+		}
+		// another thread on this CPU filled it meanwhile
+		if (!PushLocal(cls, p))
+		{
+			m_backend.Free(p, data_size);
+			break;
+		}
+	}
+	return ret;
+}
+
+void PerCpuCache::Flush(int cls, void* p, size_t size)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_backend.SetOwnerThread();
+
+	if (cls >= 0)
+	{
+		size_t data_size = m_data_sizes[cls];
+		for (uintptr_t i = m_capacities[cls] / 2; i > 0; --i)
+		{
+			void* q;
+			if (!PopLocal(cls, q)) {
+				break;
+			}
+			m_backend.Free(q, data_size);
+		}
+	}
+	m_backend.Free(p, size);
+}
+
+bool PerCpuCache::IsRseqAvailable()
+{
+#ifdef MEMMGR_RSEQ
+	// glibc registers every thread, unless told not to
+	return __rseq_size > 0 && static_cast<int32_t>(ReadCpu(GetRseqArea())) >= 0;
+#else
+	return false;
+#endif // MEMMGR_RSEQ
+}
+
+PerCpuCache* PerCpuCache::Instance()
+{
+	// never destroyed, blocks may be freed during static destruction
+	static PerCpuCache* instance = new PerCpuCache();
+	return instance;
+}
+
+}
@@ -0,0 +1,378 @@
+#include "memmgr/SharedPool.h"
+#include "memmgr/Utility.h"
+
+#include <logger.h>
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif // _WIN32
+
+#include <atomic>
+#include <new>
+
+#ifndef ALIGN
+#define ALIGN(x, a)         (((x) + ((a) - 1)) & ~((a) - 1))
+#endif
+
+namespace mm
+{
+
+// other processes see the same words through other mappings
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2,
+	"SharedPool needs address-free atomics");
+
+static const char     kPoolMagic[4] = { 'M', 'M', 'S', 'P' };
+static const uint32_t kPoolVersion  = 1;
+
+static const size_t   kMinBlockSize = 64;
+// carved at once for classes of smaller blocks
+static const size_t   kChunkSize    = 64 * 1024;
+// free list links count in units, so that 32 bits span 64GB
+static const size_t   kOffsetUnit   = 16;
+static const uint64_t kMaxSize      = static_cast<uint64_t>(kOffsetUnit) << 32;
+static const uint32_t kMaxClasses   = 32;
+
+struct SharedPool::BlockHeader
+{
+	// next free block in offset units, while on a free list
+	std::atomic<uint32_t> next;
+	uint32_t cls;
+	uint64_t reserved;
+};
+
+struct SharedPool::Header
+{
+	char     magic[4];
+	uint32_t version;
+	uint64_t size;
+	uint32_t num_classes;
+
+	// the end of the carved part of the region
+	alignas(64) std::atomic<uint64_t> top;
+
+	struct alignas(64) FreeList
+	{
+		// (tag << 32) | first block in offset units; the tag changes with
+		// every update, so a head that was popped and pushed back between
+		// a read and the swap doesn't match
+		std::atomic<uint64_t> head;
+		std::atomic<uint64_t> live;
+	};
+	FreeList lists[kMaxClasses];
+};
+
+static inline size_t ClassBlockSize(uint32_t cls)
+{
+	return kMinBlockSize << cls;
+}
+
+SharedPool::SharedPool()
+	: m_base(nullptr)
+	, m_size(0)
+	, m_fd(-1)
+{
+}
+
+SharedPool::~SharedPool()
+{
+#ifndef _WIN32
+	if (m_base) {
+		munmap(m_base, m_size);
+	}
+	if (m_fd >= 0) {
+		close(m_fd);
+	}
+#endif // _WIN32
+}
+
+SharedPool* SharedPool::Create(size_t size, size_t max_block_size)
+{
+#ifdef _WIN32
+	LOGW("SharedPool: not supported");
+	return nullptr;
+#else
+	int fd = -1;
+#if defined(__linux__) && defined(MFD_CLOEXEC)
+	fd = memfd_create("memmgr", MFD_CLOEXEC);
+#endif
+	if (fd < 0)
+	{
+		// a name nobody else can have, gone as soon as it's open
+		static std::atomic<uint32_t> s_counter(0);
+		char name[64];
+		snprintf(name, sizeof(name), "/memmgr-%d-%u", static_cast<int>(getpid()), s_counter.fetch_add(1));
+		fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+		if (fd >= 0) {
+			shm_unlink(name);
+		}
+	}
+	if (fd < 0) {
+		return nullptr;
+	}
+	return Map(fd, true, size, max_block_size);
+#endif // _WIN32
+}
+
+SharedPool* SharedPool::Create(const char* name, size_t size, size_t max_block_size)
+{
+#ifdef _WIN32
+	LOGW("SharedPool: not supported");
+	return nullptr;
+#else
+	int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+	if (fd < 0) {
+		return nullptr;
+	}
+	SharedPool* pool = Map(fd, true, size, max_block_size);
+	if (!pool) {
+		shm_unlink(name);
+	}
+	return pool;
+#endif // _WIN32
+}
+
+SharedPool* SharedPool::Open(const char* name)
+{
+#ifdef _WIN32
+	return nullptr;
+#else
+	int fd = shm_open(name, O_RDWR, 0);
+	return fd < 0 ? nullptr : Map(fd, false, 0, 0);
+#endif // _WIN32
+}
+
+SharedPool* SharedPool::Attach(int fd)
+{
+#ifdef _WIN32
+	return nullptr;
+#else
+	// the caller keeps its descriptor
+	fd = dup(fd);
+	return fd < 0 ? nullptr : Map(fd, false, 0, 0);
+#endif // _WIN32
+}
+
+bool SharedPool::Unlink(const char* name)
+{
+#ifdef _WIN32
+	return false;
+#else
+	return shm_unlink(name) == 0;
+#endif // _WIN32
+}
+
+SharedPool* SharedPool::Map(int fd, bool init, size_t size, size_t max_block_size)
+{
+	SharedPool* pool = new SharedPool();
+	pool->m_fd = fd;
+
+#ifndef _WIN32
+	if (init)
+	{
+		size = ALIGN(size, kOffsetUnit);
+		if (size <= sizeof(Header) || size > kMaxSize || ftruncate(fd, static_cast<off_t>(size)) != 0)
+		{
+			delete pool;
+			return nullptr;
+		}
+	}
+	else
+	{
+		struct stat st;
+		if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) <= sizeof(Header))
+		{
+			delete pool;
+			return nullptr;
+		}
+		size = static_cast<size_t>(st.st_size);
+	}
+
+	void* map = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED)
+	{
+		delete pool;
+		return nullptr;
+	}
+	pool->m_base = static_cast<uint8_t*>(map);
+	pool->m_size = size;
+#endif // _WIN32
+
+	Header* header = pool->GetHeader();
+	if (init)
+	{
+		// the region reads as zero, which is what the atomics start at
+		header = new (pool->m_base) Header();
+		memcpy(header->magic, kPoolMagic, sizeof(header->magic));
+		header->version = kPoolVersion;
+		header->size    = size;
+
+		uint32_t num_classes = 1;
+		while (ClassBlockSize(num_classes - 1) - sizeof(BlockHeader) < max_block_size && num_classes < kMaxClasses) {
+			++num_classes;
+		}
+		header->num_classes = num_classes;
+		header->top.store(ALIGN(sizeof(Header), kMinBlockSize));
+	}
+	else if (memcmp(header->magic, kPoolMagic, sizeof(header->magic)) != 0 ||
+		header->version != kPoolVersion || header->size != size)
+	{
+		LOGW("SharedPool: not a pool region");
+		delete pool;
+		return nullptr;
+	}
+	return pool;
+}
+
+void* SharedPool::Allocate(size_t size)
+{
+	Header* header = GetHeader();
+	size += sizeof(BlockHeader);
+
+	uint32_t cls = 0;
+	while (cls < header->num_classes && ClassBlockSize(cls) < size) {
+		++cls;
+	}
+	if (cls == header->num_classes) {
+		return nullptr;
+	}
+
+	BlockHeader* block = Pop(cls);
+	if (!block) {
+		block = Refill(cls);
+	}
+	if (!block) {
+		return nullptr;
+	}
+	header->lists[cls].live.fetch_add(1, std::memory_order_relaxed);
+	return block + 1;
+}
+
+void SharedPool::Free(void* p)
+{
+	if (!p) {
+		return;
+	}
+	assert(Contains(p));
+
+	BlockHeader* block = static_cast<BlockHeader*>(p) - 1;
+	uint32_t cls = block->cls;
+	assert(cls < GetHeader()->num_classes);
+	GetHeader()->lists[cls].live.fetch_sub(1, std::memory_order_relaxed);
+	Push(cls, block, block);
+}
+
+SharedPool::BlockHeader* SharedPool::Pop(uint32_t cls)
+{
+	std::atomic<uint64_t>& head = GetHeader()->lists[cls].head;
+	uint64_t old_head = head.load(std::memory_order_acquire);
+	for (;;)
+	{
+		uint32_t first = static_cast<uint32_t>(old_head);
+		if (!first) {
+			return nullptr;
+		}
+		// the block may be taken meanwhile, but it stays mapped, and the
+		// tag fails the swap then
+		BlockHeader* block = reinterpret_cast<BlockHeader*>(m_base + first * kOffsetUnit);
+		uint64_t next = block->next.load(std::memory_order_relaxed);
+		uint64_t new_head = (((old_head >> 32) + 1) << 32) | next;
+		if (head.compare_exchange_weak(old_head, new_head, std::memory_order_acquire, std::memory_order_acquire)) {
+			return block;
+		}
+	}
+}
+
+void SharedPool::Push(uint32_t cls, BlockHeader* first, BlockHeader* last)
+{
+	std::atomic<uint64_t>& head = GetHeader()->lists[cls].head;
+	uint64_t unit = static_cast<uint64_t>(reinterpret_cast<uint8_t*>(first) - m_base) / kOffsetUnit;
+	uint64_t old_head = head.load(std::memory_order_relaxed);
+	for (;;)
+	{
+		last->next.store(static_cast<uint32_t>(old_head), std::memory_order_relaxed);
+		uint64_t new_head = (((old_head >> 32) + 1) << 32) | unit;
+		if (head.compare_exchange_weak(old_head, new_head, std::memory_order_release, std::memory_order_relaxed)) {
+			return;
+		}
+	}
+}
+
+SharedPool::BlockHeader* SharedPool::Refill(uint32_t cls)
+{
+	Header* header = GetHeader();
+	size_t block_size = ClassBlockSize(cls);
+	size_t chunk = block_size < kChunkSize ? kChunkSize : block_size;
+
+	uint64_t top = header->top.load(std::memory_order_relaxed);
+	for (;;)
+	{
+		// the end of the region fits a single block still
+		if (top + chunk > m_size) {
+			chunk = block_size;
+		}
+		if (top + chunk > m_size) {
+			return nullptr;
+		}
+		if (header->top.compare_exchange_weak(top, top + chunk, std::memory_order_relaxed)) {
+			break;
+		}
+	}
+
+	// the first block is handed out, the others linked and pushed at once
+	uint8_t* p = m_base + top;
+	size_t count = chunk / block_size;
+	for (size_t i = 0; i < count; ++i)
+	{
+		BlockHeader* block = reinterpret_cast<BlockHeader*>(p + i * block_size);
+		block->cls = cls;
+		if (i + 1 < count) {
+			block->next.store(static_cast<uint32_t>((top + (i + 1) * block_size) / kOffsetUnit), std::memory_order_relaxed);
+		}
+	}
+	if (count > 1) {
+		Push(cls, reinterpret_cast<BlockHeader*>(p + block_size), reinterpret_cast<BlockHeader*>(p + (count - 1) * block_size));
+	}
+	return reinterpret_cast<BlockHeader*>(p);
+}
+
+size_t SharedPool::GetCarvedSize() const
+{
+	return static_cast<size_t>(GetHeader()->top.load(std::memory_order_relaxed));
+}
+
+size_t SharedPool::GetLiveBlockCount() const
+{
+	const Header* header = GetHeader();
+	uint64_t live = 0;
+	for (uint32_t i = 0; i < header->num_classes; ++i) {
+		live += header->lists[i].live.load(std::memory_order_relaxed);
+	}
+	return static_cast<size_t>(live);
+}
+
+void SharedPool::DumpMemoryStats(const char* prefix) const
+{
+	const Header* header = GetHeader();
+	LOGI("%s  block   live", prefix);
+	for (uint32_t i = 0; i < header->num_classes; ++i)
+	{
+		uint64_t live = header->lists[i].live.load(std::memory_order_relaxed);
+		if (live) {
+			LOGI("%s%7zu %6llu", prefix, ClassBlockSize(i), static_cast<unsigned long long>(live));
+		}
+	}
+
+	float pretty_carved, pretty_size;
+	const char* carved_suffix = Utility::ToSize(GetCarvedSize(), pretty_carved);
+	const char* size_suffix   = Utility::ToSize(m_size, pretty_size);
+	LOGI("%sCarved %.2f%s of %.2f%s", prefix, pretty_carved, carved_suffix, pretty_size, size_suffix);
+}
+
+}
@@ -0,0 +1,218 @@
+#include "memmgr/SizeClassTuner.h"
+#include "memmgr/BlockAllocatorPool.h"
+
+#include <stdio.h>
+
+#ifndef ALIGN
+#define ALIGN(x, a)         (((x) + ((a) - 1)) & ~((a) - 1))
+#endif
+
+namespace mm
+{
+
+void SizeClassTuner::AddRequests(size_t size, uint64_t count)
+{
+	// a zero byte request still takes the smallest class
+	if (size == 0) {
+		size = 1;
+	}
+	if (size >= m_counts.size()) {
+		m_counts.resize(size + 1, 0);
+	}
+	m_counts[size] += count;
+}
+
+void SizeClassTuner::AddHistogram(const uint64_t* counts, size_t n)
+{
+	for (size_t i = 0; i < n; ++i) {
+		if (counts[i]) {
+			AddRequests(i, counts[i]);
+		}
+	}
+}
+
+void SizeClassTuner::AddHistogram(const BlockAllocatorPool& pool)
+{
+	const uint64_t* counts = pool.GetHistogram();
+	if (counts) {
+		AddHistogram(counts, pool.GetMaxBlockSize() + 1);
+	}
+}
+
+bool SizeClassTuner::LoadHistogram(const char* filepath)
+{
+	FILE* fp = fopen(filepath, "r");
+	if (!fp) {
+		return false;
+	}
+
+	char line[128];
+	while (fgets(line, sizeof(line), fp))
+	{
+		unsigned long size;
+		unsigned long long count;
+		if (line[0] != '#' && sscanf(line, "%lu %llu", &size, &count) == 2) {
+			AddRequests(size, count);
+		}
+	}
+
+	fclose(fp);
+	return true;
+}
+
+size_t SizeClassTuner::Optimize(size_t max_classes, size_t alignment, uint32_t* sizes) const
+{
+	// An optimal class always ends at a requested size rounded up to the
+	// alignment, so only those are candidates. Candidate k gathers the
+	// requests rounding up to it.
+	std::vector<size_t> cand;
+	std::vector<double> weight, bytes;
+	for (size_t s = 1; s < m_counts.size(); ++s)
+	{
+		if (!m_counts[s]) {
+			continue;
+		}
+		size_t c = ALIGN(s, alignment);
+		if (cand.empty() || cand.back() != c) {
+			cand.push_back(c);
+			weight.push_back(0);
+			bytes.push_back(0);
+		}
+		weight.back() += static_cast<double>(m_counts[s]);
+		bytes.back()  += static_cast<double>(m_counts[s]) * static_cast<double>(s);
+	}
+
+	size_t m = cand.size();
+	if (m == 0 || max_classes == 0) {
+		return 0;
+	}
+	if (m <= max_classes)
+	{
+		for (size_t i = 0; i < m; ++i) {
+			sizes[i] = static_cast<uint32_t>(cand[i]);
+		}
+		return m;
+	}
+
+	// prefix sums, index 0 is empty
+	std::vector<double> W(m + 1, 0), S(m + 1, 0);
+	for (size_t i = 0; i < m; ++i) {
+		W[i + 1] = W[i] + weight[i];
+		S[i + 1] = S[i] + bytes[i];
+	}
+	// waste of one class at candidate b-1 serving candidates a to b-1
+	auto cost = [&](size_t a, size_t b) {
+		return static_cast<double>(cand[b - 1]) * (W[b] - W[a]) - (S[b] - S[a]);
+	};
+
+	// best[j][b]: least waste covering the first b candidates with j + 1
+	// classes, the last one at candidate b - 1
+	size_t k = max_classes;
+	std::vector<std::vector<double> > best(k, std::vector<double>(m + 1, 0));
+	std::vector<std::vector<uint32_t> > from(k, std::vector<uint32_t>(m + 1, 0));
+	for (size_t b = 1; b <= m; ++b) {
+		best[0][b] = cost(0, b);
+	}
+	for (size_t j = 1; j < k; ++j)
+	{
+		for (size_t b = j + 1; b <= m; ++b)
+		{
+			double min_waste = -1;
+			for (size_t a = j; a < b; ++a)
+			{
+				double waste = best[j - 1][a] + cost(a, b);
+				if (min_waste < 0 || waste < min_waste) {
+					min_waste = waste;
+					from[j][b] = static_cast<uint32_t>(a);
+				}
+			}
+			best[j][b] = min_waste;
+		}
+	}
+
+	size_t b = m;
+	for (size_t j = k; j-- > 0; )
+	{
+		sizes[j] = static_cast<uint32_t>(cand[b - 1]);
+		b = from[j][b];
+	}
+	return k;
+}
+
+double SizeClassTuner::CalcExpectedWaste(const uint32_t* sizes, size_t n) const
+{
+	double waste = 0, requests = 0;
+	size_t cls = 0;
+	for (size_t s = 1; s < m_counts.size() && n > 0; ++s)
+	{
+		while (cls < n && sizes[cls] < s) {
+			++cls;
+		}
+		if (cls == n) {
+			break;
+		}
+		waste    += static_cast<double>(m_counts[s]) * static_cast<double>(sizes[cls] - s);
+		requests += static_cast<double>(m_counts[s]);
+	}
+	return requests > 0 ? waste / requests : 0;
+}
+
+bool SizeClassTuner::DumpClassTable(const char* filepath, const uint32_t* sizes, size_t n)
+{
+	FILE* fp = fopen(filepath, "w");
+	if (!fp) {
+		return false;
+	}
+
+	fprintf(fp, "# size\n");
+	for (size_t i = 0; i < n; ++i) {
+		fprintf(fp, "%u\n", sizes[i]);
+	}
+
+	fclose(fp);
+	return true;
+}
+
+size_t SizeClassTuner::LoadClassTable(const char* filepath, uint32_t* sizes, size_t max_count)
+{
+	FILE* fp = fopen(filepath, "r");
+	if (!fp) {
+		return 0;
+	}
+
+	size_t n = 0;
+	char line[128];
+	while (n < max_count && fgets(line, sizeof(line), fp))
+	{
+		unsigned int size;
+		if (line[0] != '#' && sscanf(line, "%u", &size) == 1) {
+			sizes[n++] = size;
+		}
+	}
+
+	fclose(fp);
+	return n;
+}
+
+bool SizeClassTuner::DumpClassTableSource(const char* filepath, const uint32_t* sizes, size_t n)
+{
+	FILE* fp = fopen(filepath, "w");
+	if (!fp) {
+		return false;
+	}
+
+	fprintf(fp, "// generated by SizeClassTuner\n");
+	fprintf(fp, "static const uint32_t kBlockSizes[] = {");
+	for (size_t i = 0; i < n; ++i) {
+		fprintf(fp, "%s%u", i % 12 == 0 ? "\n    " : " ", sizes[i]);
+		if (i + 1 < n) {
+			fprintf(fp, ",");
+		}
+	}
+	fprintf(fp, "\n};\n");
+
+	fclose(fp);
+	return true;
+}
+
+}
@@ -1,5 +1,14 @@
 #include "memmgr/Utility.h"
 
+#include <stdlib.h>
+#ifdef _WIN32
+#include <malloc.h>
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif // _WIN32
+
 namespace mm
 {
 
@@ -17,4 +26,79 @@ const char* Utility::ToSize(size_t value, float& result)
 	return "MB";
 }
 
+void* Utility::AlignedAlloc(size_t size, size_t alignment)
+{
+#ifdef _WIN32
+	return _aligned_malloc(size, alignment);
+#else
+	if (alignment < sizeof(void*)) {
+		alignment = sizeof(void*);
+	}
+	void* p = nullptr;
+	if (posix_memalign(&p, alignment, size) != 0) {
+		return nullptr;
+	}
+	return p;
+#endif // _WIN32
+}
+
+void Utility::AlignedFree(void* p)
+{
+#ifdef _WIN32
+	_aligned_free(p);
+#else
+	free(p);
+#endif // _WIN32
+}
+
+size_t Utility::GetVirtualPageSize()
+{
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwPageSize;
+#else
+	return static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#endif // _WIN32
+}
+
+void* Utility::ReserveVirtual(size_t size)
+{
+#ifdef _WIN32
+	return VirtualAlloc(nullptr, size, MEM_RESERVE, PAGE_NOACCESS);
+#else
+	void* p = mmap(nullptr, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	return p == MAP_FAILED ? nullptr : p;
+#endif // _WIN32
+}
+
+bool Utility::CommitVirtual(void* p, size_t size)
+{
+#ifdef _WIN32
+	return VirtualAlloc(p, size, MEM_COMMIT, PAGE_READWRITE) != nullptr;
+#else
+	return mprotect(p, size, PROT_READ | PROT_WRITE) == 0;
+#endif // _WIN32
+}
+
+void Utility::DecommitVirtual(void* p, size_t size)
+{
+#ifdef _WIN32
+	VirtualFree(p, size, MEM_DECOMMIT);
+#else
+	// drops the backing pages, the range stays mapped
+	madvise(p, size, MADV_DONTNEED);
+#endif // _WIN32
+}
+
+void Utility::ReleaseVirtual(void* p, size_t size)
+{
+#ifdef _WIN32
+	(void)size;
+	VirtualFree(p, 0, MEM_RELEASE);
+#else
+	munmap(p, size);
+#endif // _WIN32
+}
+
 }
\ No newline at end of file
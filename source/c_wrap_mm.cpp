@@ -2,6 +2,9 @@
 
 #include "memmgr/Allocator.h"
 
+#include <stdint.h>
+#include <string.h>
+
 namespace mm
 {
 
@@ -17,4 +20,55 @@ void  mm_free(void* p, size_t size)
 	AllocHelper::Free(p, size);
 }
 
+extern "C"
+void* mm_calloc(size_t count, size_t size)
+{
+	if (size && count > SIZE_MAX / size) {
+		return nullptr;
+	}
+	return BlockAllocatorPool::Instance()->AllocateZeroed(count * size);
+}
+
+extern "C"
+void* mm_realloc(void* p, size_t old_size, size_t new_size)
+{
+	if (new_size == 0)
+	{
+		if (p) {
+			AllocHelper::Free(p, old_size);
+		}
+		return nullptr;
+	}
+	return BlockAllocatorPool::Instance()->Reallocate(p, old_size, new_size);
+}
+
+extern "C"
+size_t mm_usable_size(void* p, size_t size)
+{
+	return p ? BlockAllocatorPool::Instance()->GetUsableSize(size) : 0;
+}
+
+extern "C"
+void mm_stats(mm_pool_stats* stats)
+{
+	BlockAllocatorPool* pool = BlockAllocatorPool::Instance();
+
+	memset(stats, 0, sizeof(*stats));
+	for (size_t i = 0, n = pool->GetClassCount(); i < n; ++i)
+	{
+		BlockAllocatorPool::ClassInfo info;
+		pool->GetClassInfo(i, info);
+		stats->page_bytes += info.page_size * info.pages;
+		stats->used_bytes += info.block_size * (info.blocks - info.free_blocks);
+		stats->free_bytes += info.block_size * info.free_blocks;
+	}
+	stats->large_bytes = pool->GetLargeBytes();
+}
+
+extern "C"
+void mm_trim(void)
+{
+	BlockAllocatorPool::Instance()->Trim();
+}
+
 }
\ No newline at end of file